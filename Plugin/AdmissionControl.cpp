@@ -0,0 +1,162 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "AdmissionControl.h"
+
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+
+
+namespace OrthancPlugins
+{
+  bool AdmissionControl::Enter()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maximumActive_ == 0 ||
+        active_ < maximumActive_)
+    {
+      active_++;
+      countAdmitted_++;
+      return true;
+    }
+    else if (queued_ >= maximumQueued_)
+    {
+      countRejected_++;
+      return false;
+    }
+    else
+    {
+      const boost::system_time deadline = (boost::get_system_time() +
+                                           boost::posix_time::milliseconds(queueTimeout_));
+
+      queued_++;
+      countQueued_++;
+
+      while (maximumActive_ != 0 &&
+             active_ >= maximumActive_)
+      {
+        if (!released_.timed_wait(lock, deadline))
+        {
+          queued_--;
+          countTimeouts_++;
+          return false;
+        }
+      }
+
+      queued_--;
+      active_++;
+      countAdmitted_++;
+      return true;
+    }
+  }
+
+
+  void AdmissionControl::Leave()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      assert(active_ > 0);
+      active_--;
+    }
+
+    released_.notify_one();
+  }
+
+
+  AdmissionControl::Ticket::Ticket(AdmissionControl& that) :
+    that_(that)
+  {
+    if (!that_.Enter())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, Orthanc::HttpStatus_503_ServiceUnavailable,
+                                      "Too many concurrent calls to TCIA, the request is rejected", false);
+    }
+  }
+
+
+  AdmissionControl::Ticket::~Ticket()
+  {
+    that_.Leave();
+  }
+
+
+  AdmissionControl::AdmissionControl() :
+    maximumActive_(0),
+    maximumQueued_(0),
+    queueTimeout_(0),
+    active_(0),
+    queued_(0),
+    countAdmitted_(0),
+    countQueued_(0),
+    countRejected_(0),
+    countTimeouts_(0)
+  {
+  }
+
+
+  void AdmissionControl::Configure(unsigned int maximumActive,
+                                   unsigned int maximumQueued,
+                                   unsigned int queueTimeout)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      maximumActive_ = maximumActive;
+      maximumQueued_ = maximumQueued;
+      queueTimeout_ = queueTimeout;
+    }
+
+    // Wake up the waiting calls, as more slots might be available
+    released_.notify_all();
+  }
+
+
+  unsigned int AdmissionControl::GetMaximumActive()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maximumActive_;
+  }
+
+
+  void AdmissionControl::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["MaximumActive"] = maximumActive_;
+    target["MaximumQueued"] = maximumQueued_;
+    target["QueueTimeout"] = queueTimeout_;
+    target["Active"] = active_;
+    target["Queued"] = queued_;
+    target["CountAdmitted"] = boost::lexical_cast<std::string>(countAdmitted_);
+    target["CountQueued"] = boost::lexical_cast<std::string>(countQueued_);
+    target["CountRejected"] = boost::lexical_cast<std::string>(countRejected_);
+    target["CountTimeouts"] = boost::lexical_cast<std::string>(countTimeouts_);
+  }
+
+
+  AdmissionControl& AdmissionControl::GetInstance()
+  {
+    static AdmissionControl admission;
+    return admission;
+  }
+}
@@ -0,0 +1,89 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <stdint.h>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Admission control in front of the synchronous calls to TCIA that
+   * are made by the HTTP threads of Orthanc. At most a fixed number
+   * of calls are in flight, a bounded number of calls wait for their
+   * turn, and the other calls are rejected at once. This way, a slow
+   * TCIA cannot hold all the HTTP threads of Orthanc, which would
+   * starve the unrelated REST and DICOMweb traffic.
+   **/
+  class AdmissionControl : public boost::noncopyable
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  released_;
+    unsigned int               maximumActive_;   // "0" means no limit
+    unsigned int               maximumQueued_;
+    unsigned int               queueTimeout_;    // In milliseconds
+    unsigned int               active_;
+    unsigned int               queued_;
+    uint64_t                   countAdmitted_;
+    uint64_t                   countQueued_;
+    uint64_t                   countRejected_;   // Because of a full queue
+    uint64_t                   countTimeouts_;
+
+    bool Enter();
+
+    void Leave();
+
+  public:
+    /**
+     * Slot for one call to TCIA. The constructor throws an exception
+     * with HTTP status "503 Service Unavailable" if no slot can be
+     * obtained, which is to be answered by
+     * "HttpHelpers::AnswerServiceUnavailable()".
+     **/
+    class Ticket : public boost::noncopyable
+    {
+    private:
+      AdmissionControl&  that_;
+
+    public:
+      explicit Ticket(AdmissionControl& that);
+
+      ~Ticket();
+    };
+
+    AdmissionControl();
+
+    void Configure(unsigned int maximumActive,
+                   unsigned int maximumQueued,
+                   unsigned int queueTimeout);
+
+    // "0" means no limit
+    unsigned int GetMaximumActive();
+
+    void GetStatistics(Json::Value& target);
+
+    static AdmissionControl& GetInstance();
+  };
+}
@@ -0,0 +1,274 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "CircuitBreaker.h"
+
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+
+static boost::posix_time::ptime GetNow()
+{
+  return boost::posix_time::microsec_clock::universal_time();
+}
+
+
+namespace OrthancPlugins
+{
+  static const char* GetStateName(CircuitBreaker::State state)
+  {
+    switch (state)
+    {
+      case CircuitBreaker::State_Closed:
+        return "Closed";
+
+      case CircuitBreaker::State_Open:
+        return "Open";
+
+      case CircuitBreaker::State_HalfOpen:
+        return "HalfOpen";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void CircuitBreaker::ClearWindow()
+  {
+    std::fill(window_.begin(), window_.end(), false);
+    windowPosition_ = 0;
+    windowCount_ = 0;
+    windowFailures_ = 0;
+  }
+
+
+  void CircuitBreaker::Open()
+  {
+    state_ = State_Open;
+    openedAt_ = GetNow();
+    countTrips_++;
+  }
+
+
+  bool CircuitBreaker::Enter(bool& isProbe)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    isProbe = false;
+
+    if (state_ == State_Open &&
+        GetNow() >= openedAt_ + boost::posix_time::seconds(openDuration_))
+    {
+      state_ = State_HalfOpen;
+      isProbing_ = false;
+    }
+
+    switch (state_)
+    {
+      case State_Closed:
+        return true;
+
+      case State_HalfOpen:
+        if (isProbing_)
+        {
+          // Only one probe at once
+          countFailFast_++;
+          return false;
+        }
+        else
+        {
+          isProbing_ = true;
+          isProbe = true;
+          return true;
+        }
+
+      case State_Open:
+        countFailFast_++;
+        return false;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
+  void CircuitBreaker::Leave(bool isProbe,
+                             bool hasOutcome,
+                             bool success)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (isProbe)
+    {
+      isProbing_ = false;
+
+      if (hasOutcome &&
+          state_ == State_HalfOpen)
+      {
+        if (success)
+        {
+          state_ = State_Closed;
+          ClearWindow();
+        }
+        else
+        {
+          Open();
+        }
+      }
+    }
+    else if (hasOutcome &&
+             state_ == State_Closed &&
+             threshold_ != 0 &&
+             !window_.empty())
+    {
+      // Replace the oldest outcome of the window
+      if (windowCount_ == window_.size())
+      {
+        if (window_[windowPosition_])
+        {
+          windowFailures_--;
+        }
+      }
+      else
+      {
+        windowCount_++;
+      }
+
+      window_[windowPosition_] = !success;
+      if (!success)
+      {
+        windowFailures_++;
+      }
+
+      windowPosition_ = (windowPosition_ + 1) % window_.size();
+
+      // Only decide once half of the window is filled, to avoid tripping on the first failures
+      if (2 * windowCount_ >= window_.size() &&
+          windowFailures_ * 100 >= static_cast<size_t>(threshold_) * windowCount_)
+      {
+        Open();
+        ClearWindow();
+      }
+    }
+  }
+
+
+  CircuitBreaker::Call::Call(CircuitBreaker& that) :
+    that_(that),
+    isProbe_(false),
+    hasOutcome_(false)
+  {
+    if (!that_.Enter(isProbe_))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, Orthanc::HttpStatus_503_ServiceUnavailable,
+                                      "TCIA is currently unavailable, the circuit breaker is open", false);
+    }
+  }
+
+
+  CircuitBreaker::Call::~Call()
+  {
+    if (!hasOutcome_)
+    {
+      that_.Leave(isProbe_, false, false);
+    }
+  }
+
+
+  void CircuitBreaker::Call::SetOutcome(bool success)
+  {
+    if (hasOutcome_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      hasOutcome_ = true;
+      that_.Leave(isProbe_, true, success);
+    }
+  }
+
+
+  CircuitBreaker::CircuitBreaker() :
+    state_(State_Closed),
+    windowPosition_(0),
+    windowCount_(0),
+    windowFailures_(0),
+    threshold_(0),
+    openDuration_(30),
+    isProbing_(false),
+    countFailFast_(0),
+    countTrips_(0)
+  {
+  }
+
+
+  void CircuitBreaker::Configure(unsigned int threshold,
+                                 size_t windowSize,
+                                 unsigned int openDuration)
+  {
+    if (threshold > 100 ||
+        (threshold != 0 && windowSize == 0))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    threshold_ = threshold;
+    openDuration_ = openDuration;
+    window_.resize(windowSize);
+    state_ = State_Closed;
+    isProbing_ = false;
+    ClearWindow();
+  }
+
+
+  CircuitBreaker::State CircuitBreaker::GetState()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return state_;
+  }
+
+
+  void CircuitBreaker::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["State"] = GetStateName(state_);
+    target["Threshold"] = threshold_;
+    target["WindowSize"] = static_cast<unsigned int>(window_.size());
+    target["WindowCalls"] = static_cast<unsigned int>(windowCount_);
+    target["WindowFailures"] = static_cast<unsigned int>(windowFailures_);
+    target["OpenDuration"] = openDuration_;
+    target["CountTrips"] = boost::lexical_cast<std::string>(countTrips_);
+    target["CountFailFast"] = boost::lexical_cast<std::string>(countFailFast_);
+  }
+
+
+  CircuitBreaker& CircuitBreaker::GetInstance()
+  {
+    static CircuitBreaker breaker;
+    return breaker;
+  }
+}
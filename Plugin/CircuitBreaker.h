@@ -0,0 +1,110 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <stdint.h>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Circuit breaker in front of the calls to TCIA. The outcomes of the
+   * last calls are kept in a sliding window. Once the ratio of failures
+   * in the window crosses a threshold, the circuit opens: The calls
+   * fail at once, instead of waiting for the timeout of the HTTP
+   * client. After some delay, the circuit becomes half-open, and one
+   * single call is let through to probe TCIA: The circuit closes again
+   * if the probe succeeds, and opens again otherwise.
+   **/
+  class CircuitBreaker : public boost::noncopyable
+  {
+  public:
+    enum State
+    {
+      State_Closed,
+      State_Open,
+      State_HalfOpen
+    };
+
+    /**
+     * One call to TCIA. The constructor throws an exception with HTTP
+     * status "503 Service Unavailable" if the circuit is open. If no
+     * outcome is set before the destruction (e.g. because the call was
+     * not made), the call is not taken into account.
+     **/
+    class Call : public boost::noncopyable
+    {
+    private:
+      CircuitBreaker&  that_;
+      bool             isProbe_;
+      bool             hasOutcome_;
+
+    public:
+      explicit Call(CircuitBreaker& that);
+
+      ~Call();
+
+      void SetOutcome(bool success);
+    };
+
+  private:
+    boost::mutex              mutex_;
+    State                     state_;
+    std::vector<bool>         window_;          // Ring buffer of the outcomes, "true" for failures
+    size_t                    windowPosition_;
+    size_t                    windowCount_;
+    size_t                    windowFailures_;
+    unsigned int              threshold_;       // Percentage of failures
+    unsigned int              openDuration_;    // In seconds
+    boost::posix_time::ptime  openedAt_;
+    bool                      isProbing_;
+    uint64_t                  countFailFast_;
+    uint64_t                  countTrips_;
+
+    void ClearWindow();
+
+    void Open();
+
+    bool Enter(bool& isProbe);
+
+    void Leave(bool isProbe,
+               bool hasOutcome,
+               bool success);
+
+  public:
+    CircuitBreaker();
+
+    // Setting "threshold" to "0" disables the circuit breaker
+    void Configure(unsigned int threshold,
+                   size_t windowSize,
+                   unsigned int openDuration);
+
+    State GetState();
+
+    void GetStatistics(Json::Value& target);
+
+    static CircuitBreaker& GetInstance();
+  };
+}
@@ -21,71 +21,204 @@
 
 #include <OrthancException.h>
 
+#include <algorithm>
 #include <cassert>
-#include <csv.h>
+#include <cstring>
+#include <limits>
 
 
-static int IsSpace(unsigned char c)
+namespace OrthancPlugins
 {
-  return (c == CSV_SPACE || c == CSV_TAB) ? 1 : 0;
-}
+  static bool IsBlank(char c)
+  {
+    return (c == ' ' || c == '\t');
+  }
 
 
-static int IsEndOfLine(unsigned char c)
-{
-  return (c == CSV_CR || c == CSV_LF) ? 1 : 0;
-}
+  // Same separators as in "CsvTokenizer"
+  static bool IsSeparator(char c)
+  {
+    return (c == ',' || c == '\r' || c == '\n');
+  }
 
 
-namespace OrthancPlugins
-{
-  void CsvParser::OnCell(void *content,
-                         size_t size,
-                         void *payload)
+  // An opening quote must start a cell, possibly after blanks, or must escape the quote just before it
+  static bool IsOpeningQuote(const char* csv,
+                             size_t position)
+  {
+    if (position > 0 &&
+        csv[position - 1] == '"')
+    {
+      return true;
+    }
+
+    while (position > 0 &&
+           IsBlank(csv[position - 1]))
+    {
+      position--;
+    }
+
+    return (position == 0 ||
+            IsSeparator(csv[position - 1]));
+  }
+
+
+  // A closing quote must end a cell, possibly before blanks, or must be escaped by the quote just after it
+  static bool IsClosingQuote(const char* csv,
+                             size_t size,
+                             size_t position)
   {
-    CsvParser& that = *reinterpret_cast<CsvParser*>(payload);
+    position++;
+
+    if (position < size &&
+        csv[position] == '"')
+    {
+      return true;
+    }
+
+    while (position < size &&
+           IsBlank(csv[position]))
+    {
+      position++;
+    }
+
+    return (position == size ||
+            IsSeparator(csv[position]));
+  }
+
+
+  void CsvParser::Reader::OnCell(const char* data,
+                                 size_t size)
+  {
+    // Reuse the strings of the previous row, so as to avoid allocations
+    if (rowSize_ < row_.size())
+    {
+      row_[rowSize_].assign(data, size);
+    }
+    else
+    {
+      row_.push_back(std::string(data, size));
+    }
 
-    std::string s(reinterpret_cast<const char*>(content), size);
-    that.cells_.push_back(s);
+    rowSize_++;
   }
 
   
-  void CsvParser::OnNextRow(int c,
-                            void *payload)
+  void CsvParser::Reader::OnRow()
+  {
+    if (rowSize_ < row_.size())
+    {
+      row_.resize(rowSize_);
+    }
+
+    visitor_.VisitRow(rowsCount_, row_);
+
+    rowsCount_++;
+    rowSize_ = 0;
+  }
+
+
+  CsvParser::Reader::Reader(IRowVisitor& visitor) :
+    visitor_(visitor),
+    rowSize_(0),
+    rowsCount_(0),
+    done_(false)
+  {
+  }
+
+
+  void CsvParser::Reader::Feed(const void* data,
+                               size_t size)
+  {
+    if (done_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      tokenizer_.Parse(*this, data, size);
+    }
+  }
+
+
+  void CsvParser::Reader::Finish()
   {
-    CsvParser& that = *reinterpret_cast<CsvParser*>(payload);
-      
-    that.startOfRowIndex_.push_back(that.cells_.size());
+    if (done_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      done_ = true;
+      tokenizer_.Finish(*this);
+    }
   }
 
 
+  class CsvParser::ArenaWriter : public CsvTokenizer::IHandler
+  {
+  private:
+    CsvParser&  that_;
+
+  public:
+    explicit ArenaWriter(CsvParser& that) :
+      that_(that)
+    {
+    }
+
+    virtual void OnCell(const char* data,
+                        size_t size) ORTHANC_OVERRIDE
+    {
+      // No overflow, as the CSV is smaller than 4GB
+      Cell cell;
+      cell.offset_ = static_cast<uint32_t>(that_.arena_.size());
+      cell.size_ = static_cast<uint32_t>(size);
+
+      that_.arena_.append(data, size);
+      that_.cells_.push_back(cell);
+    }
+
+    virtual void OnRow() ORTHANC_OVERRIDE
+    {
+      that_.startOfRowIndex_.push_back(that_.cells_.size());
+    }
+  };
+
+
   void CsvParser::Parse(const std::string& csv)
   {
+    arena_.clear();
     cells_.clear();
     startOfRowIndex_.clear();
     startOfRowIndex_.push_back(0);
 
+    if (csv.size() > static_cast<size_t>(std::numeric_limits<uint32_t>::max()))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory, "CSV file is too large");
+    }
+
     if (!csv.empty())
     {
-      struct csv_parser p;
+      // The unescaped cells are never larger than the CSV itself, so the arena is never reallocated
+      arena_.reserve(csv.size());
 
-      if (csv_init(&p, 0) != 0)
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Failed to initialize CSV parser");
-      }
-      
-      csv_set_space_func(&p, IsSpace);
-      csv_set_term_func(&p, IsEndOfLine);
+      ArenaWriter writer(*this);
 
-      bool ok = (csv_parse(&p, csv.c_str(), csv.size(), OnCell, OnNextRow, this) == csv.size() &&
-                 csv_fini(&p, OnCell, OnNextRow, this) == 0);
+      CsvTokenizer tokenizer;
+      tokenizer.Parse(writer, csv.c_str(), csv.size());
+      tokenizer.Finish(writer);
+    }
+  }
 
-      csv_free(&p);
 
-      if (!ok)
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Cannot parse CSV");
-      }
+  void CsvParser::Parse(IRowVisitor& visitor,
+                        const std::string& csv)
+  {
+    if (!csv.empty())
+    {
+      Reader reader(visitor);
+      reader.Feed(csv);
+      reader.Finish();
     }
   }
 
@@ -111,8 +244,8 @@ namespace OrthancPlugins
   }
 
   
-  const std::string& CsvParser::GetCell(size_t row,
-                                        size_t column) const
+  boost::string_ref CsvParser::GetCell(size_t row,
+                                       size_t column) const
   {
     if (column >= GetColumnsCount(row))
     {
@@ -120,7 +253,8 @@ namespace OrthancPlugins
     }
     else
     {
-      return cells_[startOfRowIndex_[row] + column];
+      const Cell& cell = cells_[startOfRowIndex_[row] + column];
+      return boost::string_ref(arena_.data() + cell.offset_, cell.size_);
     }
   }
 
@@ -132,21 +266,122 @@ namespace OrthancPlugins
     if (GetRowsCount() > 0)
     {
       const size_t n = GetColumnsCount(0);
-      assert(cells_.size() >= n);
 
+      std::vector<std::string> header(n);
       for (size_t i = 0; i < n; i++)
       {
-        const std::string& s = cells_[i];
+        header[i] = GetCell(0, i).to_string();
+      }
 
-        if (index.find(s) != index.end())
+      GetHeaderIndex(index, header);
+    }
+  }
+
+
+  void CsvParser::GetHeaderIndex(std::map<std::string, size_t>& index,
+                                 const std::vector<std::string>& header)
+  {
+    index.clear();
+
+    for (size_t i = 0; i < header.size(); i++)
+    {
+      const std::string& s = header[i];
+
+      if (index.find(s) != index.end())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The header row is not a valid index");
+      }
+      else
+      {
+        index[s] = i;
+      }
+    }
+  }
+
+
+  bool CsvParser::SplitRows(std::vector<size_t>& boundaries,
+                            const std::string& csv,
+                            size_t count)
+  {
+    if (count == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    const char* data = csv.c_str();
+    const size_t size = csv.size();
+
+    boundaries.clear();
+    boundaries.push_back(0);
+
+    size_t header = 0;  // End of the first line, "0" if not found yet
+    size_t next = 1;    // Index of the next range to be found
+    size_t target = 0;  // The next boundary is the first end-of-line after this position
+    size_t position = 0;
+    bool quoted = false;
+
+    for (;;)
+    {
+      // Look for the next quote, as the parity is constant until there
+      const char* quote = reinterpret_cast<const char*>(memchr(data + position, '"', size - position));
+      const size_t end = (quote == NULL ? size : quote - data);
+
+      while (!quoted &&
+             target < end)
+      {
+        const size_t from = std::max(position, target);
+        const char* eol = reinterpret_cast<const char*>(memchr(data + from, '\n', end - from));
+        if (eol == NULL)
         {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The header row is not a valid index");
+          break;
         }
-        else
+
+        const size_t boundary = eol - data + 1;
+        if (boundary < size)
         {
-          index[s] = i;
+          boundaries.push_back(boundary);
         }
+
+        if (header == 0)
+        {
+          header = boundary;
+        }
+
+        // Skip the nominal starts of ranges that were passed by this boundary
+        target = size;
+        while (next < count)
+        {
+          const size_t nominal = header + (size - header) * next / count;
+          next++;
+
+          if (nominal > boundary)
+          {
+            target = nominal;
+            break;
+          }
+        }
+      }
+
+      if (quote == NULL)
+      {
+        break;
+      }
+      else if (quoted ? !IsClosingQuote(data, size, end) : !IsOpeningQuote(data, end))
+      {
+        return false;
+      }
+      else
+      {
+        quoted = !quoted;
+        position = end + 1;
       }
     }
+
+    if (boundaries.back() != size)
+    {
+      boundaries.push_back(size);
+    }
+
+    return true;
   }
 }
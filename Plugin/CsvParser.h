@@ -19,37 +19,124 @@
 
 #pragma once
 
+#include "CsvTokenizer.h"
+
+#include <Compatibility.h>
+
 #include <boost/noncopyable.hpp>
-#include <deque>
+#include <boost/utility/string_ref.hpp>
 #include <map>
+#include <stdint.h>
 #include <string>
+#include <vector>
 
 
 namespace OrthancPlugins
 {
   class CsvParser : public boost::noncopyable
   {
+  public:
+    class IRowVisitor : public boost::noncopyable
+    {
+    public:
+      virtual ~IRowVisitor()
+      {
+      }
+
+      // The cells are only valid during the call
+      virtual void VisitRow(size_t row,
+                            const std::vector<std::string>& cells) = 0;
+    };
+
+    /**
+     * Incremental parser that hands each row to a visitor as soon as
+     * it is complete, without keeping the previous rows: The memory is
+     * bounded by the size of one row. The input can be fed by chunks,
+     * that can split the rows and the cells anywhere.
+     **/
+    class Reader : private CsvTokenizer::IHandler
+    {
+    private:
+      IRowVisitor&              visitor_;
+      CsvTokenizer              tokenizer_;
+      std::vector<std::string>  row_;
+      size_t                    rowSize_;
+      size_t                    rowsCount_;
+      bool                      done_;
+
+      virtual void OnCell(const char* data,
+                          size_t size) ORTHANC_OVERRIDE;
+
+      virtual void OnRow() ORTHANC_OVERRIDE;
+
+    public:
+      explicit Reader(IRowVisitor& visitor);
+
+      void Feed(const void* data,
+                size_t size);
+
+      void Feed(const std::string& data)
+      {
+        Feed(data.empty() ? NULL : data.c_str(), data.size());
+      }
+
+      // Must be called after the last chunk, to flush the last row
+      void Finish();
+
+      size_t GetRowsCount() const
+      {
+        return rowsCount_;
+      }
+    };
+
   private:
-    std::deque<std::string>  cells_;
-    std::deque<size_t>       startOfRowIndex_;
+    struct Cell
+    {
+      uint32_t  offset_;
+      uint32_t  size_;
+    };
 
-    static void OnCell(void *content,
-                       size_t size,
-                       void *payload);
+    // The cells are stored one after the other in one single buffer
+    std::string          arena_;
+    std::vector<Cell>    cells_;
+    std::vector<size_t>  startOfRowIndex_;
 
-    static void OnNextRow(int c,
-                          void *payload);
+    class ArenaWriter;
 
   public:
     void Parse(const std::string& csv);
 
+    // Parses the CSV without storing it, the rows being handed to the visitor one by one
+    static void Parse(IRowVisitor& visitor,
+                      const std::string& csv);
+
     size_t GetRowsCount() const;
 
     size_t GetColumnsCount(size_t row) const;
 
-    const std::string& GetCell(size_t row,
-                               size_t column) const;
+    // The view is valid until the next call to "Parse()" or the destruction of the parser
+    boost::string_ref GetCell(size_t row,
+                              size_t column) const;
 
     void GetHeaderIndex(std::map<std::string, size_t>& index) const;
+
+    // Maps the names of the columns of a header row to their indices
+    static void GetHeaderIndex(std::map<std::string, size_t>& index,
+                               const std::vector<std::string>& header);
+
+    /**
+     * Splits a CSV into ranges of whole rows, so that the ranges can
+     * be tokenized independently (e.g. by different threads). The
+     * first range only contains the first line (normally, the header
+     * row), and the other rows are split into at most "count" ranges
+     * of similar sizes. The boundaries are the end-of-lines outside
+     * of the quoted cells, as given by the parity of the quotes. This
+     * parity only matches the tokenizer if every quote opens or closes
+     * a quoted cell: Otherwise, "false" is returned, and the CSV must
+     * be parsed sequentially.
+     **/
+    static bool SplitRows(std::vector<size_t>& boundaries,
+                          const std::string& csv,
+                          size_t count);
   };
 }
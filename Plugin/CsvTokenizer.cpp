@@ -0,0 +1,568 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "CsvTokenizer.h"
+
+#include <OrthancException.h>
+
+#include <cassert>
+
+// The instruction sets can be disabled from the command line, which is used by "Resources/CsvFuzz"
+#if !defined(ORTHANC_CSV_HAS_SSE2)
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define ORTHANC_CSV_HAS_SSE2 1
+#  else
+#    define ORTHANC_CSV_HAS_SSE2 0
+#  endif
+#endif
+
+// AVX2 is only used if available at runtime, which is detected by the builtins of GCC and clang
+#if !defined(ORTHANC_CSV_HAS_AVX2)
+#  if ORTHANC_CSV_HAS_SSE2 == 1 && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define ORTHANC_CSV_HAS_AVX2 1
+#  else
+#    define ORTHANC_CSV_HAS_AVX2 0
+#  endif
+#endif
+
+#if ORTHANC_CSV_HAS_AVX2 == 1 && ORTHANC_CSV_HAS_SSE2 != 1
+#  error The AVX2 code path relies on the SSE2 code path
+#endif
+
+#if ORTHANC_CSV_HAS_SSE2 == 1
+#  include <emmintrin.h>
+#endif
+
+#if ORTHANC_CSV_HAS_AVX2 == 1
+#  include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
+
+static const char DELIMITER = ',';
+static const char QUOTE = '"';
+
+
+// Blanks and line terminators, as configured in libcsv by the former versions of the plugin
+static inline bool IsSpace(uint8_t c)
+{
+  return (c == ' ' || c == '\t');
+}
+
+
+static inline bool IsEndOfLine(uint8_t c)
+{
+  return (c == '\r' || c == '\n');
+}
+
+
+namespace
+{
+  /**
+   * A finder returns a pointer to the first byte in [start, end) that
+   * is special, or "end" if there is none. In an unquoted cell, the
+   * special bytes are the delimiter, the quote, the blanks and the
+   * line terminators. In a quoted cell, only the quote is special.
+   **/
+  typedef const uint8_t* (*Finder) (const uint8_t* start,
+                                    const uint8_t* end);
+
+
+  class SpecialTable
+  {
+  private:
+    bool  special_[256];
+
+  public:
+    SpecialTable()
+    {
+      for (unsigned int i = 0; i < 256; i++)
+      {
+        special_[i] = (i == static_cast<uint8_t>(DELIMITER) ||
+                       i == static_cast<uint8_t>(QUOTE) ||
+                       IsSpace(static_cast<uint8_t>(i)) ||
+                       IsEndOfLine(static_cast<uint8_t>(i)));
+      }
+    }
+
+    bool IsSpecial(uint8_t c) const
+    {
+      return special_[c];
+    }
+  };
+
+  const SpecialTable specialTable_;
+
+
+  const uint8_t* FindSpecialScalar(const uint8_t* start,
+                                   const uint8_t* end)
+  {
+    while (start < end &&
+           !specialTable_.IsSpecial(*start))
+    {
+      start++;
+    }
+
+    return start;
+  }
+
+
+  const uint8_t* FindQuoteScalar(const uint8_t* start,
+                                 const uint8_t* end)
+  {
+    while (start < end &&
+           *start != static_cast<uint8_t>(QUOTE))
+    {
+      start++;
+    }
+
+    return start;
+  }
+
+
+#if ORTHANC_CSV_HAS_SSE2 == 1
+  inline unsigned int CountTrailingZeros(uint32_t mask)
+  {
+    assert(mask != 0);
+
+#  if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned int>(index);
+#  else
+    return static_cast<unsigned int>(__builtin_ctz(mask));
+#  endif
+  }
+
+
+  const uint8_t* FindSpecialSse2(const uint8_t* start,
+                                 const uint8_t* end)
+  {
+    const __m128i delimiter = _mm_set1_epi8(DELIMITER);
+    const __m128i quote = _mm_set1_epi8(QUOTE);
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    while (end - start >= 16)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(start));
+      const __m128i found = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, delimiter), _mm_cmpeq_epi8(v, quote)),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+
+      const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(found));
+      if (mask != 0)
+      {
+        return start + CountTrailingZeros(mask);
+      }
+
+      start += 16;
+    }
+
+    return FindSpecialScalar(start, end);
+  }
+
+
+  const uint8_t* FindQuoteSse2(const uint8_t* start,
+                               const uint8_t* end)
+  {
+    const __m128i quote = _mm_set1_epi8(QUOTE);
+
+    while (end - start >= 16)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(start));
+      const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)));
+      if (mask != 0)
+      {
+        return start + CountTrailingZeros(mask);
+      }
+
+      start += 16;
+    }
+
+    return FindQuoteScalar(start, end);
+  }
+#endif
+
+
+#if ORTHANC_CSV_HAS_AVX2 == 1
+  __attribute__((target("avx2")))
+  const uint8_t* FindSpecialAvx2(const uint8_t* start,
+                                 const uint8_t* end)
+  {
+    const __m256i delimiter = _mm256_set1_epi8(DELIMITER);
+    const __m256i quote = _mm256_set1_epi8(QUOTE);
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    while (end - start >= 32)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(start));
+      const __m256i found = _mm256_or_si256(
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, delimiter), _mm256_cmpeq_epi8(v, quote)),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+
+      const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(found));
+      if (mask != 0)
+      {
+        return start + CountTrailingZeros(mask);
+      }
+
+      start += 32;
+    }
+
+    return FindSpecialSse2(start, end);
+  }
+
+
+  __attribute__((target("avx2")))
+  const uint8_t* FindQuoteAvx2(const uint8_t* start,
+                               const uint8_t* end)
+  {
+    const __m256i quote = _mm256_set1_epi8(QUOTE);
+
+    while (end - start >= 32)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(start));
+      const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)));
+      if (mask != 0)
+      {
+        return start + CountTrailingZeros(mask);
+      }
+
+      start += 32;
+    }
+
+    return FindQuoteSse2(start, end);
+  }
+#endif
+
+
+  // The instruction set is chosen once, according to the CPU
+  class Finders
+  {
+  private:
+    const char*  instructionSet_;
+    Finder       findSpecial_;
+    Finder       findQuote_;
+
+  public:
+    Finders()
+    {
+#if ORTHANC_CSV_HAS_AVX2 == 1
+      if (__builtin_cpu_supports("avx2"))
+      {
+        instructionSet_ = "AVX2";
+        findSpecial_ = FindSpecialAvx2;
+        findQuote_ = FindQuoteAvx2;
+        return;
+      }
+#endif
+
+#if ORTHANC_CSV_HAS_SSE2 == 1
+      instructionSet_ = "SSE2";
+      findSpecial_ = FindSpecialSse2;
+      findQuote_ = FindQuoteSse2;
+#else
+      instructionSet_ = "Scalar";
+      findSpecial_ = FindSpecialScalar;
+      findQuote_ = FindQuoteScalar;
+#endif
+    }
+
+    const char* GetInstructionSet() const
+    {
+      return instructionSet_;
+    }
+
+    const uint8_t* FindSpecial(const uint8_t* start,
+                               const uint8_t* end) const
+    {
+      return findSpecial_(start, end);
+    }
+
+    const uint8_t* FindQuote(const uint8_t* start,
+                             const uint8_t* end) const
+    {
+      return findQuote_(start, end);
+    }
+  };
+
+  const Finders finders_;
+}
+
+
+namespace OrthancPlugins
+{
+  void CsvTokenizer::SubmitField(IHandler& handler)
+  {
+    size_t size = entry_.size();
+
+    // Remove the trailing blanks of the unquoted cells
+    if (!quoted_)
+    {
+      assert(spaces_ <= size);
+      size -= spaces_;
+    }
+
+    handler.OnCell(entry_.data(), size);
+
+    state_ = State_FieldNotBegun;
+    entry_.clear();
+    quoted_ = false;
+    spaces_ = 0;
+  }
+
+
+  void CsvTokenizer::SubmitRow(IHandler& handler)
+  {
+    handler.OnRow();
+
+    state_ = State_RowNotBegun;
+    entry_.clear();
+    quoted_ = false;
+    spaces_ = 0;
+  }
+
+
+  CsvTokenizer::CsvTokenizer() :
+    state_(State_RowNotBegun),
+    quoted_(false),
+    spaces_(0)
+  {
+  }
+
+
+  void CsvTokenizer::Parse(IHandler& handler,
+                           const void* data,
+                           size_t size)
+  {
+    if (size == 0)
+    {
+      return;
+    }
+    else if (data == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    const uint8_t* current = reinterpret_cast<const uint8_t*>(data);
+    const uint8_t* end = current + size;
+
+    while (current < end)
+    {
+      if (state_ == State_FieldBegun)
+      {
+        // Copy the run of bytes that cannot change the state at once
+        const uint8_t* next = (quoted_ ?
+                               finders_.FindQuote(current, end) :
+                               finders_.FindSpecial(current, end));
+
+        if (next != current)
+        {
+          entry_.append(reinterpret_cast<const char*>(current), next - current);
+          spaces_ = 0;
+          current = next;
+
+          if (current == end)
+          {
+            break;
+          }
+        }
+      }
+
+      const uint8_t c = *current;
+      current++;
+
+      switch (state_)
+      {
+        case State_RowNotBegun:
+        case State_FieldNotBegun:
+          if (IsSpace(c))
+          {
+            // Skip the leading blanks
+          }
+          else if (IsEndOfLine(c))
+          {
+            // Empty lines are skipped
+            if (state_ == State_FieldNotBegun)
+            {
+              SubmitField(handler);
+              SubmitRow(handler);
+            }
+          }
+          else if (c == DELIMITER)
+          {
+            SubmitField(handler);
+          }
+          else if (c == QUOTE)
+          {
+            state_ = State_FieldBegun;
+            quoted_ = true;
+          }
+          else
+          {
+            state_ = State_FieldBegun;
+            quoted_ = false;
+            entry_.push_back(c);
+          }
+          break;
+
+        case State_FieldBegun:
+          if (c == QUOTE)
+          {
+            entry_.push_back(c);
+
+            if (quoted_)
+            {
+              // Either the closing quote, or the first quote of an escaped quote
+              state_ = State_FieldMightHaveEnded;
+            }
+            else
+            {
+              spaces_ = 0;
+            }
+          }
+          else if (c == DELIMITER)
+          {
+            if (quoted_)
+            {
+              entry_.push_back(c);
+            }
+            else
+            {
+              SubmitField(handler);
+            }
+          }
+          else if (IsEndOfLine(c))
+          {
+            if (quoted_)
+            {
+              entry_.push_back(c);
+            }
+            else
+            {
+              SubmitField(handler);
+              SubmitRow(handler);
+            }
+          }
+          else if (!quoted_ &&
+                   IsSpace(c))
+          {
+            entry_.push_back(c);
+            spaces_++;
+          }
+          else
+          {
+            entry_.push_back(c);
+            spaces_ = 0;
+          }
+          break;
+
+        case State_FieldMightHaveEnded:
+          if (c == DELIMITER)
+          {
+            // Remove the closing quote, and the blanks after it
+            entry_.resize(entry_.size() - spaces_ - 1);
+            SubmitField(handler);
+          }
+          else if (IsEndOfLine(c))
+          {
+            entry_.resize(entry_.size() - spaces_ - 1);
+            SubmitField(handler);
+            SubmitRow(handler);
+          }
+          else if (IsSpace(c))
+          {
+            entry_.push_back(c);
+            spaces_++;
+          }
+          else if (c == QUOTE)
+          {
+            if (spaces_ != 0)
+            {
+              entry_.push_back(c);
+              spaces_ = 0;
+            }
+            else
+            {
+              // Escaped quote: The first quote is already in the entry
+              state_ = State_FieldBegun;
+            }
+          }
+          else
+          {
+            state_ = State_FieldBegun;
+            spaces_ = 0;
+            entry_.push_back(c);
+          }
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+  }
+
+
+  void CsvTokenizer::Finish(IHandler& handler)
+  {
+    switch (state_)
+    {
+      case State_RowNotBegun:
+        break;
+
+      case State_FieldMightHaveEnded:
+        // Remove the closing quote, and the blanks after it
+        entry_.resize(entry_.size() - spaces_ - 1);
+        SubmitField(handler);
+        SubmitRow(handler);
+        break;
+
+      case State_FieldNotBegun:
+      case State_FieldBegun:
+        SubmitField(handler);
+        SubmitRow(handler);
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    state_ = State_RowNotBegun;
+    entry_.clear();
+    quoted_ = false;
+    spaces_ = 0;
+  }
+
+
+  const char* CsvTokenizer::GetInstructionSet()
+  {
+    return finders_.GetInstructionSet();
+  }
+}
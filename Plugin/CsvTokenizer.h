@@ -0,0 +1,90 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Tokenizer of CSV files that reproduces the state machine of
+   * libcsv (in its default, non-strict mode, with spaces and tabs as
+   * blanks, and with CR and LF as line terminators): Leading and
+   * trailing blanks of the unquoted cells are removed, doubled quotes
+   * are unescaped, and empty lines are skipped.
+   *
+   * Contrarily to libcsv, which handles the input byte per byte, the
+   * content of the cells is copied by runs: The next byte that can
+   * change the state is searched for using SIMD instructions (AVX2 or
+   * SSE2, depending on the CPU, with a scalar fallback). The input can
+   * be fed by chunks, that can split the rows and the cells anywhere.
+   **/
+  class CsvTokenizer : public boost::noncopyable
+  {
+  public:
+    class IHandler : public boost::noncopyable
+    {
+    public:
+      virtual ~IHandler()
+      {
+      }
+
+      // The content of the cell is only valid during the call
+      virtual void OnCell(const char* data,
+                          size_t size) = 0;
+
+      virtual void OnRow() = 0;
+    };
+
+  private:
+    enum State
+    {
+      State_RowNotBegun,
+      State_FieldNotBegun,
+      State_FieldBegun,
+      State_FieldMightHaveEnded
+    };
+
+    State        state_;
+    bool         quoted_;
+    size_t       spaces_;  // Number of trailing blanks in the current cell
+    std::string  entry_;   // Content of the current cell
+
+    void SubmitField(IHandler& handler);
+
+    void SubmitRow(IHandler& handler);
+
+  public:
+    CsvTokenizer();
+
+    void Parse(IHandler& handler,
+               const void* data,
+               size_t size);
+
+    // Flushes the last cell and the last row, if not terminated by an end-of-line
+    void Finish(IHandler& handler);
+
+    // Name of the instruction set that is used to find the special characters
+    static const char* GetInstructionSet();
+  };
+}
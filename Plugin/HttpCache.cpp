@@ -19,8 +19,14 @@
 
 #include "HttpCache.h"
 
+#include "HttpHelpers.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
 #include <OrthancException.h>
 
+#include <cassert>
+
 
 static boost::posix_time::ptime GetNow()
 {
@@ -30,43 +36,64 @@ static boost::posix_time::ptime GetNow()
 
 namespace OrthancPlugins
 {
-  class HttpCache::Item : public boost::noncopyable
+  HttpCache::Item::Item(std::string& body,
+                        const std::string& mime) :
+    time_(GetNow()),
+    mime_(mime)
   {
-  private:
-    boost::posix_time::ptime  time_;
-    std::string               body_;
-    std::string               mime_;
-      
-  public:
-    Item(const void* bodyData,
-         size_t bodySize,
-         const std::string& mime) :
-      time_(GetNow()),
-      body_(reinterpret_cast<const char*>(bodyData), bodySize),
-      mime_(mime)
-    {
-    }
+    body_.swap(body);
+    HttpHelpers::ComputeETag(etag_, body_.c_str(), body_.size());
+  }
 
-    bool HasExpired(const boost::posix_time::time_duration& duration) const
-    {
-      return (GetNow() - time_ >= duration);
-    }
 
-    const std::string& GetBody() const
-    {
-      return body_;
-    }
+  HttpCache::Item::Item(const void* bodyData,
+                        size_t bodySize,
+                        const std::string& mime) :
+    time_(GetNow()),
+    body_(reinterpret_cast<const char*>(bodyData), bodySize),
+    mime_(mime)
+  {
+    HttpHelpers::ComputeETag(etag_, bodyData, bodySize);
+  }
 
-    const std::string& GetMime() const
+
+  bool HttpCache::Item::HasExpired(const boost::posix_time::time_duration& duration) const
+  {
+    return (GetNow() - time_ >= duration);
+  }
+    
+
+  boost::shared_ptr<const Json::Value> HttpCache::Item::GetJson() const
+  {
+    boost::mutex::scoped_lock lock(jsonMutex_);
+
+    if (json_.get() == NULL)
     {
-      return mime_;
+      boost::shared_ptr<Json::Value> json(new Json::Value);
+      if (body_.empty())
+      {
+        // TCIA answers with an empty body if there is no match, as in "TciaMirrorJob::GetFromTcia()"
+        *json = Json::arrayValue;
+        json_ = json;
+      }
+      else if (ReadJson(*json, body_))
+      {
+        json_ = json;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The answer from TCIA is not a JSON document");
+      }
     }
-  };
-    
+
+    return json_;
+  }
+
 
   HttpCache::HttpCache() :
     hasExpiration_(false),
-    expiration_(boost::posix_time::hours(1))
+    expiration_(boost::posix_time::hours(1)),
+    maximumItemSize_(0)
   {
   }
     
@@ -92,23 +119,30 @@ namespace OrthancPlugins
     hasExpiration_ = false;
   }
 
-  
-  void HttpCache::Clear()
+
+  void HttpCache::SetMaximumItemSize(size_t size)
   {
     boost::mutex::scoped_lock lock(mutex_);
+    maximumItemSize_ = size;
+  }
 
-    for (Content::iterator it = content_.begin(); it != content_.end(); ++it)
-    {
-      assert(it->second != NULL);
-      delete it->second;
-    }
 
+  bool HttpCache::IsCacheable(size_t bodySize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return (maximumItemSize_ == 0 ||
+            bodySize <= maximumItemSize_);
+  }
+
+  
+  void HttpCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
     content_.clear();
   }
 
   
-  bool HttpCache::Read(std::string& body,
-                       std::string& mime,
+  bool HttpCache::Read(boost::shared_ptr<const Item>& item,
                        const std::string& key)
   {
     boost::mutex::scoped_lock lock(mutex_);
@@ -120,7 +154,7 @@ namespace OrthancPlugins
     }
     else
     {
-      assert(found->second != NULL);
+      assert(found->second.get() != NULL);
       if (hasExpiration_ &&
           found->second->HasExpired(expiration_))
       {
@@ -128,32 +162,48 @@ namespace OrthancPlugins
       }
       else
       {
-        body = found->second->GetBody();
-        mime = found->second->GetMime();
+        item = found->second;
         return true;
       }
     }
   }
 
+  
+  bool HttpCache::Write(const std::string& key,
+                        boost::shared_ptr<const Item> item)
+  {
+    if (item.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maximumItemSize_ != 0 &&
+        item->GetBody().size() > maximumItemSize_)
+    {
+      return false;
+    }
+    else
+    {
+      content_[key] = item;
+      return true;
+    }
+  }
+
 
-  void HttpCache::Write(const std::string& key,
+  bool HttpCache::Write(const std::string& key,
                         const void* bodyData,
                         size_t bodySize,
                         const std::string& mime)
   {
-    boost::mutex::scoped_lock lock(mutex_);
-
-    Content::iterator found = content_.find(key);
-    if (found == content_.end())
+    if (IsCacheable(bodySize))
     {
-      content_[key] = new Item(bodyData, bodySize, mime);
+      return Write(key, boost::shared_ptr<const Item>(new Item(bodyData, bodySize, mime)));
     }
     else
     {
-      assert(found->second != NULL);
-      delete found->second;
-
-      found->second = new Item(bodyData, bodySize, mime);
+      return false;
     }
   }
     
@@ -21,43 +21,96 @@
 
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/mutex.hpp>
+#include <json/value.h>
 #include <map>
+#include <string>
 
 
 namespace OrthancPlugins
 {
   class HttpCache : public boost::noncopyable
   {
+  public:
+    /**
+     * Items are immutable once created, which allows to share them
+     * between the cache and the HTTP threads without copying the
+     * body, that can be large. The ETag is computed once, on creation.
+     * The body is parsed as JSON only once, on the first request.
+     **/
+    class Item : public boost::noncopyable
+    {
+    private:
+      boost::posix_time::ptime  time_;
+      std::string               body_;
+      std::string               mime_;
+      std::string               etag_;
+
+      mutable boost::mutex                          jsonMutex_;
+      mutable boost::shared_ptr<const Json::Value>  json_;
+
+    public:
+      // The content of "body" is swapped into the item to avoid a copy
+      Item(std::string& body,
+           const std::string& mime);
+
+      Item(const void* bodyData,
+           size_t bodySize,
+           const std::string& mime);
+
+      bool HasExpired(const boost::posix_time::time_duration& duration) const;
+
+      const std::string& GetBody() const
+      {
+        return body_;
+      }
+
+      const std::string& GetMime() const
+      {
+        return mime_;
+      }
+
+      const std::string& GetETag() const
+      {
+        return etag_;
+      }
+
+      // Parses the body as JSON, an empty body being an empty list. Throws an exception if the body is not JSON.
+      boost::shared_ptr<const Json::Value> GetJson() const;
+    };
+
   private:
-    class Item;
-    
-    typedef std::map<std::string, Item*>  Content;
+    typedef std::map<std::string, boost::shared_ptr<const Item> >  Content;
     
     boost::mutex  mutex_;
     Content       content_;
     bool          hasExpiration_;
     boost::posix_time::time_duration  expiration_;
+    size_t        maximumItemSize_;
 
   public:
     HttpCache();
     
-    ~HttpCache()
-    {
-      Clear();
-    }
-
     void SetExpiration(const boost::posix_time::time_duration& expiration);
 
     void ClearExpiration();
+
+    // Items whose body is larger than this size are never cached ("0" means no limit)
+    void SetMaximumItemSize(size_t size);
+
+    bool IsCacheable(size_t bodySize);
     
     void Clear();
 
-    bool Read(std::string& body,
-              std::string& mime,
+    bool Read(boost::shared_ptr<const Item>& item,
               const std::string& key);
+
+    // Returns "false" if the item was too large to be cached
+    bool Write(const std::string& key,
+               boost::shared_ptr<const Item> item);
     
-    void Write(const std::string& key,
+    bool Write(const std::string& key,
                const void* bodyData,
                size_t bodySize,
                const std::string& mime);
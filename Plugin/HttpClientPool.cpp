@@ -0,0 +1,509 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "HttpClientPool.h"
+
+#include <OrthancFramework.h>
+
+#if ORTHANC_ENABLE_CURL == 1
+#  include <HttpClient.h>
+#endif
+
+#include <Compatibility.h>
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+
+
+static bool globalInitialized_ = false;
+
+
+namespace OrthancPlugins
+{
+  namespace
+  {
+    class StringAnswer : public HttpClient::IAnswer
+    {
+    private:
+      std::string&  body_;
+
+    public:
+      explicit StringAnswer(std::string& body) :
+        body_(body)
+      {
+        body_.clear();
+      }
+
+      virtual void AddHeader(const std::string& key,
+                             const std::string& value) ORTHANC_OVERRIDE
+      {
+      }
+
+      virtual void AddChunk(const void* data,
+                            size_t size) ORTHANC_OVERRIDE
+      {
+        body_.append(reinterpret_cast<const char*>(data), size);
+      }
+    };
+
+
+    // Takes the received bytes from the rate limiter
+    class RateLimitedAnswer : public HttpClient::IAnswer
+    {
+    private:
+      HttpClient::IAnswer&  target_;
+      RateLimiter::Lane     lane_;
+
+    public:
+      RateLimitedAnswer(HttpClient::IAnswer& target,
+                        RateLimiter::Lane lane) :
+        target_(target),
+        lane_(lane)
+      {
+      }
+
+      virtual void AddHeader(const std::string& key,
+                             const std::string& value) ORTHANC_OVERRIDE
+      {
+        target_.AddHeader(key, value);
+      }
+
+      virtual void AddChunk(const void* data,
+                            size_t size) ORTHANC_OVERRIDE
+      {
+        RateLimiter::GetInstance().ConsumeBytes(lane_, size);
+        target_.AddChunk(data, size);
+      }
+    };
+
+
+#if ORTHANC_ENABLE_CURL == 1
+    class AnswerAdapter : public Orthanc::HttpClient::IAnswer
+    {
+    private:
+      HttpClient::IAnswer&  target_;
+
+    public:
+      explicit AnswerAdapter(HttpClient::IAnswer& target) :
+        target_(target)
+      {
+      }
+
+      virtual void AddHeader(const std::string& key,
+                             const std::string& value) ORTHANC_OVERRIDE
+      {
+        target_.AddHeader(key, value);
+      }
+
+      virtual void AddChunk(const void* data,
+                            size_t size) ORTHANC_OVERRIDE
+      {
+        target_.AddChunk(data, size);
+      }
+    };
+#endif
+  }
+
+
+  class HttpClientPool::Client : public boost::noncopyable
+  {
+  private:
+    unsigned int  countRequests_;
+
+#if ORTHANC_ENABLE_CURL == 1
+    Orthanc::HttpClient  client_;
+#else
+    unsigned int         timeout_;
+#endif
+
+  public:
+    Client(unsigned int timeout,
+           bool httpsVerifyPeers,
+           const std::string& httpsCACertificates,
+           const std::string& proxy) :
+      countRequests_(0)
+    {
+#if ORTHANC_ENABLE_CURL == 1
+      client_.SetTimeout(timeout);
+      client_.SetHttpsVerifyPeers(httpsVerifyPeers);
+
+      if (!httpsCACertificates.empty())
+      {
+        client_.SetHttpsCACertificates(httpsCACertificates);
+      }
+
+      if (!proxy.empty())
+      {
+        client_.SetProxy(proxy);
+      }
+#else
+      timeout_ = timeout;
+#endif
+    }
+
+    /**
+     * Tells whether this client has already sent a request. This does
+     * not guarantee that its connection is reused, as libcurl opens a
+     * new connection if the server has closed the previous one.
+     **/
+    bool IsWarm() const
+    {
+      return countRequests_ > 0;
+    }
+
+    void Get(HttpClient::IAnswer& answer,
+             const std::string& url)
+    {
+      uint16_t status;
+
+#if ORTHANC_ENABLE_CURL == 1
+      AnswerAdapter adapter(answer);
+      client_.SetMethod(Orthanc::HttpMethod_Get);
+      client_.SetUrl(url);
+      client_.Apply(adapter);
+      status = static_cast<uint16_t>(client_.GetLastStatus());
+#else
+      HttpClient client;
+      client.SetMethod(OrthancPluginHttpMethod_Get);
+      client.SetUrl(url);
+      client.SetTimeout(timeout_);
+      client.Execute(answer);
+      status = client.GetHttpStatus();
+#endif
+
+      countRequests_++;
+
+      if (status < 200 ||
+          status >= 300)
+      {
+        const std::string message = ("HTTP status " + boost::lexical_cast<std::string>(status) +
+                                     " while accessing: " + url);
+
+        if (status >= 400 &&
+            status < 600)
+        {
+          // Forward the HTTP status, which allows to distinguish the errors of the client from those of TCIA
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                          static_cast<Orthanc::HttpStatus>(status), message);
+        }
+        else
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, message);
+        }
+      }
+    }
+  };
+
+
+  class HttpClientPool::Lease : public boost::noncopyable
+  {
+  private:
+    HttpClientPool&    pool_;
+    RateLimiter::Lane  lane_;
+    Client*            client_;
+
+  public:
+    Lease(HttpClientPool& pool,
+          RateLimiter::Lane lane) :
+      pool_(pool),
+      lane_(lane),
+      client_(pool.Acquire(lane))
+    {
+      assert(client_ != NULL);
+    }
+
+    ~Lease()
+    {
+      pool_.Release(client_, lane_);
+    }
+
+    Client& GetClient()
+    {
+      return *client_;
+    }
+  };
+
+
+  HttpClientPool::Client* HttpClientPool::Acquire(RateLimiter::Lane lane)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    countRequests_++;
+
+    const boost::system_time deadline = (boost::get_system_time() +
+                                         boost::posix_time::milliseconds(interactiveTimeout_));
+
+    bool hasWaited = false;
+
+    for (;;)
+    {
+      // The bulk lane never takes the last client of the pool, which is kept for the interactive lane
+      const bool allowed = (lane == RateLimiter::Lane_Interactive ||
+                            maximumSize_ <= 1 ||
+                            activeBulk_ + 1 < maximumSize_);
+
+      std::unique_ptr<Client> client;
+
+      if (allowed &&
+          !idle_.empty())
+      {
+        // Last in, first out, in order to favor the clients whose connections are the most recent
+        client.reset(idle_.back());
+        idle_.pop_back();
+
+        if (client->IsWarm())
+        {
+          countWarmLeases_++;
+        }
+      }
+      else if (allowed &&
+               size_ < maximumSize_)
+      {
+        client.reset(new Client(timeout_, httpsVerifyPeers_, httpsCACertificates_, proxy_));
+        size_++;
+      }
+
+      if (client.get() != NULL)
+      {
+        if (lane == RateLimiter::Lane_Bulk)
+        {
+          activeBulk_++;
+        }
+
+        return client.release();
+      }
+
+      if (!hasWaited)
+      {
+        countWaits_++;
+        hasWaited = true;
+      }
+
+      if (lane == RateLimiter::Lane_Bulk)
+      {
+        available_.wait(lock);
+      }
+      else if (!available_.timed_wait(lock, deadline))
+      {
+        countTimeouts_++;
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, Orthanc::HttpStatus_503_ServiceUnavailable,
+                                        "No HTTP client is available to access TCIA, the request is rejected", false);
+      }
+    }
+  }
+
+
+  void HttpClientPool::Release(Client* client,
+                               RateLimiter::Lane lane)
+  {
+    assert(client != NULL);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (lane == RateLimiter::Lane_Bulk)
+      {
+        assert(activeBulk_ > 0);
+        activeBulk_--;
+      }
+
+      if (size_ > maximumSize_)
+      {
+        // The pool has been shrunk in the meantime
+        delete client;
+        size_--;
+      }
+      else
+      {
+        idle_.push_back(client);
+      }
+    }
+
+    // Wake up all the waiters, as the bulk ones might not be allowed to take the released client
+    available_.notify_all();
+  }
+
+
+  HttpClientPool::HttpClientPool() :
+    maximumSize_(4),
+    size_(0),
+    activeBulk_(0),
+    interactiveTimeout_(5000),
+    timeout_(60),
+    httpsVerifyPeers_(true),
+    countRequests_(0),
+    countWarmLeases_(0),
+    countWaits_(0),
+    countTimeouts_(0)
+  {
+  }
+
+
+  HttpClientPool::~HttpClientPool()
+  {
+    for (size_t i = 0; i < idle_.size(); i++)
+    {
+      assert(idle_[i] != NULL);
+      delete idle_[i];
+    }
+  }
+
+
+  void HttpClientPool::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (size_t i = 0; i < idle_.size(); i++)
+    {
+      assert(idle_[i] != NULL);
+      delete idle_[i];
+    }
+
+    size_ -= idle_.size();
+    idle_.clear();
+  }
+
+
+  void HttpClientPool::SetMaximumSize(size_t size)
+  {
+    if (size == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      maximumSize_ = size;
+
+      while (size_ > maximumSize_ &&
+             !idle_.empty())
+      {
+        delete idle_.back();
+        idle_.pop_back();
+        size_--;
+      }
+    }
+
+    available_.notify_all();
+  }
+
+
+  void HttpClientPool::SetInteractiveTimeout(unsigned int timeout)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    interactiveTimeout_ = timeout;
+  }
+
+
+  void HttpClientPool::Configure(const OrthancConfiguration& configuration)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (size_ != 0)
+    {
+      // The configuration must be set before the first request
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    // Same options as for the HTTP client of the Orthanc core
+    timeout_ = configuration.GetUnsignedIntegerValue("HttpTimeout", 60);
+    httpsVerifyPeers_ = configuration.GetBooleanValue("HttpsVerifyPeers", true);
+    httpsCACertificates_ = configuration.GetStringValue("HttpsCACertificates", "");
+    proxy_ = configuration.GetStringValue("HttpProxy", "");
+  }
+
+
+  void HttpClientPool::Get(HttpClient::IAnswer& answer,
+                           const std::string& url,
+                           RateLimiter::Lane lane)
+  {
+    // Wait for the rate limiter before leasing a client, so that no client is held while waiting
+    RateLimiter::GetInstance().AcquireRequest(lane);
+
+    RateLimitedAnswer limited(answer, lane);
+
+    Lease lease(*this, lane);
+    lease.GetClient().Get(limited, url);
+  }
+
+
+  void HttpClientPool::Get(std::string& body,
+                           const std::string& url,
+                           RateLimiter::Lane lane)
+  {
+    StringAnswer answer(body);
+    Get(answer, url, lane);
+  }
+
+
+  void HttpClientPool::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["MaximumSize"] = static_cast<unsigned int>(maximumSize_);
+    target["Size"] = static_cast<unsigned int>(size_);
+    target["Idle"] = static_cast<unsigned int>(idle_.size());
+    target["CountRequests"] = boost::lexical_cast<std::string>(countRequests_);
+    target["CountWarmClientLeases"] = boost::lexical_cast<std::string>(countWarmLeases_);
+    target["CountWaits"] = boost::lexical_cast<std::string>(countWaits_);
+    target["CountTimeouts"] = boost::lexical_cast<std::string>(countTimeouts_);
+    target["ActiveBulk"] = static_cast<unsigned int>(activeBulk_);
+
+#if ORTHANC_ENABLE_CURL == 1
+    target["KeepAlive"] = true;
+#else
+    target["KeepAlive"] = false;
+#endif
+  }
+
+
+  void HttpClientPool::GlobalInitialize()
+  {
+    if (!globalInitialized_)
+    {
+#if ORTHANC_ENABLE_CURL == 1
+      Orthanc::HttpClient::GlobalInitialize();
+#endif
+      globalInitialized_ = true;
+    }
+  }
+
+
+  void HttpClientPool::GlobalFinalize()
+  {
+    if (globalInitialized_)
+    {
+#if ORTHANC_ENABLE_CURL == 1
+      Orthanc::HttpClient::GlobalFinalize();
+#endif
+      globalInitialized_ = false;
+    }
+  }
+
+
+  HttpClientPool& HttpClientPool::GetInstance()
+  {
+    static HttpClientPool pool;
+    return pool;
+  }
+}
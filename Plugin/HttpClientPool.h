@@ -0,0 +1,113 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "RateLimiter.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/thread/condition_variable.hpp>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Pool of HTTP clients that is owned by the plugin and that is
+   * shared by all the accesses to TCIA. Each client keeps its
+   * connections alive between successive requests, which avoids
+   * paying a new TCP/TLS handshake for each request. If the Orthanc
+   * framework was built without libcurl, the HTTP client of the
+   * Orthanc core is used instead, without reuse of the connections.
+   *
+   * The bulk downloads can hold a client for minutes. One client is
+   * therefore reserved to the interactive lane (if the pool has more
+   * than one client), and the interactive requests only wait for a
+   * client for a bounded time, after which they fail with "503
+   * Service Unavailable".
+   **/
+  class HttpClientPool : public boost::noncopyable
+  {
+  private:
+    class Client;
+    class Lease;
+
+    boost::mutex               mutex_;
+    boost::condition_variable  available_;
+    std::vector<Client*>       idle_;
+    size_t                     maximumSize_;
+    size_t                     size_;
+    size_t                     activeBulk_;          // Number of clients leased by the bulk lane
+    unsigned int               interactiveTimeout_;  // In milliseconds
+    unsigned int               timeout_;
+    bool                       httpsVerifyPeers_;
+    std::string                httpsCACertificates_;
+    std::string                proxy_;
+    uint64_t                   countRequests_;
+    uint64_t                   countWarmLeases_;  // Leases of a client that has already sent a request
+    uint64_t                   countWaits_;
+    uint64_t                   countTimeouts_;
+
+    Client* Acquire(RateLimiter::Lane lane);
+
+    void Release(Client* client,
+                 RateLimiter::Lane lane);
+
+  public:
+    HttpClientPool();
+
+    ~HttpClientPool();
+
+    /**
+     * Frees the idle clients. This must be called before
+     * "GlobalFinalize()", as the static pool would otherwise free its
+     * clients after libcurl has been finalized.
+     **/
+    void Clear();
+
+    void SetMaximumSize(size_t size);
+
+    // Maximum time (in milliseconds) during which an interactive request waits for a client
+    void SetInteractiveTimeout(unsigned int timeout);
+
+    // Reads the HTTP-related options of the global Orthanc configuration
+    void Configure(const OrthancConfiguration& configuration);
+
+    /**
+     * Throws an exception if the HTTP status is not 2xx, with the same
+     * HTTP status if it is 4xx or 5xx. The request goes through the
+     * rate limiter, in the given lane.
+     **/
+    void Get(HttpClient::IAnswer& answer,
+             const std::string& url,
+             RateLimiter::Lane lane);
+
+    void Get(std::string& body,
+             const std::string& url,
+             RateLimiter::Lane lane);
+
+    void GetStatistics(Json::Value& target);
+
+    static void GlobalInitialize();
+
+    static void GlobalFinalize();
+
+    static HttpClientPool& GetInstance();
+  };
+}
@@ -0,0 +1,125 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "HttpHelpers.h"
+
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/lexical_cast.hpp>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  void HttpHelpers::ComputeETag(std::string& etag,
+                                const void* data,
+                                size_t size)
+  {
+    std::string sha1;
+    Orthanc::Toolbox::ComputeSHA1(sha1, data, size);
+    etag = "\"" + sha1 + "\"";
+  }
+
+
+  bool HttpHelpers::LookupHttpHeader(std::string& value,
+                                     const OrthancPluginHttpRequest* request,
+                                     const std::string& key)
+  {
+    for (uint32_t i = 0; i < request->headersCount; i++)
+    {
+      if (boost::iequals(key, request->headersKeys[i]))
+      {
+        value = request->headersValues[i];
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  bool HttpHelpers::IsNotModified(const OrthancPluginHttpRequest* request,
+                                  const std::string& etag)
+  {
+    std::string header;
+    if (!LookupHttpHeader(header, request, "If-None-Match"))
+    {
+      return false;
+    }
+
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, header, ',');
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      std::string token = Orthanc::Toolbox::StripSpaces(tokens[i]);
+
+      // Weak comparison, as mandated by RFC 7232 for "If-None-Match"
+      if (boost::starts_with(token, "W/"))
+      {
+        token = token.substr(2);
+      }
+
+      if (token == "*" ||
+          token == etag)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  void HttpHelpers::AnswerBuffer(OrthancPluginRestOutput* output,
+                                 const OrthancPluginHttpRequest* request,
+                                 const void* data,
+                                 size_t size,
+                                 const std::string& mime,
+                                 const std::string& etag)
+  {
+    OrthancPluginContext* context = GetGlobalContext();
+
+    OrthancPluginSetHttpHeader(context, output, "ETag", etag.c_str());
+
+    // Force the browsers to revalidate, which is cheap thanks to the ETag
+    OrthancPluginSetHttpHeader(context, output, "Cache-Control", "no-cache");
+
+    if (IsNotModified(request, etag))
+    {
+      OrthancPluginSendHttpStatusCode(context, output, 304);
+    }
+    else
+    {
+      OrthancPluginAnswerBuffer(context, output, reinterpret_cast<const char*>(data), size, mime.c_str());
+    }
+  }
+
+
+  void HttpHelpers::AnswerServiceUnavailable(OrthancPluginRestOutput* output,
+                                             unsigned int retryAfterSeconds)
+  {
+    OrthancPluginContext* context = GetGlobalContext();
+
+    const std::string retryAfter = boost::lexical_cast<std::string>(retryAfterSeconds);
+    OrthancPluginSetHttpHeader(context, output, "Retry-After", retryAfter.c_str());
+    OrthancPluginSendHttpStatusCode(context, output, 503);
+  }
+}
@@ -0,0 +1,68 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+
+namespace OrthancPlugins
+{
+  class HttpHelpers : public boost::noncopyable
+  {
+  public:
+    // Computes a strong validator, including the surrounding double quotes
+    static void ComputeETag(std::string& etag,
+                            const void* data,
+                            size_t size);
+
+    static bool LookupHttpHeader(std::string& value,
+                                 const OrthancPluginHttpRequest* request,
+                                 const std::string& key);
+
+    // Tests whether the "If-None-Match" header of the request matches the given ETag
+    static bool IsNotModified(const OrthancPluginHttpRequest* request,
+                              const std::string& etag);
+
+    /**
+     * Answers with the given buffer, together with its ETag. If the
+     * client already owns this version of the resource, "304 Not
+     * Modified" is sent instead, without the body.
+     **/
+    static void AnswerBuffer(OrthancPluginRestOutput* output,
+                             const OrthancPluginHttpRequest* request,
+                             const void* data,
+                             size_t size,
+                             const std::string& mime,
+                             const std::string& etag);
+
+    static void AnswerBuffer(OrthancPluginRestOutput* output,
+                             const OrthancPluginHttpRequest* request,
+                             const std::string& body,
+                             const std::string& mime,
+                             const std::string& etag)
+    {
+      AnswerBuffer(output, request, body.empty() ? NULL : body.c_str(), body.size(), mime, etag);
+    }
+
+    // Answers "503 Service Unavailable", asking the client to retry after the given delay
+    static void AnswerServiceUnavailable(OrthancPluginRestOutput* output,
+                                         unsigned int retryAfterSeconds);
+  };
+}
@@ -0,0 +1,111 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ImportJobsRegistry.h"
+
+#include "TciaImportJob.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+
+
+namespace OrthancPlugins
+{
+  ImportJobsRegistry::Accessor::Accessor(ImportJobsRegistry& registry,
+                                         const std::string& importId) :
+    lock_(registry.mutex_)
+  {
+    Jobs::const_iterator found = registry.jobs_.find(importId);
+
+    if (found == registry.jobs_.end())
+    {
+      job_ = NULL;
+    }
+    else
+    {
+      job_ = found->second;
+    }
+  }
+
+
+  const TciaImportJob& ImportJobsRegistry::Accessor::GetJob() const
+  {
+    if (job_ == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return *job_;
+    }
+  }
+
+
+  void ImportJobsRegistry::Register(const std::string& importId,
+                                    const TciaImportJob& job)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!jobs_.insert(std::make_pair(importId, &job)).second)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Import job registered twice: " + importId);
+    }
+  }
+
+
+  void ImportJobsRegistry::Unregister(const std::string& importId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    jobs_.erase(importId);
+  }
+
+
+  bool ImportJobsRegistry::LookupImportId(std::string& importId,
+                                          const std::string& jobId)
+  {
+    static const char* const CONTENT = "Content";
+    static const char* const IMPORT_ID = "ImportID";
+
+    Json::Value job;
+    if (RestApiGet(job, "/jobs/" + jobId, false) &&
+        job.type() == Json::objectValue &&
+        job.isMember("Type") &&
+        job["Type"] == TciaImportJob::GetJobType() &&
+        job.isMember(CONTENT) &&
+        job[CONTENT].type() == Json::objectValue &&
+        job[CONTENT].isMember(IMPORT_ID) &&
+        job[CONTENT][IMPORT_ID].type() == Json::stringValue)
+    {
+      importId = job[CONTENT][IMPORT_ID].asString();
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  ImportJobsRegistry& ImportJobsRegistry::GetInstance()
+  {
+    static ImportJobsRegistry registry;
+    return registry;
+  }
+}
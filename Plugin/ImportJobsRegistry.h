@@ -0,0 +1,84 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  class TciaImportJob;
+
+  /**
+   * Registry of the TCIA import jobs that are alive in this instance
+   * of Orthanc, indexed by an identifier that is generated by the
+   * plugin (the "ImportID" in the content of the job). This gives the
+   * REST routes access to the series of a job, without having them
+   * listed in the content of the job, which Orthanc writes as a whole
+   * in each answer to "GET /jobs/{id}".
+   **/
+  class ImportJobsRegistry : public boost::noncopyable
+  {
+  private:
+    typedef std::map<std::string, const TciaImportJob*>  Jobs;
+
+    boost::mutex  mutex_;
+    Jobs          jobs_;
+
+  public:
+    /**
+     * Locks the registry as long as a job is accessed, which prevents
+     * Orthanc from deleting the job in the meantime. The series of a
+     * job must be read with "TciaImportJob::CopySeries()", as the
+     * series of its manifests are added while the job is running.
+     **/
+    class Accessor : public boost::noncopyable
+    {
+    private:
+      boost::mutex::scoped_lock  lock_;
+      const TciaImportJob*       job_;
+
+    public:
+      Accessor(ImportJobsRegistry& registry,
+               const std::string& importId);
+
+      bool IsValid() const
+      {
+        return job_ != NULL;
+      }
+
+      const TciaImportJob& GetJob() const;
+    };
+
+    void Register(const std::string& importId,
+                  const TciaImportJob& job);
+
+    void Unregister(const std::string& importId);
+
+    // Reads the "ImportID" from the content of an Orthanc job, returns "false" if not a TCIA import job
+    static bool LookupImportId(std::string& importId,
+                               const std::string& jobId);
+
+    static ImportJobsRegistry& GetInstance();
+  };
+}
@@ -0,0 +1,242 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ImportStatus.h"
+
+#include "ImportJobsRegistry.h"
+#include "MetadataMirror.h"
+#include "SeriesIndex.h"
+#include "TciaImportJob.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <map>
+#include <set>
+
+
+// Maximum number of series in one page of "/tcia/jobs/{id}/series"
+static const size_t MAX_PAGE_SIZE = 1000;
+
+
+namespace OrthancPlugins
+{
+  static void FormatPatient(Json::Value& target,
+                            const TciaImportJob::PatientStatus& patient)
+  {
+    std::string orthancId;
+    Orthanc::Toolbox::ComputeSHA1(orthancId, patient.GetPatientId());
+
+    target = Json::objectValue;
+    target["Collection"] = patient.GetCollection();
+    target["PatientID"] = patient.GetPatientId();
+    target["OrthancID"] = orthancId;
+    target["SeriesCount"] = patient.GetSeriesCount();
+    target["CompletedSeries"] = patient.GetCompletedSeries();
+    target["InstancesCount"] = patient.GetInstancesCount();
+    target["Size"] = boost::lexical_cast<std::string>(patient.GetSize());
+  }
+
+
+  // Tells whether the series exists in Orthanc, whatever its number of instances
+  static bool IsSeriesPresent(const std::string& seriesInstanceUid)
+  {
+    bool isStored;
+    unsigned int instancesCount;
+    if (SeriesIndex::GetInstance().Lookup(isStored, instancesCount, seriesInstanceUid))
+    {
+      return isStored;
+    }
+
+    // "/tools/lookup" uses the index of the DICOM identifiers in the Orthanc database
+    Json::Value found;
+    if (RestApiPost(found, "/tools/lookup", seriesInstanceUid, false) &&
+        found.type() == Json::arrayValue)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < found.size(); i++)
+      {
+        if (found[i].isMember("Type") &&
+            found[i]["Type"] == "Series")
+        {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+
+  static std::string LookupImportId(const std::string& jobId)
+  {
+    std::string importId;
+    if (ImportJobsRegistry::LookupImportId(importId, jobId))
+    {
+      return importId;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Not a TCIA import job: " + jobId);
+    }
+  }
+
+
+  /**
+   * The status of the series is maintained by the job itself, from
+   * the changes of the index of the series: Reading it does not need
+   * any REST call, which allows to keep the registry locked.
+   **/
+  static const TciaImportJob& GetJob(const ImportJobsRegistry::Accessor& accessor,
+                                     const std::string& jobId)
+  {
+    if (!accessor.IsValid())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Not a TCIA import job: " + jobId);
+    }
+
+    return accessor.GetJob();
+  }
+
+
+  void ImportStatus::ComputeForJob(Json::Value& target,
+                                   const std::string& jobId)
+  {
+    std::vector<TciaImportJob::PatientStatus> patients;
+
+    {
+      ImportJobsRegistry::Accessor accessor(ImportJobsRegistry::GetInstance(), LookupImportId(jobId));
+      GetJob(accessor, jobId).GetPatientsStatus(patients);
+    }
+
+    target = Json::arrayValue;
+
+    for (size_t i = 0; i < patients.size(); i++)
+    {
+      Json::Value item;
+      FormatPatient(item, patients[i]);
+      target.append(item);
+    }
+  }
+
+
+  void ImportStatus::ListJobSeries(Json::Value& target,
+                                   const std::string& jobId,
+                                   Filter filter,
+                                   size_t offset,
+                                   size_t limit)
+  {
+    if (limit == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "The limit must be positive");
+    }
+    else if (limit > MAX_PAGE_SIZE)
+    {
+      limit = MAX_PAGE_SIZE;
+    }
+
+    // Only the series of the page are copied, the filter being applied to the status kept by the job
+    std::vector<TciaImportJob::Series> series;
+    std::vector<bool> stored;
+    size_t total;
+
+    {
+      ImportJobsRegistry::Accessor accessor(ImportJobsRegistry::GetInstance(), LookupImportId(jobId));
+      const TciaImportJob& job = GetJob(accessor, jobId);
+
+      switch (filter)
+      {
+        case Filter_All:
+          total = job.CopySeries(series, stored, offset, limit);
+          break;
+
+        case Filter_Stored:
+        case Filter_Missing:
+          total = job.CopySeriesWithStatus(series, filter == Filter_Stored, offset, limit);
+          stored.assign(series.size(), filter == Filter_Stored);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    target = Json::objectValue;
+    target["Offset"] = static_cast<unsigned int>(offset);
+    target["Limit"] = static_cast<unsigned int>(limit);
+    target["Total"] = static_cast<unsigned int>(total);
+
+    Json::Value& page = target["Items"];
+    page = Json::arrayValue;
+
+    for (size_t i = 0; i < series.size(); i++)
+    {
+      std::string orthancId;
+      Orthanc::Toolbox::ComputeSHA1(orthancId, series[i].GetPatientId());
+
+      Json::Value item = Json::objectValue;
+      item["Collection"] = series[i].GetCollection();
+      item["PatientID"] = series[i].GetPatientId();
+      item["OrthancID"] = orthancId;
+      item["SeriesInstanceUID"] = series[i].GetSeriesInstanceUid();
+      item["InstancesCount"] = series[i].GetInstancesCount();
+      item["Size"] = boost::lexical_cast<std::string>(series[i].GetSize());
+      item["Stored"] = static_cast<bool>(stored[i]);
+      page.append(item);
+    }
+  }
+
+
+  void ImportStatus::ComputeForSeries(Json::Value& target,
+                                      const std::vector<std::string>& seriesInstanceUids)
+  {
+    // The expected number of instances of each series is read from the mirror of TCIA
+    std::vector<MetadataMirror::Series> mirrored;
+    MetadataMirror::GetInstance().LookupSeries(
+      mirrored, std::set<std::string>(seriesInstanceUids.begin(), seriesInstanceUids.end()));
+
+    std::map<std::string, const MetadataMirror::Series*> expected;
+    for (size_t i = 0; i < mirrored.size(); i++)
+    {
+      expected[mirrored[i].GetSeriesInstanceUid()] = &mirrored[i];
+    }
+
+    target = Json::objectValue;
+
+    for (size_t i = 0; i < seriesInstanceUids.size(); i++)
+    {
+      std::map<std::string, const MetadataMirror::Series*>::const_iterator
+        found = expected.find(seriesInstanceUids[i]);
+
+      if (found == expected.end())
+      {
+        // Unknown number of instances
+        target[seriesInstanceUids[i]] = IsSeriesPresent(seriesInstanceUids[i]);
+      }
+      else
+      {
+        const MetadataMirror::Series& s = *found->second;
+        target[seriesInstanceUids[i]] = TciaImportJob::IsSeriesFullyStored(
+          TciaImportJob::Series(s.GetCollection(), s.GetPatientId(), s.GetSeriesInstanceUid(),
+                                s.GetImagesCount(), s.GetSize()));
+      }
+    }
+  }
+}
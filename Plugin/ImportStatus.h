@@ -0,0 +1,74 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <json/value.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Computes which of the series to be imported from TCIA are
+   * already stored in Orthanc, in one single call from the Web
+   * application.
+   **/
+  class ImportStatus : public boost::noncopyable
+  {
+  public:
+    enum Filter
+    {
+      Filter_All,
+      Filter_Stored,
+      Filter_Missing
+    };
+
+    /**
+     * Returns one entry per patient of the job, with the number of
+     * completed series, i.e. the series whose instances are all
+     * stored in Orthanc.
+     **/
+    static void ComputeForJob(Json::Value& target,
+                              const std::string& jobId);
+
+    /**
+     * Returns one page of the series of the job, in the order of the
+     * job, with the Boolean "Stored" telling whether each series is
+     * already stored in Orthanc. The limit must be positive, and is
+     * capped to 1000.
+     **/
+    static void ListJobSeries(Json::Value& target,
+                              const std::string& jobId,
+                              Filter filter,
+                              size_t offset,
+                              size_t limit);
+
+    /**
+     * Returns a map from each SeriesInstanceUID to a Boolean telling
+     * whether all its instances are stored. The series that are not
+     * in the mirror of TCIA are only checked for existence, as their
+     * number of instances is unknown.
+     **/
+    static void ComputeForSeries(Json::Value& target,
+                                 const std::vector<std::string>& seriesInstanceUids);
+  };
+}
@@ -0,0 +1,126 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "IntegerParser.h"
+
+#include <limits>
+
+
+namespace OrthancPlugins
+{
+  bool IntegerParser::ParseUnsignedInteger64(uint64_t& target,
+                                             const char* value,
+                                             size_t size)
+  {
+    if (size > 0 &&
+        value[0] == '+')
+    {
+      value++;
+      size--;
+    }
+
+    if (size == 0)
+    {
+      return false;
+    }
+
+    static const uint64_t MAX = std::numeric_limits<uint64_t>::max();
+
+    uint64_t result = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+      const unsigned int digit = static_cast<unsigned int>(static_cast<unsigned char>(value[i])) - '0';
+      if (digit > 9)
+      {
+        return false;
+      }
+      else if (result > (MAX - digit) / 10)
+      {
+        return false;  // Overflow
+      }
+      else
+      {
+        result = result * 10 + digit;
+      }
+    }
+
+    target = result;
+    return true;
+  }
+
+
+  bool IntegerParser::ParseUnsignedInteger32(uint32_t& target,
+                                             const std::string& value)
+  {
+    uint64_t result;
+    if (ParseUnsignedInteger64(result, value) &&
+        result <= static_cast<uint64_t>(std::numeric_limits<uint32_t>::max()))
+    {
+      target = static_cast<uint32_t>(result);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  bool IntegerParser::ParseInteger32(int32_t& target,
+                                     const std::string& value)
+  {
+    const bool isNegative = (!value.empty() && value[0] == '-');
+
+    if (isNegative &&
+        value.size() > 1 &&
+        value[1] == '+')
+    {
+      return false;  // "-+1" must not be accepted
+    }
+
+    uint64_t magnitude;
+    if (!ParseUnsignedInteger64(magnitude, value.c_str() + (isNegative ? 1 : 0), value.size() - (isNegative ? 1 : 0)))
+    {
+      return false;
+    }
+
+    if (isNegative)
+    {
+      // The magnitude of the smallest value is one more than the largest value
+      if (magnitude > static_cast<uint64_t>(std::numeric_limits<int32_t>::max()) + 1)
+      {
+        return false;
+      }
+
+      target = static_cast<int32_t>(-static_cast<int64_t>(magnitude));
+    }
+    else
+    {
+      if (magnitude > static_cast<uint64_t>(std::numeric_limits<int32_t>::max()))
+      {
+        return false;
+      }
+
+      target = static_cast<int32_t>(magnitude);
+    }
+
+    return true;
+  }
+}
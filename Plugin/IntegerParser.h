@@ -0,0 +1,62 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Parsing of the unsigned decimal integers of the spreadsheets and
+   * of the serialized jobs, as a replacement for
+   * "boost::lexical_cast" on the hot paths: No stream is created, no
+   * memory is allocated, and malformed values are reported by the
+   * return value instead of by exceptions. The value must only
+   * consist of digits, with an optional leading "+". Contrarily to
+   * "boost::lexical_cast", negative values are rejected instead of
+   * wrapping around, except by the signed variant.
+   **/
+  class IntegerParser : public boost::noncopyable
+  {
+  public:
+    // Returns "false" if the value is malformed or does not fit in 64 bits
+    static bool ParseUnsignedInteger64(uint64_t& target,
+                                       const char* value,
+                                       size_t size);
+
+    static bool ParseUnsignedInteger64(uint64_t& target,
+                                       const std::string& value)
+    {
+      return ParseUnsignedInteger64(target, value.c_str(), value.size());
+    }
+
+    // Returns "false" if the value is malformed or does not fit in 32 bits
+    static bool ParseUnsignedInteger32(uint32_t& target,
+                                       const std::string& value);
+
+    // Same as ParseUnsignedInteger32(), but also accepts a leading "-" (e.g. for the priorities of the jobs)
+    static bool ParseInteger32(int32_t& target,
+                               const std::string& value);
+  };
+}
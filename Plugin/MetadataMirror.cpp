@@ -0,0 +1,1351 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MetadataMirror.h"
+
+#include "IntegerParser.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SerializationToolbox.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <deque>
+#include <limits>
+
+
+static const unsigned int MIRROR_VERSION = 1;
+
+// The pool of strings is rebuilt once it has grown by this number of strings since it was last rebuilt
+static const size_t MIN_STRINGS_TO_RECLAIM = 65536;
+
+static const char* const BODY_PART_EXAMINED = "BodyPartExamined";
+static const char* const COLLECTION = "Collection";
+static const char* const FILE_SIZE = "FileSize";
+static const char* const IMAGE_COUNT = "ImageCount";
+static const char* const LAST_UPDATE = "LastUpdate";
+static const char* const MODALITY = "Modality";
+static const char* const PATIENT_ID = "PatientID";
+static const char* const SERIES_DESCRIPTION = "SeriesDescription";
+static const char* const SERIES_INSTANCE_UID = "SeriesInstanceUID";
+static const char* const STUDY_INSTANCE_UID = "StudyInstanceUID";
+
+
+namespace OrthancPlugins
+{
+  static std::string GetStringField(const Json::Value& item,
+                                    const char* field)
+  {
+    if (item.isMember(field) &&
+        item[field].type() == Json::stringValue)
+    {
+      return item[field].asString();
+    }
+    else
+    {
+      return "";
+    }
+  }
+
+
+  static uint64_t GetIntegerField(const Json::Value& item,
+                                  const char* field)
+  {
+    if (!item.isMember(field))
+    {
+      return 0;
+    }
+
+    const Json::Value& value = item[field];
+
+    switch (value.type())
+    {
+      case Json::intValue:
+      case Json::uintValue:
+        return value.isUInt64() ? value.asUInt64() : 0;
+
+      case Json::realValue:
+        // TCIA reports some sizes as floating-point numbers
+        return value.asDouble() > 0 ? static_cast<uint64_t>(value.asDouble()) : 0;
+
+      case Json::stringValue:
+      {
+        uint64_t result;
+        return IntegerParser::ParseUnsignedInteger64(result, value.asString()) ? result : 0;
+      }
+
+      default:
+        return 0;
+    }
+  }
+
+
+  class MetadataMirror::StringPool : public boost::noncopyable
+  {
+  private:
+    struct Hasher
+    {
+      size_t operator() (const boost::string_ref& s) const
+      {
+        return boost::hash_range(s.begin(), s.end());
+      }
+    };
+
+    typedef boost::unordered_map<boost::string_ref, uint32_t, Hasher>  Index;
+
+    // A deque never moves its elements, so the keys of the index remain valid
+    std::deque<std::string>  strings_;
+    Index                    index_;
+    size_t                   charactersCount_;
+
+  public:
+    StringPool() :
+      charactersCount_(0)
+    {
+      Intern("");  // The empty string always has identifier 0
+    }
+
+    uint32_t Intern(const std::string& value)
+    {
+      Index::const_iterator found = index_.find(boost::string_ref(value));
+      if (found != index_.end())
+      {
+        return found->second;
+      }
+      else if (strings_.size() >= static_cast<size_t>(std::numeric_limits<uint32_t>::max()))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+      }
+      else
+      {
+        const uint32_t id = static_cast<uint32_t>(strings_.size());
+        strings_.push_back(value);
+        index_[boost::string_ref(strings_.back())] = id;
+        charactersCount_ += value.size();
+        return id;
+      }
+    }
+
+    bool Lookup(uint32_t& id,
+                const std::string& value) const
+    {
+      Index::const_iterator found = index_.find(boost::string_ref(value));
+      if (found == index_.end())
+      {
+        return false;
+      }
+      else
+      {
+        id = found->second;
+        return true;
+      }
+    }
+
+    const std::string& GetString(uint32_t id) const
+    {
+      if (id >= strings_.size())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+      else
+      {
+        return strings_[id];
+      }
+    }
+
+    size_t GetSize() const
+    {
+      return strings_.size();
+    }
+
+    size_t GetCharactersCount() const
+    {
+      return charactersCount_;
+    }
+  };
+
+
+  namespace
+  {
+    struct SeriesOrdering
+    {
+      bool operator() (const MetadataMirror::Series& a,
+                       const MetadataMirror::Series& b) const
+      {
+        if (a.GetPatientId() != b.GetPatientId())
+        {
+          return a.GetPatientId() < b.GetPatientId();
+        }
+        else if (a.GetStudyInstanceUid() != b.GetStudyInstanceUid())
+        {
+          return a.GetStudyInstanceUid() < b.GetStudyInstanceUid();
+        }
+        else
+        {
+          return a.GetSeriesInstanceUid() < b.GetSeriesInstanceUid();
+        }
+      }
+    };
+
+
+    // A string constraint of a query, resolved as an identifier in the pool of strings
+    class Constraint
+    {
+    private:
+      bool      isActive_;
+      bool      isKnown_;
+      uint32_t  id_;
+
+    public:
+      template <typename Pool>
+      Constraint(const Pool& pool,
+                 const std::string& value) :
+        isActive_(!value.empty()),
+        isKnown_(false),
+        id_(0)
+      {
+        if (isActive_)
+        {
+          isKnown_ = pool.Lookup(id_, value);
+        }
+      }
+
+      // If the string is not in the pool, no series can match
+      bool IsImpossible() const
+      {
+        return isActive_ && !isKnown_;
+      }
+
+      bool IsMatch(uint32_t id) const
+      {
+        return (!isActive_ ||
+                id == id_);
+      }
+    };
+  }
+
+
+  class MetadataMirror::Collection : public boost::noncopyable
+  {
+  private:
+    std::vector<uint32_t>  patientIds_;
+    std::vector<uint32_t>  studyInstanceUids_;
+    std::vector<uint32_t>  seriesInstanceUids_;
+    std::vector<uint32_t>  modalities_;
+    std::vector<uint32_t>  bodyParts_;
+    std::vector<uint32_t>  descriptions_;
+    std::vector<uint32_t>  imagesCounts_;
+    std::vector<uint64_t>  sizes_;
+
+    // First row of each patient (resp. study), followed by the total number of rows
+    std::vector<size_t>    patients_;
+    std::vector<size_t>    studies_;
+
+  public:
+    Collection(StringPool& strings,
+               std::vector<Series>& series /* will be sorted */)
+    {
+      std::sort(series.begin(), series.end(), SeriesOrdering());
+
+      const size_t count = series.size();
+      patientIds_.reserve(count);
+      studyInstanceUids_.reserve(count);
+      seriesInstanceUids_.reserve(count);
+      modalities_.reserve(count);
+      bodyParts_.reserve(count);
+      descriptions_.reserve(count);
+      imagesCounts_.reserve(count);
+      sizes_.reserve(count);
+
+      for (size_t i = 0; i < count; i++)
+      {
+        const Series& s = series[i];
+
+        if (i > 0 &&
+            s.GetSeriesInstanceUid() == series[i - 1].GetSeriesInstanceUid() &&
+            s.GetStudyInstanceUid() == series[i - 1].GetStudyInstanceUid() &&
+            s.GetPatientId() == series[i - 1].GetPatientId())
+        {
+          continue;  // Duplicated series
+        }
+
+        const uint32_t patient = strings.Intern(s.GetPatientId());
+        const uint32_t study = strings.Intern(s.GetStudyInstanceUid());
+
+        if (patientIds_.empty() ||
+            patientIds_.back() != patient)
+        {
+          patients_.push_back(patientIds_.size());
+          studies_.push_back(patientIds_.size());
+        }
+        else if (studyInstanceUids_.back() != study)
+        {
+          studies_.push_back(patientIds_.size());
+        }
+
+        patientIds_.push_back(patient);
+        studyInstanceUids_.push_back(study);
+        seriesInstanceUids_.push_back(strings.Intern(s.GetSeriesInstanceUid()));
+        modalities_.push_back(strings.Intern(s.GetModality()));
+        bodyParts_.push_back(strings.Intern(s.GetBodyPartExamined()));
+        descriptions_.push_back(strings.Intern(s.GetSeriesDescription()));
+        imagesCounts_.push_back(s.GetImagesCount());
+        sizes_.push_back(s.GetSize());
+      }
+
+      patients_.push_back(patientIds_.size());
+      studies_.push_back(patientIds_.size());
+    }
+
+    size_t GetSeriesCount() const
+    {
+      return seriesInstanceUids_.size();
+    }
+
+    size_t GetPatientsCount() const
+    {
+      return patients_.size() - 1;
+    }
+
+    size_t GetStudiesCount() const
+    {
+      return studies_.size() - 1;
+    }
+
+    size_t GetPatientBegin(size_t patient) const
+    {
+      return patients_[patient];
+    }
+
+    size_t GetPatientEnd(size_t patient) const
+    {
+      return patients_[patient + 1];
+    }
+
+    size_t GetStudyBegin(size_t study) const
+    {
+      return studies_[study];
+    }
+
+    size_t GetStudyEnd(size_t study) const
+    {
+      return studies_[study + 1];
+    }
+
+    uint32_t GetPatientId(size_t row) const
+    {
+      return patientIds_[row];
+    }
+
+    uint32_t GetStudyInstanceUid(size_t row) const
+    {
+      return studyInstanceUids_[row];
+    }
+
+    uint32_t GetSeriesInstanceUid(size_t row) const
+    {
+      return seriesInstanceUids_[row];
+    }
+
+    uint32_t GetModality(size_t row) const
+    {
+      return modalities_[row];
+    }
+
+    uint32_t GetBodyPartExamined(size_t row) const
+    {
+      return bodyParts_[row];
+    }
+
+    uint64_t GetSize(size_t row) const
+    {
+      return sizes_[row];
+    }
+
+    // Summarizes the rows in the range [begin, end)
+    void FormatSummary(Json::Value& target,
+                       size_t begin,
+                       size_t end) const
+    {
+      uint64_t imagesCount = 0;
+      uint64_t size = 0;
+
+      for (size_t row = begin; row < end; row++)
+      {
+        imagesCount += imagesCounts_[row];
+        size += sizes_[row];
+      }
+
+      target["SeriesCount"] = static_cast<unsigned int>(end - begin);
+      target[IMAGE_COUNT] = static_cast<Json::UInt64>(imagesCount);
+      target[FILE_SIZE] = static_cast<Json::UInt64>(size);
+    }
+
+    Series GetSeries(const StringPool& strings,
+                     const std::string& collection,
+                     size_t row) const
+    {
+      return Series(collection,
+                    strings.GetString(patientIds_[row]),
+                    strings.GetString(studyInstanceUids_[row]),
+                    strings.GetString(seriesInstanceUids_[row]),
+                    strings.GetString(modalities_[row]),
+                    strings.GetString(bodyParts_[row]),
+                    strings.GetString(descriptions_[row]),
+                    imagesCounts_[row],
+                    sizes_[row]);
+    }
+
+    void Extract(std::vector<Series>& target,
+                 const StringPool& strings,
+                 const std::string& collection) const
+    {
+      target.reserve(target.size() + GetSeriesCount());
+
+      for (size_t row = 0; row < GetSeriesCount(); row++)
+      {
+        target.push_back(GetSeries(strings, collection, row));
+      }
+    }
+  };
+
+
+  MetadataMirror::Series::Series(const std::string& collection,
+                                 const std::string& patientId,
+                                 const std::string& studyInstanceUid,
+                                 const std::string& seriesInstanceUid,
+                                 const std::string& modality,
+                                 const std::string& bodyPartExamined,
+                                 const std::string& seriesDescription,
+                                 unsigned int imagesCount,
+                                 uint64_t size) :
+    collection_(collection),
+    patientId_(patientId),
+    studyInstanceUid_(studyInstanceUid),
+    seriesInstanceUid_(seriesInstanceUid),
+    modality_(modality),
+    bodyPartExamined_(bodyPartExamined),
+    seriesDescription_(seriesDescription),
+    imagesCount_(imagesCount),
+    size_(size)
+  {
+  }
+
+
+  void MetadataMirror::Series::Format(Json::Value& target) const
+  {
+    target = Json::objectValue;
+    target[COLLECTION] = collection_;
+    target[PATIENT_ID] = patientId_;
+    target[STUDY_INSTANCE_UID] = studyInstanceUid_;
+    target[SERIES_INSTANCE_UID] = seriesInstanceUid_;
+    target[MODALITY] = modality_;
+    target[BODY_PART_EXAMINED] = bodyPartExamined_;
+    target[SERIES_DESCRIPTION] = seriesDescription_;
+    target[IMAGE_COUNT] = imagesCount_;
+    target[FILE_SIZE] = static_cast<Json::UInt64>(size_);
+  }
+
+
+  void MetadataMirror::Series::Parse(std::vector<Series>& target,
+                                     const Json::Value& tcia)
+  {
+    if (tcia.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The series from TCIA must be an array");
+    }
+
+    target.reserve(target.size() + tcia.size());
+
+    for (Json::Value::ArrayIndex i = 0; i < tcia.size(); i++)
+    {
+      const Json::Value& item = tcia[i];
+
+      if (item.type() == Json::objectValue)
+      {
+        const std::string collection = GetStringField(item, COLLECTION);
+        const std::string patientId = GetStringField(item, PATIENT_ID);
+        const std::string studyInstanceUid = GetStringField(item, STUDY_INSTANCE_UID);
+        const std::string seriesInstanceUid = GetStringField(item, SERIES_INSTANCE_UID);
+
+        if (!collection.empty() &&
+            !patientId.empty() &&
+            !studyInstanceUid.empty() &&
+            !seriesInstanceUid.empty())
+        {
+          const uint64_t imagesCount = GetIntegerField(item, IMAGE_COUNT);
+
+          target.push_back(Series(collection, patientId, studyInstanceUid, seriesInstanceUid,
+                                  GetStringField(item, MODALITY),
+                                  GetStringField(item, BODY_PART_EXAMINED),
+                                  GetStringField(item, SERIES_DESCRIPTION),
+                                  static_cast<unsigned int>(std::min(imagesCount, static_cast<uint64_t>(
+                                    std::numeric_limits<unsigned int>::max()))),
+                                  GetIntegerField(item, FILE_SIZE)));
+        }
+      }
+    }
+  }
+
+
+  MetadataMirror::Query::Query() :
+    minSize_(0),
+    maxSize_(std::numeric_limits<uint64_t>::max()),
+    offset_(0),
+    limit_(100)
+  {
+  }
+
+
+  const MetadataMirror::Collection* MetadataMirror::LookupCollection(const std::string& name) const
+  {
+    Collections::const_iterator found = collections_.find(name);
+    if (found == collections_.end())
+    {
+      return NULL;
+    }
+    else
+    {
+      assert(found->second != NULL);
+      return found->second;
+    }
+  }
+
+
+  void MetadataMirror::ClearInternal()
+  {
+    for (Collections::iterator it = collections_.begin(); it != collections_.end(); ++it)
+    {
+      assert(it->second != NULL);
+      delete it->second;
+    }
+
+    collections_.clear();
+    strings_.reset(new StringPool);
+    reclaimedStrings_ = strings_->GetSize();
+    lastUpdate_.clear();
+    revision_++;
+  }
+
+
+  void MetadataMirror::ReclaimStringsInternal()
+  {
+    /**
+     * The strings of the replaced and removed series are never
+     * removed from the pool. Once the pool has sufficiently grown, all
+     * the collections are interned again in a new pool, which discards
+     * these strings. As the pool must at least double in size between
+     * two rebuilds, the cost of the rebuilds is amortized.
+     **/
+    if (strings_->GetSize() < 2 * reclaimedStrings_ + MIN_STRINGS_TO_RECLAIM)
+    {
+      return;
+    }
+
+    std::unique_ptr<StringPool> strings(new StringPool);
+    Collections tables;
+
+    try
+    {
+      for (Collections::const_iterator it = collections_.begin(); it != collections_.end(); ++it)
+      {
+        std::vector<Series> rows;
+        it->second->Extract(rows, *strings_, it->first);
+        tables[it->first] = new Collection(*strings, rows);
+      }
+    }
+    catch (...)
+    {
+      for (Collections::iterator it = tables.begin(); it != tables.end(); ++it)
+      {
+        delete it->second;
+      }
+
+      throw;
+    }
+
+    LOG(INFO) << "Rebuilding the pool of strings of the TCIA mirror: " << strings_->GetSize()
+              << " strings before, " << strings->GetSize() << " after";
+
+    for (Collections::iterator it = collections_.begin(); it != collections_.end(); ++it)
+    {
+      delete it->second;
+    }
+
+    collections_.swap(tables);
+    strings_.reset(strings.release());
+    reclaimedStrings_ = strings_->GetSize();
+  }
+
+
+  MetadataMirror::MetadataMirror() :
+    strings_(new StringPool),
+    reclaimedStrings_(0),
+    revision_(0)
+  {
+  }
+
+
+  MetadataMirror::~MetadataMirror()
+  {
+    ClearInternal();
+  }
+
+
+  bool MetadataMirror::ReplaceCollection(const std::string& collection,
+                                         const std::vector<Series>& series)
+  {
+    std::vector<Series> sorted;
+    sorted.reserve(series.size());
+
+    for (size_t i = 0; i < series.size(); i++)
+    {
+      if (series[i].GetCollection() == collection)
+      {
+        sorted.push_back(series[i]);
+      }
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Collections::iterator found = collections_.find(collection);
+
+    if (sorted.empty() &&
+        found != collections_.end() &&
+        found->second->GetSeriesCount() > 0)
+    {
+      return false;
+    }
+
+    std::unique_ptr<Collection> table(new Collection(*strings_, sorted));
+
+    if (found == collections_.end())
+    {
+      collections_[collection] = table.release();
+    }
+    else
+    {
+      delete found->second;
+      found->second = table.release();
+    }
+
+    ReclaimStringsInternal();
+    revision_++;
+    return true;
+  }
+
+
+  void MetadataMirror::UpsertSeries(const std::vector<Series>& series)
+  {
+    typedef std::map<std::string, std::vector<const Series*> >  ByCollection;
+
+    ByCollection updates;
+    for (size_t i = 0; i < series.size(); i++)
+    {
+      updates[series[i].GetCollection()].push_back(&series[i]);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    /**
+     * A series whose collection has changed is removed from its
+     * previous collection. The UIDs that were never interned cannot
+     * be mirrored in another collection.
+     **/
+    boost::unordered_map<uint32_t, const std::string*> newCollections;
+    for (size_t i = 0; i < series.size(); i++)
+    {
+      uint32_t id;
+      if (strings_->Lookup(id, series[i].GetSeriesInstanceUid()))
+      {
+        newCollections[id] = &series[i].GetCollection();
+      }
+    }
+
+    if (!newCollections.empty())
+    {
+      for (Collections::iterator it = collections_.begin(); it != collections_.end(); ++it)
+      {
+        const Collection& table = *it->second;
+
+        std::vector<bool> moved(table.GetSeriesCount(), false);
+        bool hasMoved = false;
+
+        for (size_t row = 0; row < table.GetSeriesCount(); row++)
+        {
+          boost::unordered_map<uint32_t, const std::string*>::const_iterator
+            found = newCollections.find(table.GetSeriesInstanceUid(row));
+
+          if (found != newCollections.end() &&
+              *found->second != it->first)
+          {
+            moved[row] = true;
+            hasMoved = true;
+          }
+        }
+
+        if (hasMoved)
+        {
+          std::vector<Series> rows;
+          for (size_t row = 0; row < table.GetSeriesCount(); row++)
+          {
+            if (!moved[row])
+            {
+              rows.push_back(table.GetSeries(*strings_, it->first, row));
+            }
+          }
+
+          std::unique_ptr<Collection> pruned(new Collection(*strings_, rows));
+          delete it->second;
+          it->second = pruned.release();
+        }
+      }
+    }
+
+    // Only the collections that contain an updated series are rebuilt
+    for (ByCollection::const_iterator it = updates.begin(); it != updates.end(); ++it)
+    {
+      std::vector<Series> rows;
+
+      Collections::iterator found = collections_.find(it->first);
+      if (found != collections_.end())
+      {
+        found->second->Extract(rows, *strings_, it->first);
+      }
+
+      std::map<std::string, size_t> index;
+      for (size_t i = 0; i < rows.size(); i++)
+      {
+        index[rows[i].GetSeriesInstanceUid()] = i;
+      }
+
+      for (size_t i = 0; i < it->second.size(); i++)
+      {
+        const Series& update = *it->second[i];
+
+        std::map<std::string, size_t>::const_iterator existing = index.find(update.GetSeriesInstanceUid());
+        if (existing == index.end())
+        {
+          index[update.GetSeriesInstanceUid()] = rows.size();
+          rows.push_back(update);
+        }
+        else
+        {
+          rows[existing->second] = update;
+        }
+      }
+
+      std::unique_ptr<Collection> table(new Collection(*strings_, rows));
+
+      if (found == collections_.end())
+      {
+        collections_[it->first] = table.release();
+      }
+      else
+      {
+        delete found->second;
+        found->second = table.release();
+      }
+    }
+
+    ReclaimStringsInternal();
+    revision_++;
+  }
+
+
+  void MetadataMirror::RemoveCollection(const std::string& collection)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Collections::iterator found = collections_.find(collection);
+    if (found != collections_.end())
+    {
+      delete found->second;
+      collections_.erase(found);
+      ReclaimStringsInternal();
+      revision_++;
+    }
+  }
+
+
+  void MetadataMirror::ListCollectionNames(std::set<std::string>& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target.clear();
+
+    for (Collections::const_iterator it = collections_.begin(); it != collections_.end(); ++it)
+    {
+      target.insert(it->first);
+    }
+  }
+
+
+  void MetadataMirror::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ClearInternal();
+  }
+
+
+  void MetadataMirror::ListCollections(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::arrayValue;
+
+    for (Collections::const_iterator it = collections_.begin(); it != collections_.end(); ++it)
+    {
+      Json::Value item = Json::objectValue;
+      item[COLLECTION] = it->first;
+      item["PatientsCount"] = static_cast<unsigned int>(it->second->GetPatientsCount());
+      item["StudiesCount"] = static_cast<unsigned int>(it->second->GetStudiesCount());
+      it->second->FormatSummary(item, 0, it->second->GetSeriesCount());
+      target.append(item);
+    }
+  }
+
+
+  bool MetadataMirror::ListPatients(Json::Value& target,
+                                    const std::string& collection)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const Collection* table = LookupCollection(collection);
+    if (table == NULL)
+    {
+      return false;
+    }
+
+    target = Json::arrayValue;
+
+    size_t study = 0;
+
+    for (size_t patient = 0; patient < table->GetPatientsCount(); patient++)
+    {
+      const size_t begin = table->GetPatientBegin(patient);
+      const size_t end = table->GetPatientEnd(patient);
+
+      // The studies are nested inside the range of rows of the patient
+      size_t studiesCount = 0;
+      while (study < table->GetStudiesCount() &&
+             table->GetStudyBegin(study) < end)
+      {
+        studiesCount++;
+        study++;
+      }
+
+      Json::Value item = Json::objectValue;
+      item[COLLECTION] = collection;
+      item[PATIENT_ID] = strings_->GetString(table->GetPatientId(begin));
+      item["StudiesCount"] = static_cast<unsigned int>(studiesCount);
+      table->FormatSummary(item, begin, end);
+      target.append(item);
+    }
+
+    return true;
+  }
+
+
+  bool MetadataMirror::ListStudies(Json::Value& target,
+                                   const std::string& collection,
+                                   const std::string& patientId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const Collection* table = LookupCollection(collection);
+    if (table == NULL)
+    {
+      return false;
+    }
+
+    target = Json::arrayValue;
+
+    Constraint patient(*strings_, patientId);
+    if (patient.IsImpossible())
+    {
+      return true;
+    }
+
+    for (size_t study = 0; study < table->GetStudiesCount(); study++)
+    {
+      const size_t begin = table->GetStudyBegin(study);
+      const size_t end = table->GetStudyEnd(study);
+
+      if (patient.IsMatch(table->GetPatientId(begin)))
+      {
+        Json::Value item = Json::objectValue;
+        item[COLLECTION] = collection;
+        item[PATIENT_ID] = strings_->GetString(table->GetPatientId(begin));
+        item[STUDY_INSTANCE_UID] = strings_->GetString(table->GetStudyInstanceUid(begin));
+        table->FormatSummary(item, begin, end);
+        target.append(item);
+      }
+    }
+
+    return true;
+  }
+
+
+  void MetadataMirror::FindSeries(Json::Value& target,
+                                  const Query& query)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["Offset"] = static_cast<unsigned int>(query.GetOffset());
+    target["Limit"] = static_cast<unsigned int>(query.GetLimit());
+    target["Items"] = Json::arrayValue;
+
+    const Constraint patient(*strings_, query.GetPatientId());
+    const Constraint study(*strings_, query.GetStudyInstanceUid());
+    const Constraint modality(*strings_, query.GetModality());
+    const Constraint bodyPart(*strings_, query.GetBodyPartExamined());
+
+    size_t total = 0;
+
+    if (!patient.IsImpossible() &&
+        !study.IsImpossible() &&
+        !modality.IsImpossible() &&
+        !bodyPart.IsImpossible())
+    {
+      for (Collections::const_iterator it = collections_.begin(); it != collections_.end(); ++it)
+      {
+        if (!query.GetCollection().empty() &&
+            query.GetCollection() != it->first)
+        {
+          continue;
+        }
+
+        const Collection& table = *it->second;
+
+        // Only integer comparisons on the columns, no string is read
+        for (size_t row = 0; row < table.GetSeriesCount(); row++)
+        {
+          if (patient.IsMatch(table.GetPatientId(row)) &&
+              study.IsMatch(table.GetStudyInstanceUid(row)) &&
+              modality.IsMatch(table.GetModality(row)) &&
+              bodyPart.IsMatch(table.GetBodyPartExamined(row)) &&
+              table.GetSize(row) >= query.GetMinSize() &&
+              table.GetSize(row) <= query.GetMaxSize())
+          {
+            if (total >= query.GetOffset() &&
+                (query.GetLimit() == 0 ||
+                 total < query.GetOffset() + query.GetLimit()))
+            {
+              Json::Value item;
+              table.GetSeries(*strings_, it->first, row).Format(item);
+              target["Items"].append(item);
+            }
+
+            total++;
+          }
+        }
+      }
+    }
+
+    target["Total"] = static_cast<unsigned int>(total);
+  }
+
+
+  void MetadataMirror::LookupSeries(std::vector<Series>& target,
+                                    const std::set<std::string>& seriesInstanceUids)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // The UIDs that were never interned cannot be mirrored
+    boost::unordered_set<uint32_t> ids;
+    for (std::set<std::string>::const_iterator it = seriesInstanceUids.begin();
+         it != seriesInstanceUids.end(); ++it)
+    {
+      uint32_t id;
+      if (strings_->Lookup(id, *it))
+      {
+        ids.insert(id);
+      }
+    }
+
+    if (ids.empty())
+    {
+      return;
+    }
+
+    for (Collections::const_iterator it = collections_.begin(); it != collections_.end(); ++it)
+    {
+      const Collection& table = *it->second;
+
+      for (size_t row = 0; row < table.GetSeriesCount(); row++)
+      {
+        if (ids.find(table.GetSeriesInstanceUid(row)) != ids.end())
+        {
+          target.push_back(table.GetSeries(*strings_, it->first, row));
+        }
+      }
+    }
+  }
+
+
+  void MetadataMirror::SetLastUpdate(const std::string& date)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    lastUpdate_ = date;
+  }
+
+
+  bool MetadataMirror::LookupLastUpdate(std::string& date)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (lastUpdate_.empty())
+    {
+      return false;
+    }
+    else
+    {
+      date = lastUpdate_;
+      return true;
+    }
+  }
+
+
+  void MetadataMirror::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    size_t seriesCount = 0;
+    for (Collections::const_iterator it = collections_.begin(); it != collections_.end(); ++it)
+    {
+      seriesCount += it->second->GetSeriesCount();
+    }
+
+    target = Json::objectValue;
+    target["CollectionsCount"] = static_cast<unsigned int>(collections_.size());
+    target["SeriesCount"] = static_cast<unsigned int>(seriesCount);
+    target["StringsCount"] = static_cast<unsigned int>(strings_->GetSize());
+    target["StringsCharacters"] = static_cast<unsigned int>(strings_->GetCharactersCount());
+    target["Persistent"] = !path_.empty();
+
+    if (!lastUpdate_.empty())
+    {
+      target["LastUpdate"] = lastUpdate_;
+    }
+  }
+
+
+  uint64_t MetadataMirror::GetRevision()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return revision_;
+  }
+
+
+  uint64_t MetadataMirror::Apply(IVisitor& visitor)
+  {
+    uint64_t revision;
+    std::set<std::string> names;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      revision = revision_;
+
+      for (Collections::const_iterator it = collections_.begin(); it != collections_.end(); ++it)
+      {
+        names.insert(it->first);
+      }
+    }
+
+    // The mirror is only locked while one collection is copied, never while the visitor runs
+    for (std::set<std::string>::const_iterator name = names.begin(); name != names.end(); ++name)
+    {
+      std::vector<Series> series;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        Collections::const_iterator found = collections_.find(*name);
+        if (found != collections_.end())
+        {
+          found->second->Extract(series, *strings_, *name);
+        }
+      }
+
+      for (size_t i = 0; i < series.size(); i++)
+      {
+        visitor.Visit(series[i]);
+      }
+    }
+
+    return revision;
+  }
+
+
+  void MetadataMirror::SerializeInternal(Json::Value& target) const
+  {
+    /**
+     * The strings are interned again in a new pool, which discards
+     * the strings of the series that have been replaced since the
+     * mirror was loaded.
+     **/
+    StringPool strings;
+
+    target = Json::objectValue;
+    target["Version"] = MIRROR_VERSION;
+    target[LAST_UPDATE] = lastUpdate_;
+    target["Collections"] = Json::objectValue;
+
+    for (Collections::const_iterator it = collections_.begin(); it != collections_.end(); ++it)
+    {
+      Json::Value columns = Json::objectValue;
+      columns[PATIENT_ID] = Json::arrayValue;
+      columns[STUDY_INSTANCE_UID] = Json::arrayValue;
+      columns[SERIES_INSTANCE_UID] = Json::arrayValue;
+      columns[MODALITY] = Json::arrayValue;
+      columns[BODY_PART_EXAMINED] = Json::arrayValue;
+      columns[SERIES_DESCRIPTION] = Json::arrayValue;
+      columns[IMAGE_COUNT] = Json::arrayValue;
+      columns[FILE_SIZE] = Json::arrayValue;
+
+      for (size_t row = 0; row < it->second->GetSeriesCount(); row++)
+      {
+        const Series series = it->second->GetSeries(*strings_, it->first, row);
+        columns[PATIENT_ID].append(strings.Intern(series.GetPatientId()));
+        columns[STUDY_INSTANCE_UID].append(strings.Intern(series.GetStudyInstanceUid()));
+        columns[SERIES_INSTANCE_UID].append(strings.Intern(series.GetSeriesInstanceUid()));
+        columns[MODALITY].append(strings.Intern(series.GetModality()));
+        columns[BODY_PART_EXAMINED].append(strings.Intern(series.GetBodyPartExamined()));
+        columns[SERIES_DESCRIPTION].append(strings.Intern(series.GetSeriesDescription()));
+        columns[IMAGE_COUNT].append(series.GetImagesCount());
+        columns[FILE_SIZE].append(static_cast<Json::UInt64>(series.GetSize()));
+      }
+
+      target["Collections"][it->first] = columns;
+    }
+
+    Json::Value pool = Json::arrayValue;
+    for (size_t i = 0; i < strings.GetSize(); i++)
+    {
+      pool.append(strings.GetString(static_cast<uint32_t>(i)));
+    }
+
+    target["Strings"] = pool;
+  }
+
+
+  void MetadataMirror::Serialize(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    SerializeInternal(target);
+  }
+
+
+  void MetadataMirror::Unserialize(const Json::Value& source)
+  {
+    if (source.type() != Json::objectValue ||
+        Orthanc::SerializationToolbox::ReadUnsignedInteger(source, "Version") != MIRROR_VERSION ||
+        !source.isMember("Strings") ||
+        source["Strings"].type() != Json::arrayValue ||
+        !source.isMember("Collections") ||
+        source["Collections"].type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Bad file format for the TCIA mirror");
+    }
+
+    const Json::Value& pool = source["Strings"];
+    const Json::Value& collections = source["Collections"];
+
+    std::unique_ptr<StringPool> strings(new StringPool);
+    Collections tables;
+
+    try
+    {
+      const std::vector<std::string> names = collections.getMemberNames();
+
+      for (size_t i = 0; i < names.size(); i++)
+      {
+        const Json::Value& columns = collections[names[i]];
+
+        static const char* const FIELDS[] = {
+          PATIENT_ID, STUDY_INSTANCE_UID, SERIES_INSTANCE_UID, MODALITY,
+          BODY_PART_EXAMINED, SERIES_DESCRIPTION, IMAGE_COUNT, FILE_SIZE
+        };
+
+        if (columns.type() != Json::objectValue)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Bad file format for the TCIA mirror");
+        }
+
+        const size_t count = (columns.isMember(PATIENT_ID) ? columns[PATIENT_ID].size() : 0);
+
+        for (size_t j = 0; j < sizeof(FIELDS) / sizeof(FIELDS[0]); j++)
+        {
+          if (!columns.isMember(FIELDS[j]) ||
+              columns[FIELDS[j]].type() != Json::arrayValue ||
+              columns[FIELDS[j]].size() != count)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Bad file format for the TCIA mirror");
+          }
+        }
+
+        std::vector<Series> series;
+        series.reserve(count);
+
+        for (Json::Value::ArrayIndex row = 0; row < count; row++)
+        {
+          std::string values[6];
+          for (size_t j = 0; j < 6; j++)
+          {
+            const Json::Value& id = columns[FIELDS[j]][row];
+            if (!id.isUInt() ||
+                id.asUInt() >= pool.size() ||
+                pool[id.asUInt()].type() != Json::stringValue)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Bad file format for the TCIA mirror");
+            }
+
+            values[j] = pool[id.asUInt()].asString();
+          }
+
+          const Json::Value& imagesCount = columns[IMAGE_COUNT][row];
+          const Json::Value& size = columns[FILE_SIZE][row];
+          if (!imagesCount.isUInt() ||
+              !size.isUInt64())
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Bad file format for the TCIA mirror");
+          }
+
+          series.push_back(Series(names[i], values[0], values[1], values[2], values[3], values[4], values[5],
+                                  imagesCount.asUInt(), size.asUInt64()));
+        }
+
+        tables[names[i]] = new Collection(*strings, series);
+      }
+    }
+    catch (...)
+    {
+      for (Collections::iterator it = tables.begin(); it != tables.end(); ++it)
+      {
+        delete it->second;
+      }
+
+      throw;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    ClearInternal();
+    strings_.reset(strings.release());
+    reclaimedStrings_ = strings_->GetSize();
+    collections_.swap(tables);
+
+    if (source.isMember(LAST_UPDATE) &&
+        source[LAST_UPDATE].type() == Json::stringValue)
+    {
+      lastUpdate_ = source[LAST_UPDATE].asString();
+    }
+  }
+
+
+  void MetadataMirror::SetPath(const std::string& path)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    path_ = path;
+  }
+
+
+  void MetadataMirror::Load()
+  {
+    std::string path;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      path = path_;
+    }
+
+    if (!path.empty() &&
+        Orthanc::SystemToolbox::IsExistingFile(path))
+    {
+      std::string content;
+      Orthanc::SystemToolbox::ReadFile(content, path);
+
+      Json::Value source;
+      if (!ReadJson(source, content))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Cannot parse the TCIA mirror: " + path);
+      }
+
+      Unserialize(source);
+
+      Json::Value statistics;
+      GetStatistics(statistics);
+      LOG(WARNING) << "The TCIA mirror has been loaded from " << path << " with "
+                   << statistics["SeriesCount"].asUInt() << " series";
+    }
+  }
+
+
+  void MetadataMirror::Save()
+  {
+    std::string path;
+    Json::Value serialized;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (path_.empty())
+      {
+        return;
+      }
+
+      path = path_;
+      SerializeInternal(serialized);
+    }
+
+    std::string content;
+    WriteFastJson(content, serialized);
+
+    // Write to a temporary file, then rename it, so that a crash never leaves a truncated mirror
+    const std::string tmp = path + ".tmp";
+    Orthanc::SystemToolbox::WriteFile(content, tmp, true /* fsync */);
+
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                      "Cannot write the TCIA mirror to: " + path);
+    }
+
+    LOG(INFO) << "The TCIA mirror has been saved to " << path;
+  }
+
+
+  MetadataMirror& MetadataMirror::GetInstance()
+  {
+    static MetadataMirror mirror;
+    return mirror;
+  }
+}
@@ -0,0 +1,352 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <Compatibility.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Local mirror of the metadata of TCIA, organized as the hierarchy
+   * collections, patients, studies and series. Each collection is
+   * stored as a table with one column per field, whose strings are
+   * interned in a pool shared by all the collections. The series of
+   * a collection are sorted by patient, then by study, so that each
+   * patient and each study is a contiguous range of rows.
+   **/
+  class MetadataMirror : public boost::noncopyable
+  {
+  public:
+    // One series, as returned by the "getSeries" route of TCIA
+    class Series
+    {
+    private:
+      std::string   collection_;
+      std::string   patientId_;
+      std::string   studyInstanceUid_;
+      std::string   seriesInstanceUid_;
+      std::string   modality_;
+      std::string   bodyPartExamined_;
+      std::string   seriesDescription_;
+      unsigned int  imagesCount_;
+      uint64_t      size_;
+
+    public:
+      Series(const std::string& collection,
+             const std::string& patientId,
+             const std::string& studyInstanceUid,
+             const std::string& seriesInstanceUid,
+             const std::string& modality,
+             const std::string& bodyPartExamined,
+             const std::string& seriesDescription,
+             unsigned int imagesCount,
+             uint64_t size);
+
+      const std::string& GetCollection() const
+      {
+        return collection_;
+      }
+
+      const std::string& GetPatientId() const
+      {
+        return patientId_;
+      }
+
+      const std::string& GetStudyInstanceUid() const
+      {
+        return studyInstanceUid_;
+      }
+
+      const std::string& GetSeriesInstanceUid() const
+      {
+        return seriesInstanceUid_;
+      }
+
+      const std::string& GetModality() const
+      {
+        return modality_;
+      }
+
+      const std::string& GetBodyPartExamined() const
+      {
+        return bodyPartExamined_;
+      }
+
+      const std::string& GetSeriesDescription() const
+      {
+        return seriesDescription_;
+      }
+
+      unsigned int GetImagesCount() const
+      {
+        return imagesCount_;
+      }
+
+      uint64_t GetSize() const
+      {
+        return size_;
+      }
+
+      // Formats the series with the same field names as TCIA
+      void Format(Json::Value& target) const;
+
+      // Parses the answer of "getSeries", ignoring the items without identifiers
+      static void Parse(std::vector<Series>& target,
+                        const Json::Value& tcia);
+    };
+
+
+    class IVisitor : public boost::noncopyable
+    {
+    public:
+      virtual ~IVisitor()
+      {
+      }
+
+      virtual void Visit(const Series& series) = 0;
+    };
+
+
+    class Query
+    {
+    private:
+      std::string  collection_;
+      std::string  patientId_;
+      std::string  studyInstanceUid_;
+      std::string  modality_;
+      std::string  bodyPartExamined_;
+      uint64_t     minSize_;
+      uint64_t     maxSize_;
+      size_t       offset_;
+      size_t       limit_;
+
+    public:
+      Query();
+
+      // The empty string means no constraint on a string field
+      void SetCollection(const std::string& collection)
+      {
+        collection_ = collection;
+      }
+
+      const std::string& GetCollection() const
+      {
+        return collection_;
+      }
+
+      void SetPatientId(const std::string& patientId)
+      {
+        patientId_ = patientId;
+      }
+
+      const std::string& GetPatientId() const
+      {
+        return patientId_;
+      }
+
+      void SetStudyInstanceUid(const std::string& studyInstanceUid)
+      {
+        studyInstanceUid_ = studyInstanceUid;
+      }
+
+      const std::string& GetStudyInstanceUid() const
+      {
+        return studyInstanceUid_;
+      }
+
+      void SetModality(const std::string& modality)
+      {
+        modality_ = modality;
+      }
+
+      const std::string& GetModality() const
+      {
+        return modality_;
+      }
+
+      void SetBodyPartExamined(const std::string& bodyPart)
+      {
+        bodyPartExamined_ = bodyPart;
+      }
+
+      const std::string& GetBodyPartExamined() const
+      {
+        return bodyPartExamined_;
+      }
+
+      // Size of the series in bytes, both bounds being inclusive
+      void SetMinSize(uint64_t size)
+      {
+        minSize_ = size;
+      }
+
+      uint64_t GetMinSize() const
+      {
+        return minSize_;
+      }
+
+      void SetMaxSize(uint64_t size)
+      {
+        maxSize_ = size;
+      }
+
+      uint64_t GetMaxSize() const
+      {
+        return maxSize_;
+      }
+
+      void SetOffset(size_t offset)
+      {
+        offset_ = offset;
+      }
+
+      size_t GetOffset() const
+      {
+        return offset_;
+      }
+
+      // "0" means no limit
+      void SetLimit(size_t limit)
+      {
+        limit_ = limit;
+      }
+
+      size_t GetLimit() const
+      {
+        return limit_;
+      }
+    };
+
+  private:
+    class StringPool;
+    class Collection;
+
+    typedef std::map<std::string, Collection*>  Collections;
+
+    boost::mutex                 mutex_;
+    std::unique_ptr<StringPool>  strings_;
+    size_t                       reclaimedStrings_;  // Size of the pool after it was last rebuilt
+    Collections                  collections_;
+    std::string                  lastUpdate_;
+    std::string                  path_;
+    uint64_t                     revision_;  // Incremented on each modification of the series
+
+    const Collection* LookupCollection(const std::string& name) const;
+
+    void SerializeInternal(Json::Value& target) const;
+
+    void ClearInternal();
+
+    void ReclaimStringsInternal();
+
+  public:
+    MetadataMirror();
+
+    ~MetadataMirror();
+
+    /**
+     * Replaces all the series of one collection. A collection that is
+     * not empty is never replaced by an empty list, which TCIA
+     * transiently answers: The collection is kept, and "false" is
+     * returned.
+     **/
+    bool ReplaceCollection(const std::string& collection,
+                           const std::vector<Series>& series);
+
+    /**
+     * Adds the given series, or replaces them if already mirrored
+     * (same SeriesInstanceUID), possibly in another collection.
+     **/
+    void UpsertSeries(const std::vector<Series>& series);
+
+    void RemoveCollection(const std::string& collection);
+
+    void ListCollectionNames(std::set<std::string>& target);
+
+    void Clear();
+
+    void ListCollections(Json::Value& target);
+
+    // Returns "false" if the collection is not mirrored
+    bool ListPatients(Json::Value& target,
+                      const std::string& collection);
+
+    // Returns "false" if the collection is not mirrored
+    bool ListStudies(Json::Value& target,
+                     const std::string& collection,
+                     const std::string& patientId);
+
+    // Returns {Total, Offset, Limit, Items}, like "TciaBrowser::Query"
+    void FindSeries(Json::Value& target,
+                    const Query& query);
+
+    /**
+     * Appends the mirrored series whose SeriesInstanceUID belongs to
+     * the given set, in one single pass over the mirror. The series
+     * that are not mirrored are ignored.
+     **/
+    void LookupSeries(std::vector<Series>& target,
+                      const std::set<std::string>& seriesInstanceUids);
+
+    // Date (in the "YYYYMMDD" format) since which the mirror has been kept up-to-date
+    void SetLastUpdate(const std::string& date);
+
+    bool LookupLastUpdate(std::string& date);
+
+    void GetStatistics(Json::Value& target);
+
+    uint64_t GetRevision();
+
+    /**
+     * Visits all the series, and returns the revision of the mirror
+     * that was visited. The series are copied collection by
+     * collection, so that the mirror is not locked by the visitor. If
+     * the mirror is modified meanwhile, the returned revision is older
+     * than the current revision, hence the visit is to be done again.
+     **/
+    uint64_t Apply(IVisitor& visitor);
+
+    void Serialize(Json::Value& target);
+
+    void Unserialize(const Json::Value& source);
+
+    // The empty string disables the persistence of the mirror
+    void SetPath(const std::string& path);
+
+    // Reads the mirror from its file, if persistence is enabled and if the file exists
+    void Load();
+
+    // Writes the mirror to its file, if persistence is enabled
+    void Save();
+
+    static MetadataMirror& GetInstance();
+  };
+}
@@ -0,0 +1,145 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "NegativeCache.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+
+static boost::posix_time::ptime GetNow()
+{
+  return boost::posix_time::microsec_clock::universal_time();
+}
+
+
+namespace OrthancPlugins
+{
+  void NegativeCache::RemoveExpired(const boost::posix_time::ptime& now)
+  {
+    Content::iterator it = content_.begin();
+
+    while (it != content_.end())
+    {
+      if (it->second.expiration_ <= now)
+      {
+        content_.erase(it++);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+
+
+  NegativeCache::NegativeCache() :
+    ttl_(0),
+    maximumSize_(10000),
+    countHits_(0)
+  {
+  }
+
+
+  void NegativeCache::SetTimeToLive(unsigned int seconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    ttl_ = seconds;
+
+    if (ttl_ == 0)
+    {
+      content_.clear();
+    }
+  }
+
+
+  void NegativeCache::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.clear();
+  }
+
+
+  bool NegativeCache::Lookup(std::string& message,
+                             const std::string& url)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(url);
+
+    if (found == content_.end())
+    {
+      return false;
+    }
+    else if (found->second.expiration_ <= GetNow())
+    {
+      content_.erase(found);
+      return false;
+    }
+    else
+    {
+      message = found->second.message_;
+      countHits_++;
+      return true;
+    }
+  }
+
+
+  void NegativeCache::Add(const std::string& url,
+                          const std::string& message)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (ttl_ != 0)
+    {
+      const boost::posix_time::ptime now = GetNow();
+
+      if (content_.size() >= maximumSize_)
+      {
+        RemoveExpired(now);
+      }
+
+      if (content_.size() < maximumSize_ ||
+          content_.find(url) != content_.end())
+      {
+        Failure& failure = content_[url];
+        failure.expiration_ = now + boost::posix_time::seconds(ttl_);
+        failure.message_ = message;
+      }
+    }
+  }
+
+
+  void NegativeCache::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["TimeToLive"] = ttl_;
+    target["Size"] = static_cast<unsigned int>(content_.size());
+    target["CountHits"] = boost::lexical_cast<std::string>(countHits_);
+  }
+
+
+  NegativeCache& NegativeCache::GetInstance()
+  {
+    static NegativeCache cache;
+    return cache;
+  }
+}
@@ -0,0 +1,75 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Short-lived memory of the URLs of TCIA whose last call has failed.
+   * While the failure is remembered, the same URL fails at once
+   * instead of calling TCIA again.
+   **/
+  class NegativeCache : public boost::noncopyable
+  {
+  private:
+    struct Failure
+    {
+      boost::posix_time::ptime  expiration_;
+      std::string               message_;
+    };
+
+    typedef std::map<std::string, Failure>  Content;
+
+    boost::mutex  mutex_;
+    Content       content_;
+    unsigned int  ttl_;          // In seconds, "0" disables the negative cache
+    size_t        maximumSize_;
+    uint64_t      countHits_;
+
+    void RemoveExpired(const boost::posix_time::ptime& now);
+
+  public:
+    NegativeCache();
+
+    void SetTimeToLive(unsigned int seconds);
+
+    void Clear();
+
+    // Returns "true" if a failure of this URL is remembered
+    bool Lookup(std::string& message,
+                const std::string& url);
+
+    void Add(const std::string& url,
+             const std::string& message);
+
+    void GetStatistics(Json::Value& target);
+
+    static NegativeCache& GetInstance();
+  };
+}
@@ -21,8 +21,24 @@
 #  error Macro ORTHANC_STANDALONE must be defined
 #endif
 
+#include "AdmissionControl.h"
+#include "CircuitBreaker.h"
+#include "ImportStatus.h"
+#include "IntegerParser.h"
+#include "MetadataMirror.h"
+#include "NegativeCache.h"
+#include "RateLimiter.h"
+#include "SearchIndex.h"
+#include "SeriesIndex.h"
+#include "TciaBrowser.h"
 #include "TciaImportJob.h"
+#include "TciaManifest.h"
+#include "TciaMirrorJob.h"
+#include "TciaSyncJob.h"
+#include "TciaProxy.h"
 #include "HttpCache.h"
+#include "HttpClientPool.h"
+#include "HttpHelpers.h"
 #include "CsvParser.h"
 
 #include <EmbeddedResources.h>
@@ -36,6 +52,8 @@
 #  include <SystemToolbox.h>
 #endif
 
+#include <limits>
+
 
 
 static OrthancPluginJob* TciaJobUnserializer(const char *jobType,
@@ -50,6 +68,16 @@ static OrthancPluginJob* TciaJobUnserializer(const char *jobType,
     {
       return OrthancPlugins::OrthancJob::Create(OrthancPlugins::TciaImportJob::Unserialize(value));
     }
+    else if (std::string(jobType) == OrthancPlugins::TciaMirrorJob::GetJobType() &&
+             OrthancPlugins::ReadJson(value, serialized))
+    {
+      return OrthancPlugins::OrthancJob::Create(OrthancPlugins::TciaMirrorJob::Unserialize(value));
+    }
+    else if (std::string(jobType) == OrthancPlugins::TciaSyncJob::GetJobType() &&
+             OrthancPlugins::ReadJson(value, serialized))
+    {
+      return OrthancPlugins::OrthancJob::Create(OrthancPlugins::TciaSyncJob::Unserialize(value));
+    }
     else
     {
       return NULL;
@@ -63,6 +91,37 @@ static OrthancPluginJob* TciaJobUnserializer(const char *jobType,
 
 
 
+/**
+ * Answers "503 Service Unavailable" with a "Retry-After" header to
+ * the requests that cannot reach TCIA for now: Rejected by the
+ * admission control, by the circuit breaker or by the pool of HTTP
+ * clients, or unavailability of TCIA itself.
+ **/
+template <OrthancPlugins::RestCallback Callback>
+void ShedOverload(OrthancPluginRestOutput* output,
+                  const char* url,
+                  const OrthancPluginHttpRequest* request)
+{
+  try
+  {
+    Callback(output, url, request);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    if (e.GetHttpStatus() == Orthanc::HttpStatus_503_ServiceUnavailable)
+    {
+      LOG(INFO) << "Request to TCIA shed with a 503 status (" << (e.HasDetails() ? e.GetDetails() : e.What())
+                << "): " << url;
+      OrthancPlugins::HttpHelpers::AnswerServiceUnavailable(output, 1 /* retry after 1 second */);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
 void TciaHttpProxy(OrthancPluginRestOutput* output,
                    const char* url,
                    const OrthancPluginHttpRequest* request)
@@ -73,67 +132,414 @@ void TciaHttpProxy(OrthancPluginRestOutput* output,
   }
   else
   {
-    std::string tcia = OrthancPlugins::TciaImportJob::GetTciaUrl(request->groups[0]);
+    OrthancPlugins::TciaProxy::Arguments arguments;
+    OrthancPlugins::TciaProxy::Fields fields;
 
+    // The "fields" argument selects the fields of the answer, the other ones are forwarded to TCIA
     for (uint32_t i = 0; i < request->getCount; i++)
     {
-      if (i == 0)
+      const std::string key(request->getKeys[i]);
+      const std::string value(request->getValues[i]);
+
+      if (key == "fields")
       {
-        tcia += "?";
+        OrthancPlugins::TciaProxy::ParseFields(fields, value);
       }
       else
       {
-        tcia += "&";
+        arguments[key] = value;
       }
-
-      std::string encoded;
-      Orthanc::Toolbox::UriEncode(encoded, request->getValues[i]);
-    
-      tcia += std::string(request->getKeys[i]) + "=" + encoded;
     }
 
-    std::string oldBody, oldMime;
-    if (OrthancPlugins::HttpCache::GetInstance().Read(oldBody, oldMime, tcia))
+    const std::string tcia = OrthancPlugins::TciaProxy::GetUrl(request->groups[0], arguments);
+    OrthancPlugins::TciaProxy::Answer(output, request, tcia, fields);
+  }
+}
+
+
+// Contrarily to "boost::lexical_cast", negative values are rejected instead of wrapping around
+static uint64_t ParseUnsignedArgument(const std::string& key,
+                                      const std::string& value)
+{
+  uint64_t result;
+  if (OrthancPlugins::IntegerParser::ParseUnsignedInteger64(result, value))
+  {
+    return result;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Argument \"" + key + "\" must be a non-negative integer: " + value);
+  }
+}
+
+
+static size_t ParseSizeArgument(const std::string& key,
+                                const std::string& value)
+{
+  const uint64_t result = ParseUnsignedArgument(key, value);
+
+  if (result > static_cast<uint64_t>(std::numeric_limits<size_t>::max()))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Argument \"" + key + "\" is too large: " + value);
+  }
+  else
+  {
+    return static_cast<size_t>(result);
+  }
+}
+
+
+void TciaBrowse(OrthancPluginRestOutput* output,
+                const char* url,
+                const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "GET");
+  }
+  else
+  {
+    std::string path;
+    if (!OrthancPlugins::TciaBrowser::LookupTciaPath(path, request->groups[0]))
     {
-      OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output,
-                                oldBody.empty() ? NULL : oldBody.c_str(), oldBody.size(), oldMime.c_str());
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
     }
-    else
+
+    OrthancPlugins::TciaBrowser::Query query;
+    OrthancPlugins::TciaProxy::Arguments arguments;
+
+    // The lower-case arguments control the browsing, the other ones are forwarded to TCIA
+    for (uint32_t i = 0; i < request->getCount; i++)
     {
-      OrthancPlugins::MemoryBuffer body, headersBuffer;
-      uint16_t status;
+      const std::string key(request->getKeys[i]);
+      const std::string value(request->getValues[i]);
 
-      if (OrthancPluginErrorCode_Success == OrthancPluginHttpClient(
-            OrthancPlugins::GetGlobalContext(), *body, *headersBuffer, &status,
-            OrthancPluginHttpMethod_Get, tcia.c_str(),
-            0 /* HTTP headers in request */, NULL, NULL,
-            NULL /* body */, 0,
-            NULL /* username */, NULL /* password */,
-            0 /* use default timeout */, NULL, NULL, NULL, 0))
+      if (key == "filter")
       {
-        Json::Value headers;
-        headersBuffer.ToJson(headers);
-
-        static const char* const CONTENT_TYPE = "Content-Type";
-      
-        std::string mime = "application/octet-stream";
-        if (headers.type() == Json::objectValue &&
-            headers.isMember(CONTENT_TYPE))
+        query.SetFilter(value);
+      }
+      else if (key == "sort")
+      {
+        query.SetSort(value, query.IsAscending());
+      }
+      else if (key == "order")
+      {
+        if (value != "asc" &&
+            value != "desc")
         {
-          mime = Orthanc::SerializationToolbox::ReadString(headers, CONTENT_TYPE);
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "The order must be \"asc\" or \"desc\"");
         }
 
-        OrthancPlugins::HttpCache::GetInstance().Write(tcia, body.GetData(), body.GetSize(), mime);
+        query.SetSort(query.GetSortField(), value == "asc");
+      }
+      else if (key == "offset")
+      {
+        query.SetOffset(ParseSizeArgument(key, value));
+      }
+      else if (key == "limit")
+      {
+        query.SetLimit(ParseSizeArgument(key, value));
+      }
+      else
+      {
+        arguments[key] = value;
+      }
+    }
+
+    Json::Value answer;
+    query.Apply(answer, *OrthancPlugins::TciaProxy::GetJson(OrthancPlugins::TciaProxy::GetUrl(path, arguments),
+                                                               OrthancPlugins::RateLimiter::Lane_Interactive));
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
+void GetPatientView(OrthancPluginRestOutput* output,
+                    const char* url,
+                    const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "GET");
+  }
+  else
+  {
+    std::string collection, patientId;
+    bool hasCollection = false;
+    bool hasPatientId = false;
+    OrthancPlugins::TciaProxy::Fields seriesFields;
+
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      if (std::string(request->getKeys[i]) == "Collection")
+      {
+        collection = request->getValues[i];
+        hasCollection = true;
+      }
+      else if (std::string(request->getKeys[i]) == "PatientID")
+      {
+        patientId = request->getValues[i];
+        hasPatientId = true;
+      }
+      else if (std::string(request->getKeys[i]) == "fields")
+      {
+        OrthancPlugins::TciaProxy::ParseFields(seriesFields, request->getValues[i]);
+      }
+    }
+
+    if (!hasCollection ||
+        !hasPatientId)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Arguments \"Collection\" and \"PatientID\" are mandatory");
+    }
+
+    Json::Value answer;
+    OrthancPlugins::TciaBrowser::GetPatientView(answer, collection, patientId, seriesFields);
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
+// Reads the "Priority" option of the jobs that update the mirror
+static int ReadPriority(const Json::Value& body)
+{
+  if (body.isMember("Priority"))
+  {
+    if (body["Priority"].type() != Json::intValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Option \"Priority\" must be an integer");
+    }
+
+    return body["Priority"].asInt();
+  }
+  else
+  {
+    return 0;
+  }
+}
+
+
+// Answers with the job that updates the mirror, which is either the submitted one or the one that was already active
+static void AnswerMirrorJob(OrthancPluginRestOutput* output,
+                            const std::string& jobId,
+                            bool submitted)
+{
+  Json::Value answer = Json::objectValue;
+  answer["ID"] = jobId;
+  answer["Path"] = "/jobs/" + jobId;
+  answer["Submitted"] = submitted;
+  OrthancPlugins::AnswerJson(answer, output);
+}
+
+
+void RefreshMirror(OrthancPluginRestOutput* output,
+                   const char* url,
+                   const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+  }
+  else
+  {
+    static const char* const COLLECTIONS = "Collections";
+
+    Json::Value body = Json::objectValue;
+    if (request->bodySize != 0 &&
+        (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+         body.type() != Json::objectValue))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    std::unique_ptr<OrthancPlugins::TciaMirrorJob> job(new OrthancPlugins::TciaMirrorJob);
+
+    if (body.isMember(COLLECTIONS))
+    {
+      std::set<std::string> collections;
+      Orthanc::SerializationToolbox::ReadSetOfStrings(collections, body, COLLECTIONS);
+
+      for (std::set<std::string>::const_iterator it = collections.begin(); it != collections.end(); ++it)
+      {
+        job->AddCollection(*it);
+      }
+    }
+
+    // The refresh job is always asynchronous, as it is serialized with the sync jobs
+    std::string jobId;
+    const bool submitted = OrthancPlugins::TciaSyncJob::SubmitUnlessActive(jobId, job.release(), ReadPriority(body));
+    AnswerMirrorJob(output, jobId, submitted);
+  }
+}
+
+
+void SyncMirror(OrthancPluginRestOutput* output,
+                const char* url,
+                const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+  }
+  else
+  {
+    Json::Value body = Json::objectValue;
+    if (request->bodySize != 0 &&
+        (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+         body.type() != Json::objectValue))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    std::string lastUpdate;
+    if (!OrthancPlugins::MetadataMirror::GetInstance().LookupLastUpdate(lastUpdate))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "The TCIA mirror must be fully refreshed once before it can be synchronized");
+    }
+
+    // The sync job is always asynchronous, as a scheduled sync job might already be running
+    std::string jobId;
+    const bool submitted = OrthancPlugins::TciaSyncJob::SubmitUnlessActive(jobId, ReadPriority(body));
+    AnswerMirrorJob(output, jobId, submitted);
+  }
+}
+
 
-        OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output,
-                                  reinterpret_cast<const char*>(body.GetData()), body.GetSize(), mime.c_str());
+void BrowseMirror(OrthancPluginRestOutput* output,
+                  const char* url,
+                  const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "GET");
+  }
+  else
+  {
+    const std::string level(request->groups[0]);
+
+    OrthancPlugins::MetadataMirror::Query query;
+
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      const std::string key(request->getKeys[i]);
+      const std::string value(request->getValues[i]);
+
+      if (key == "Collection")
+      {
+        query.SetCollection(value);
+      }
+      else if (key == "PatientID")
+      {
+        query.SetPatientId(value);
+      }
+      else if (key == "StudyInstanceUID")
+      {
+        query.SetStudyInstanceUid(value);
+      }
+      else if (key == "Modality")
+      {
+        query.SetModality(value);
+      }
+      else if (key == "BodyPartExamined")
+      {
+        query.SetBodyPartExamined(value);
+      }
+      else if (key == "MinSize")
+      {
+        query.SetMinSize(ParseUnsignedArgument(key, value));
+      }
+      else if (key == "MaxSize")
+      {
+        query.SetMaxSize(ParseUnsignedArgument(key, value));
+      }
+      else if (key == "offset")
+      {
+        query.SetOffset(ParseSizeArgument(key, value));
+      }
+      else if (key == "limit")
+      {
+        query.SetLimit(ParseSizeArgument(key, value));
       }
       else
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem,
-                                        "Cannot proxy HTTP request to TCIA: " + tcia);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unsupported argument to browse the TCIA mirror: " + key);
+      }
+    }
+
+    OrthancPlugins::MetadataMirror& mirror = OrthancPlugins::MetadataMirror::GetInstance();
+
+    Json::Value answer;
+
+    if (level == "collections")
+    {
+      mirror.ListCollections(answer);
+    }
+    else if (level == "patients")
+    {
+      if (!mirror.ListPatients(answer, query.GetCollection()))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                        "Collection not in the TCIA mirror: " + query.GetCollection());
+      }
+    }
+    else if (level == "studies")
+    {
+      if (!mirror.ListStudies(answer, query.GetCollection(), query.GetPatientId()))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                        "Collection not in the TCIA mirror: " + query.GetCollection());
+      }
+    }
+    else if (level == "series")
+    {
+      mirror.FindSeries(answer, query);
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
+void Search(OrthancPluginRestOutput* output,
+            const char* url,
+            const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "GET");
+  }
+  else
+  {
+    std::string query;
+    size_t limit = 20;
+
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      const std::string key(request->getKeys[i]);
+
+      if (key == "q")
+      {
+        query = request->getValues[i];
+      }
+      else if (key == "limit")
+      {
+        limit = ParseSizeArgument(key, request->getValues[i]);
       }
     }
+
+    Json::Value answer;
+    OrthancPlugins::SearchIndex::GetInstance().Search(answer, query, limit);
+    OrthancPlugins::AnswerJson(answer, output);
   }
 }
 
@@ -163,17 +569,35 @@ void TciaImport(OrthancPluginRestOutput* output,
       
         OrthancPlugins::OrthancJob::SubmitFromRestApiPost(output, body, job.release());
       }
+      else if (Orthanc::SerializationToolbox::ReadString(body, "Type") == "TciaManifest")
+      {
+        std::string content;
+        Orthanc::Toolbox::DecodeBase64(content, Orthanc::SerializationToolbox::ReadString(body, CONTENT));
+
+        OrthancPlugins::TciaManifest manifest;
+        manifest.AddChunk(content.empty() ? NULL : content.c_str(), content.size());
+        manifest.Finish();
+
+        std::unique_ptr<OrthancPlugins::TciaImportJob> job(new OrthancPlugins::TciaImportJob);
+        job->AddTciaManifest(manifest);
+
+        OrthancPlugins::OrthancJob::SubmitFromRestApiPost(output, body, job.release());
+      }
       else if (Orthanc::SerializationToolbox::ReadString(body, "Type") == "Series" &&
                body.isMember(CONTENT) &&
                body[CONTENT].type() == Json::arrayValue)
       {
-        std::unique_ptr<OrthancPlugins::TciaImportJob> job(new OrthancPlugins::TciaImportJob);
+        std::vector<OrthancPlugins::TciaImportJob::Series> series;
+        series.reserve(body[CONTENT].size());
 
         for (Json::Value::ArrayIndex i = 0; i < body[CONTENT].size(); i++)
         {
-          job->AddSeries(OrthancPlugins::TciaImportJob::Series::Unserialize(body[CONTENT][i]));
+          series.push_back(OrthancPlugins::TciaImportJob::Series::Unserialize(body[CONTENT][i]));
         }
-        
+
+        std::unique_ptr<OrthancPlugins::TciaImportJob> job(new OrthancPlugins::TciaImportJob);
+        job->AddSeries(series);
+
         OrthancPlugins::OrthancJob::SubmitFromRestApiPost(output, body, job.release());
       }
       else
@@ -189,6 +613,263 @@ void TciaImport(OrthancPluginRestOutput* output,
 }
 
 
+class SpreadsheetUpload : public OrthancPlugins::IChunkedRequestReader
+{
+private:
+  std::unique_ptr<OrthancPlugins::TciaImportJob>                     job_;
+  std::unique_ptr<OrthancPlugins::TciaImportJob::SpreadsheetReader>  reader_;
+  Json::Value                                                        options_;
+
+public:
+  explicit SpreadsheetUpload(const Json::Value& options) :
+    job_(new OrthancPlugins::TciaImportJob),
+    options_(options)
+  {
+    reader_.reset(new OrthancPlugins::TciaImportJob::SpreadsheetReader(*job_));
+  }
+
+  virtual void AddChunk(const void* data,
+                        size_t size) ORTHANC_OVERRIDE
+  {
+    reader_->AddChunk(data, size);
+  }
+
+  virtual void Execute(OrthancPluginRestOutput* output) ORTHANC_OVERRIDE
+  {
+    reader_->Finish();
+    reader_.reset();
+
+    OrthancPlugins::OrthancJob::SubmitFromRestApiPost(output, options_, job_.release());
+  }
+};
+
+
+static bool ParseBooleanArgument(const std::string& key,
+                                 const std::string& value)
+{
+  if (value == "true" ||
+      value == "1")
+  {
+    return true;
+  }
+  else if (value == "false" ||
+           value == "0")
+  {
+    return false;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Argument \"" + key + "\" must be Boolean");
+  }
+}
+
+
+// The options of the uploaded jobs are given as GET arguments, as the body is not JSON
+static void ParseJobOptions(Json::Value& options,
+                            const OrthancPluginHttpRequest* request)
+{
+  options = Json::objectValue;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    const std::string key(request->getKeys[i]);
+    const std::string value(request->getValues[i]);
+
+    if (key == "Synchronous" ||
+        key == "Asynchronous")
+    {
+      options[key] = ParseBooleanArgument(key, value);
+    }
+    else if (key == "Priority")
+    {
+      int32_t priority;
+      if (OrthancPlugins::IntegerParser::ParseInteger32(priority, value))
+      {
+        options[key] = priority;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Argument \"" + key + "\" must be an integer: " + value);
+      }
+    }
+  }
+}
+
+
+// The NBIA spreadsheet is uploaded as the raw body of the request, and is parsed chunk by chunk as it arrives
+static OrthancPlugins::IChunkedRequestReader* CreateSpreadsheetUpload(const char* url,
+                                                                      const OrthancPluginHttpRequest* request)
+{
+  Json::Value options;
+  ParseJobOptions(options, request);
+  return new SpreadsheetUpload(options);
+}
+
+
+class ManifestUpload : public OrthancPlugins::IChunkedRequestReader
+{
+private:
+  OrthancPlugins::TciaManifest  manifest_;
+  Json::Value                   options_;
+
+public:
+  explicit ManifestUpload(const Json::Value& options) :
+    options_(options)
+  {
+  }
+
+  virtual void AddChunk(const void* data,
+                        size_t size) ORTHANC_OVERRIDE
+  {
+    manifest_.AddChunk(data, size);
+  }
+
+  virtual void Execute(OrthancPluginRestOutput* output) ORTHANC_OVERRIDE
+  {
+    manifest_.Finish();
+
+    std::unique_ptr<OrthancPlugins::TciaImportJob> job(new OrthancPlugins::TciaImportJob);
+    job->AddTciaManifest(manifest_);
+
+    OrthancPlugins::OrthancJob::SubmitFromRestApiPost(output, options_, job.release());
+  }
+};
+
+
+static OrthancPlugins::IChunkedRequestReader* CreateManifestUpload(const char* url,
+                                                                   const OrthancPluginHttpRequest* request)
+{
+  Json::Value options;
+  ParseJobOptions(options, request);
+  return new ManifestUpload(options);
+}
+
+
+static std::string GetEmbeddedResourceETag(Orthanc::EmbeddedResources::FileResourceId resource)
+{
+  std::string etag;
+  OrthancPlugins::HttpHelpers::ComputeETag(etag, Orthanc::EmbeddedResources::GetFileResourceBuffer(resource),
+                                           Orthanc::EmbeddedResources::GetFileResourceSize(resource));
+  return etag;
+}
+
+
+static void AnswerEmbeddedResource(OrthancPluginRestOutput* output,
+                                   const OrthancPluginHttpRequest* request,
+                                   Orthanc::EmbeddedResources::FileResourceId resource,
+                                   const std::string& mime,
+                                   const std::string& etag)
+{
+  OrthancPlugins::HttpHelpers::AnswerBuffer(output, request,
+                                            Orthanc::EmbeddedResources::GetFileResourceBuffer(resource),
+                                            Orthanc::EmbeddedResources::GetFileResourceSize(resource),
+                                            mime, etag);
+}
+
+
+void GetImportStatus(OrthancPluginRestOutput* output,
+                     const char* url,
+                     const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "POST");
+  }
+  else
+  {
+    static const char* const JOB = "Job";
+    static const char* const SERIES = "Series";
+
+    Json::Value body;
+    if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+        body.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (body.isMember(JOB))
+    {
+      OrthancPlugins::ImportStatus::ComputeForJob(answer["Patients"],
+                                                  Orthanc::SerializationToolbox::ReadString(body, JOB));
+    }
+    else if (body.isMember(SERIES))
+    {
+      std::vector<std::string> series;
+      Orthanc::SerializationToolbox::ReadArrayOfStrings(series, body, SERIES);
+      OrthancPlugins::ImportStatus::ComputeForSeries(answer[SERIES], series);
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Either \"Job\" or \"Series\" must be provided");
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
+void ListJobSeries(OrthancPluginRestOutput* output,
+                   const char* url,
+                   const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "GET");
+  }
+  else
+  {
+    OrthancPlugins::ImportStatus::Filter filter = OrthancPlugins::ImportStatus::Filter_All;
+    size_t offset = 0;
+    size_t limit = 100;
+
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      const std::string key(request->getKeys[i]);
+      const std::string value(request->getValues[i]);
+
+      if (key == "status")
+      {
+        if (value == "stored")
+        {
+          filter = OrthancPlugins::ImportStatus::Filter_Stored;
+        }
+        else if (value == "missing")
+        {
+          filter = OrthancPlugins::ImportStatus::Filter_Missing;
+        }
+        else if (value != "all")
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "The status must be \"all\", \"stored\" or \"missing\": " + value);
+        }
+      }
+      else if (key == "offset")
+      {
+        offset = ParseSizeArgument(key, value);
+      }
+      else if (key == "limit")
+      {
+        limit = ParseSizeArgument(key, value);
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unsupported argument to list the series of a job: " + key);
+      }
+    }
+
+    Json::Value answer;
+    OrthancPlugins::ImportStatus::ListJobSeries(answer, request->groups[0], filter, offset, limit);
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
+
+
 void ServeHtml(OrthancPluginRestOutput* output,
                const char* url,
                const OrthancPluginHttpRequest* request)
@@ -199,16 +880,15 @@ void ServeHtml(OrthancPluginRestOutput* output,
   }
   else
   {
-    std::string s;
-
 #if ORTHANC_STANDALONE == 1
-    Orthanc::EmbeddedResources::GetFileResource(s, Orthanc::EmbeddedResources::TCIA_HTML);
+    static const std::string etag = GetEmbeddedResourceETag(Orthanc::EmbeddedResources::TCIA_HTML);
+    AnswerEmbeddedResource(output, request, Orthanc::EmbeddedResources::TCIA_HTML, "text/html", etag);
 #else
+    std::string s, etag;
     Orthanc::SystemToolbox::ReadFile(s, std::string(TCIA_SOURCE_DIR) + "/WebApplication/index.html");
+    OrthancPlugins::HttpHelpers::ComputeETag(etag, s.c_str(), s.size());
+    OrthancPlugins::HttpHelpers::AnswerBuffer(output, request, s, "text/html", etag);
 #endif
-    
-    OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output,
-                              s.c_str(), s.size(), "text/html");
   }
 }
 
@@ -223,16 +903,15 @@ void ServeJavaScript(OrthancPluginRestOutput* output,
   }
   else
   {
-    std::string s;
-
 #if ORTHANC_STANDALONE == 1
-    Orthanc::EmbeddedResources::GetFileResource(s, Orthanc::EmbeddedResources::TCIA_JS);
+    static const std::string etag = GetEmbeddedResourceETag(Orthanc::EmbeddedResources::TCIA_JS);
+    AnswerEmbeddedResource(output, request, Orthanc::EmbeddedResources::TCIA_JS, "application/javascript", etag);
 #else
+    std::string s, etag;
     Orthanc::SystemToolbox::ReadFile(s, std::string(TCIA_SOURCE_DIR) + "/WebApplication/app.js");
+    OrthancPlugins::HttpHelpers::ComputeETag(etag, s.c_str(), s.size());
+    OrthancPlugins::HttpHelpers::AnswerBuffer(output, request, s, "application/javascript", etag);
 #endif
-
-    OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output,
-                              s.c_str(), s.size(), "application/javascript");
   }
 }
 
@@ -248,12 +927,58 @@ void ClearCache(OrthancPluginRestOutput* output,
   else
   {
     OrthancPlugins::HttpCache::GetInstance().Clear();
+    OrthancPlugins::NegativeCache::GetInstance().Clear();
     LOG(WARNING) << "The TCIA cache has been cleared";
     OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, "", 0, "text/plain");
   }
 }
 
 
+void GetStatus(OrthancPluginRestOutput* output,
+               const char* url,
+               const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(OrthancPlugins::GetGlobalContext(), output, "GET");
+  }
+  else
+  {
+    Json::Value status = Json::objectValue;
+    OrthancPlugins::HttpClientPool::GetInstance().GetStatistics(status["HttpClientPool"]);
+    OrthancPlugins::AdmissionControl::GetInstance().GetStatistics(status["AdmissionControl"]);
+    OrthancPlugins::RateLimiter::GetInstance().GetStatistics(status["RateLimiter"]);
+    OrthancPlugins::CircuitBreaker::GetInstance().GetStatistics(status["CircuitBreaker"]);
+    OrthancPlugins::NegativeCache::GetInstance().GetStatistics(status["NegativeCache"]);
+    OrthancPlugins::SeriesIndex::GetInstance().GetStatistics(status["SeriesIndex"]);
+    OrthancPlugins::MetadataMirror::GetInstance().GetStatistics(status["Mirror"]);
+    OrthancPlugins::SearchIndex::GetInstance().GetStatistics(status["SearchIndex"]);
+    OrthancPlugins::AnswerJson(status, output);
+  }
+}
+
+
+static OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
+                                               OrthancPluginResourceType resourceType,
+                                               const char* resourceId)
+{
+  try
+  {
+    OrthancPlugins::SeriesIndex::GetInstance().HandleChange(changeType, resourceType, resourceId);
+    return OrthancPluginErrorCode_Success;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Error while updating the index of the series: " << e.What();
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+  }
+  catch (...)
+  {
+    return OrthancPluginErrorCode_InternalError;
+  }
+}
+
+
 template <enum Orthanc::EmbeddedResources::FileResourceId resource,
           enum Orthanc::MimeType mime>
 void ServeEmbeddedResource(OrthancPluginRestOutput* output,
@@ -266,10 +991,9 @@ void ServeEmbeddedResource(OrthancPluginRestOutput* output,
   }
   else
   {
-    OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output,
-                              reinterpret_cast<const char*>(Orthanc::EmbeddedResources::GetFileResourceBuffer(resource)),
-                              Orthanc::EmbeddedResources::GetFileResourceSize(resource),
-                              Orthanc::EnumerationToString(mime));
+    // Computed only once per resource (thread-safe initialization of static variables)
+    static const std::string etag = GetEmbeddedResourceETag(resource);
+    AnswerEmbeddedResource(output, request, resource, Orthanc::EnumerationToString(mime), etag);
   }
 }
 
@@ -333,7 +1057,66 @@ extern "C"
           OrthancPlugins::TciaImportJob::SetTciaBaseUrl(s);
         }
       }
+
+      // Answers from TCIA that are larger than this limit (in MB) are
+      // forwarded to the client, but are not kept in the cache
+      OrthancPlugins::HttpCache::GetInstance().SetMaximumItemSize(
+        static_cast<size_t>(tcia.GetUnsignedIntegerValue("CacheMaxItemSize", 16)) * 1024 * 1024);
+
+      OrthancPlugins::HttpClientPool::GlobalInitialize();
+      OrthancPlugins::HttpClientPool::GetInstance().Configure(configuration);
+      OrthancPlugins::HttpClientPool::GetInstance().SetMaximumSize(tcia.GetUnsignedIntegerValue("HttpClientPoolSize", 4));
+
+      // The proxy waits for a client of the pool at most as long as in the queue of the admission control
+      OrthancPlugins::HttpClientPool::GetInstance().SetInteractiveTimeout(
+        tcia.GetUnsignedIntegerValue("UpstreamQueueTimeout", 5000));
+
+      // Bounds the number of HTTP threads of Orthanc that can wait for
+      // TCIA ("0" for no limit), the other requests being answered
+      // with "503 Service Unavailable"
+      OrthancPlugins::AdmissionControl::GetInstance().Configure(
+        tcia.GetUnsignedIntegerValue("MaxConcurrentUpstreamCalls", 4),
+        tcia.GetUnsignedIntegerValue("MaxUpstreamQueueLength", 16),
+        tcia.GetUnsignedIntegerValue("UpstreamQueueTimeout", 5000));
+
+      // Rate limit of all the traffic to TCIA, shared by the proxy and
+      // the jobs ("0" for no limit), the bandwidth being in KB/s
+      OrthancPlugins::RateLimiter::GetInstance().Configure(
+        tcia.GetUnsignedIntegerValue("MaxRequestsPerSecond", 10),
+        static_cast<double>(tcia.GetUnsignedIntegerValue("MaxBandwidth", 0)) * 1024.0);
+
+      // Failures of TCIA are remembered for a few seconds ("0" to disable)
+      OrthancPlugins::NegativeCache::GetInstance().SetTimeToLive(tcia.GetUnsignedIntegerValue("NegativeCacheTtl", 10));
+
+      // The proxy fails fast once the percentage of failed calls to
+      // TCIA crosses this threshold ("0" to disable), then probes TCIA
+      // again after the given duration (in seconds)
+      OrthancPlugins::CircuitBreaker::GetInstance().Configure(
+        tcia.GetUnsignedIntegerValue("CircuitBreakerThreshold", 50),
+        tcia.GetUnsignedIntegerValue("CircuitBreakerWindow", 20),
+        tcia.GetUnsignedIntegerValue("CircuitBreakerOpenDuration", 30));
       
+      {
+        // Persistence of the local mirror of the metadata of TCIA
+        std::string path;
+        if (tcia.LookupStringValue(path, "MirrorPath"))
+        {
+          OrthancPlugins::MetadataMirror::GetInstance().SetPath(path);
+
+          try
+          {
+            OrthancPlugins::MetadataMirror::GetInstance().Load();
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            LOG(ERROR) << "Cannot load the TCIA mirror, starting with an empty mirror: " << e.What();
+          }
+        }
+
+        // Interval (in seconds) between two incremental syncs of the mirror, "0" to disable
+        OrthancPlugins::TciaSyncJob::StartScheduler(tcia.GetUnsignedIntegerValue("MirrorSyncInterval", 86400));
+      }
+
       OrthancPlugins::SetRootUri(ORTHANC_PLUGIN_NAME, "/tcia/app/index.html");
 
       {
@@ -344,12 +1127,33 @@ extern "C"
       }
   
       OrthancPluginRegisterJobsUnserializer(context, TciaJobUnserializer);
+      OrthancPlugins::SeriesIndex::GetInstance().Start();
+      OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
 
       OrthancPlugins::RegisterRestCallback<ServeHtml>("/tcia/app/index.html", true /* thread safe */);
       OrthancPlugins::RegisterRestCallback<ServeJavaScript>("/tcia/app/app.js", true /* thread safe */);
       OrthancPlugins::RegisterRestCallback<ClearCache>("/tcia/clear-cache", true /* thread safe */);
-      OrthancPlugins::RegisterRestCallback<TciaHttpProxy>("/tcia/proxy/(.*)", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback< ShedOverload<TciaHttpProxy> >("/tcia/proxy/(.*)", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback< ShedOverload<TciaBrowse> >("/tcia/browse/(.*)", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback< ShedOverload<GetPatientView> >("/tcia/patient", true /* thread safe */);
       OrthancPlugins::RegisterRestCallback<TciaImport>("/tcia/import", true /* thread safe */);
+      OrthancPlugins::ChunkedRestRegistration<
+        OrthancPlugins::Internals::NullRestCallback, CreateSpreadsheetUpload>::Apply("/tcia/import/spreadsheet");
+      OrthancPlugins::ChunkedRestRegistration<
+        OrthancPlugins::Internals::NullRestCallback, CreateManifestUpload>::Apply("/tcia/import/manifest");
+
+#if HAS_ORTHANC_PLUGIN_CHUNKED_HTTP_SERVER == 0
+      LOG(WARNING) << "The Orthanc SDK has no support for chunked uploads, the files "
+                   << "uploaded to /tcia/import/{spreadsheet,manifest} will be buffered in memory";
+#endif
+
+      OrthancPlugins::RegisterRestCallback<GetImportStatus>("/tcia/import-status", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback<ListJobSeries>("/tcia/jobs/([^/]+)/series", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback<GetStatus>("/tcia/status", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback<RefreshMirror>("/tcia/mirror/refresh", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback<SyncMirror>("/tcia/mirror/sync", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback<Search>("/tcia/search", true /* thread safe */);
+      OrthancPlugins::RegisterRestCallback<BrowseMirror>("/tcia/mirror/(collections|patients|studies|series)", true /* thread safe */);
 
       {
         using namespace Orthanc;
@@ -392,6 +1196,10 @@ extern "C"
   ORTHANC_PLUGINS_API void OrthancPluginFinalize()
   {
     OrthancPlugins::LogWarning("TCIA plugin is finalizing");
+    OrthancPlugins::SeriesIndex::GetInstance().Stop();
+    OrthancPlugins::TciaSyncJob::StopScheduler();
+    OrthancPlugins::HttpClientPool::GetInstance().Clear();
+    OrthancPlugins::HttpClientPool::GlobalFinalize();
   }
 
 
@@ -0,0 +1,281 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "RateLimiter.h"
+
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+#include <cmath>
+
+
+namespace OrthancPlugins
+{
+  static const char* GetLaneName(RateLimiter::Lane lane)
+  {
+    switch (lane)
+    {
+      case RateLimiter::Lane_Interactive:
+        return "Interactive";
+
+      case RateLimiter::Lane_Bulk:
+        return "Bulk";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void RateLimiter::Refill()
+  {
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    const double elapsed = static_cast<double>((now - lastRefill_).total_microseconds()) / 1000000.0;
+    lastRefill_ = now;
+
+    if (elapsed > 0)
+    {
+      // The buckets can store the tokens of one second, and at least one request
+      requestTokens_ = std::min(requestTokens_ + elapsed * requestsPerSecond_, std::max(1.0, requestsPerSecond_));
+      byteTokens_ = std::min(byteTokens_ + elapsed * bytesPerSecond_, bytesPerSecond_);
+    }
+  }
+
+
+  static int64_t ToMicroseconds(double delay)
+  {
+    if (delay <= 0)
+    {
+      return 0;
+    }
+    else
+    {
+      // Round up, so that the tokens are available after the wait
+      return static_cast<int64_t>(std::ceil(delay * 1000000.0));
+    }
+  }
+
+
+  int64_t RateLimiter::ComputeDelay(Lane lane) const
+  {
+    double delay = 0;  // In seconds
+
+    if (requestsPerSecond_ > 0 &&
+        requestTokens_ < 1.0)
+    {
+      delay = (1.0 - requestTokens_) / requestsPerSecond_;
+    }
+
+    // The interactive lane is never delayed by the bandwidth
+    if (lane == Lane_Bulk &&
+        bytesPerSecond_ > 0 &&
+        byteTokens_ < 0)
+    {
+      delay = std::max(delay, -byteTokens_ / bytesPerSecond_);
+    }
+
+    return ToMicroseconds(delay);
+  }
+
+
+  int64_t RateLimiter::ComputeBytesDelay() const
+  {
+    if (bytesPerSecond_ > 0 &&
+        byteTokens_ < 0)
+    {
+      return ToMicroseconds(-byteTokens_ / bytesPerSecond_);
+    }
+    else
+    {
+      return 0;
+    }
+  }
+
+
+  RateLimiter::RateLimiter() :
+    requestsPerSecond_(0),
+    bytesPerSecond_(0),
+    requestTokens_(1),
+    byteTokens_(0),
+    lastRefill_(boost::posix_time::microsec_clock::universal_time())
+  {
+  }
+
+
+  void RateLimiter::Configure(double requestsPerSecond,
+                              double bytesPerSecond)
+  {
+    if (requestsPerSecond < 0 ||
+        bytesPerSecond < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      Refill();
+
+      requestsPerSecond_ = requestsPerSecond;
+      bytesPerSecond_ = bytesPerSecond;
+
+      // Start with full buckets
+      requestTokens_ = std::max(1.0, requestsPerSecond_);
+      byteTokens_ = bytesPerSecond_;
+    }
+
+    changed_.notify_all();
+  }
+
+
+  void RateLimiter::AcquireRequest(Lane lane)
+  {
+    assert(lane == Lane_Interactive ||
+           lane == Lane_Bulk);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      LaneStatistics& statistics = lanes_[lane];
+      statistics.countRequests_++;
+      statistics.waiting_++;
+
+      bool hasWaited = false;
+
+      for (;;)
+      {
+        Refill();
+
+        if (lane == Lane_Bulk &&
+            lanes_[Lane_Interactive].waiting_ > 0)
+        {
+          // Give way to the interactive requests, that notify once they leave their lane
+          hasWaited = true;
+          changed_.wait(lock);
+        }
+        else
+        {
+          const int64_t delay = ComputeDelay(lane);
+
+          if (delay == 0)
+          {
+            if (requestsPerSecond_ > 0)
+            {
+              requestTokens_ -= 1.0;
+            }
+
+            break;
+          }
+          else
+          {
+            hasWaited = true;
+            changed_.timed_wait(lock, boost::posix_time::microseconds(delay));
+          }
+        }
+      }
+
+      statistics.waiting_--;
+
+      if (hasWaited)
+      {
+        statistics.countWaits_++;
+      }
+    }
+
+    // Wake up the requests of the bulk lane, that might have been waiting for this one
+    changed_.notify_all();
+  }
+
+
+  void RateLimiter::ConsumeBytes(Lane lane,
+                                 size_t size)
+  {
+    assert(lane == Lane_Interactive ||
+           lane == Lane_Bulk);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    Refill();
+
+    lanes_[lane].countBytes_ += size;
+
+    if (bytesPerSecond_ > 0)
+    {
+      byteTokens_ -= static_cast<double>(size);
+
+      if (lane == Lane_Interactive)
+      {
+        // Bound the debt, so that a large interactive answer cannot lock out the bulk lane for long
+        byteTokens_ = std::max(byteTokens_, -bytesPerSecond_);
+      }
+      else
+      {
+        // Throttle the transfer itself, chunk by chunk, instead of delaying the next requests
+        for (;;)
+        {
+          const int64_t delay = ComputeBytesDelay();
+
+          if (delay == 0)
+          {
+            break;
+          }
+          else
+          {
+            changed_.timed_wait(lock, boost::posix_time::microseconds(delay));
+            Refill();
+          }
+        }
+      }
+    }
+  }
+
+
+  void RateLimiter::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    Refill();
+
+    target = Json::objectValue;
+    target["MaximumRequestsPerSecond"] = requestsPerSecond_;
+    target["MaximumBytesPerSecond"] = bytesPerSecond_;
+    target["AvailableRequests"] = requestTokens_;
+    target["AvailableBytes"] = byteTokens_;
+
+    Json::Value& lanes = target["Lanes"];
+    lanes = Json::objectValue;
+
+    for (unsigned int i = 0; i < 2; i++)
+    {
+      const LaneStatistics& statistics = lanes_[i];
+
+      Json::Value& lane = lanes[GetLaneName(static_cast<Lane>(i))];
+      lane["Waiting"] = statistics.waiting_;
+      lane["CountRequests"] = boost::lexical_cast<std::string>(statistics.countRequests_);
+      lane["CountBytes"] = boost::lexical_cast<std::string>(statistics.countBytes_);
+      lane["CountWaits"] = boost::lexical_cast<std::string>(statistics.countWaits_);
+    }
+  }
+
+
+  RateLimiter& RateLimiter::GetInstance()
+  {
+    static RateLimiter limiter;
+    return limiter;
+  }
+}
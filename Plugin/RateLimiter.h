@@ -0,0 +1,110 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <stdint.h>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Process-wide rate limiter of the traffic to TCIA, implemented as
+   * two token buckets: One for the number of requests per second, and
+   * one for the number of bytes per second. Each bucket can store the
+   * tokens of one second, which allows for short bursts. The requests
+   * are sorted into two lanes: The interactive requests (those of the
+   * proxy) always go before the bulk requests (those of the jobs).
+   *
+   * The size of an answer is only known as it is received, so the
+   * bytes are taken chunk by chunk during the transfer. The transfers
+   * of the bulk lane are throttled as they are received: Each chunk
+   * waits until the bucket of the bytes is not overdrawn anymore,
+   * which slows down the download itself (beware of "HttpTimeout").
+   * The interactive transfers are never throttled by the bandwidth:
+   * Their bytes are taken from the same bucket, which makes the bulk
+   * lane give way to them, but the resulting debt is bounded to the
+   * tokens of one second, and never delays the interactive lane.
+   **/
+  class RateLimiter : public boost::noncopyable
+  {
+  public:
+    enum Lane
+    {
+      Lane_Interactive = 0,
+      Lane_Bulk = 1
+    };
+
+  private:
+    struct LaneStatistics
+    {
+      unsigned int  waiting_;
+      uint64_t      countRequests_;
+      uint64_t      countBytes_;
+      uint64_t      countWaits_;
+
+      LaneStatistics() :
+        waiting_(0),
+        countRequests_(0),
+        countBytes_(0),
+        countWaits_(0)
+      {
+      }
+    };
+
+    boost::mutex                mutex_;
+    boost::condition_variable   changed_;
+    double                      requestsPerSecond_;  // "0" means no limit
+    double                      bytesPerSecond_;     // "0" means no limit
+    double                      requestTokens_;
+    double                      byteTokens_;
+    boost::posix_time::ptime    lastRefill_;
+    LaneStatistics              lanes_[2];
+
+    void Refill();
+
+    // Returns the delay (in microseconds) before the next request is allowed, "0" if it can go now
+    int64_t ComputeDelay(Lane lane) const;
+
+    // Returns the delay (in microseconds) before the bucket of the bytes is not overdrawn anymore
+    int64_t ComputeBytesDelay() const;
+
+  public:
+    RateLimiter();
+
+    void Configure(double requestsPerSecond,
+                   double bytesPerSecond);
+
+    // Blocks until one request to TCIA is allowed for the given lane
+    void AcquireRequest(Lane lane);
+
+    // Takes the received bytes from the bucket, blocks the bulk lane while the bucket is overdrawn
+    void ConsumeBytes(Lane lane,
+                      size_t size);
+
+    void GetStatistics(Json::Value& target);
+
+    static RateLimiter& GetInstance();
+  };
+}
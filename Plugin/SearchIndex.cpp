@@ -0,0 +1,692 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "SearchIndex.h"
+
+#include "MetadataMirror.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/unordered_map.hpp>
+#include <algorithm>
+#include <cctype>
+
+
+// Relevance of a token, depending on the field it comes from
+static const uint8_t WEIGHT_IDENTIFIER = 8;  // Identifier of the document itself
+static const uint8_t WEIGHT_TEXT = 4;        // Description, modality, or word inside an identifier
+static const uint8_t WEIGHT_PARENT = 1;      // Collection or patient that contains the document
+
+static const size_t MAX_TERMS = 8;
+
+
+namespace OrthancPlugins
+{
+  namespace
+  {
+    enum Level
+    {
+      Level_Collection = 0,
+      Level_Patient = 1,
+      Level_Series = 2
+    };
+
+
+    struct Document
+    {
+      uint8_t   level_;
+      uint32_t  collection_;
+      uint32_t  patientId_;
+      uint32_t  studyInstanceUid_;
+      uint32_t  seriesInstanceUid_;
+      uint32_t  seriesDescription_;
+      uint32_t  modality_;
+    };
+
+
+    struct Posting
+    {
+      uint32_t  document_;
+      uint8_t   weight_;
+
+      Posting(uint32_t document,
+              uint8_t weight) :
+        document_(document),
+        weight_(weight)
+      {
+      }
+
+      bool operator< (const Posting& other) const
+      {
+        return document_ < other.document_;
+      }
+    };
+
+
+    // Document with its score, for one search
+    struct Match
+    {
+      uint32_t  document_;
+      unsigned int  score_;
+
+      Match(uint32_t document,
+            unsigned int score) :
+        document_(document),
+        score_(score)
+      {
+      }
+
+      bool operator< (const Match& other) const
+      {
+        return document_ < other.document_;
+      }
+    };
+
+
+    class PrefixPredicate
+    {
+    private:
+      const std::string&  prefix_;
+
+    public:
+      explicit PrefixPredicate(const std::string& prefix) :
+        prefix_(prefix)
+      {
+      }
+
+      bool operator() (const std::string& token) const
+      {
+        return token.compare(0, prefix_.size(), prefix_) == 0;
+      }
+    };
+  }
+
+
+  class SearchIndex::Index : public boost::noncopyable
+  {
+  private:
+    typedef std::vector<std::string>::const_iterator  TokenIterator;
+
+    std::vector<std::string>  strings_;
+    std::vector<Document>     documents_;
+
+    // Sorted dictionary of the tokens, each token having a list of postings
+    std::vector<std::string>  tokens_;
+    std::vector<uint32_t>     postingsStart_;
+    std::vector<Posting>      postings_;
+
+
+    class Builder : public MetadataMirror::IVisitor
+    {
+    private:
+      typedef boost::unordered_map<std::string, uint32_t>               Strings;
+      typedef std::map<std::pair<uint32_t, uint32_t>, uint32_t>         Patients;
+      typedef boost::unordered_map<std::string, std::vector<Posting> >  Postings;
+
+      Index&    index_;
+      Strings   strings_;
+      Strings   collections_;
+      Patients  patients_;
+      Postings  postings_;
+
+      uint32_t Intern(const std::string& value)
+      {
+        Strings::const_iterator found = strings_.find(value);
+        if (found != strings_.end())
+        {
+          return found->second;
+        }
+        else
+        {
+          const uint32_t id = static_cast<uint32_t>(index_.strings_.size());
+          index_.strings_.push_back(value);
+          strings_[value] = id;
+          return id;
+        }
+      }
+
+      uint32_t AddDocument(Level level,
+                           uint32_t collection,
+                           uint32_t patientId,
+                           uint32_t studyInstanceUid,
+                           uint32_t seriesInstanceUid,
+                           uint32_t seriesDescription,
+                           uint32_t modality)
+      {
+        Document document;
+        document.level_ = static_cast<uint8_t>(level);
+        document.collection_ = collection;
+        document.patientId_ = patientId;
+        document.studyInstanceUid_ = studyInstanceUid;
+        document.seriesInstanceUid_ = seriesInstanceUid;
+        document.seriesDescription_ = seriesDescription;
+        document.modality_ = modality;
+
+        const uint32_t id = static_cast<uint32_t>(index_.documents_.size());
+        index_.documents_.push_back(document);
+        return id;
+      }
+
+      void AddToken(uint32_t document,
+                    const std::string& token,
+                    uint8_t weight)
+      {
+        if (!token.empty())
+        {
+          postings_[token].push_back(Posting(document, weight));
+        }
+      }
+
+      // Indexes the full value, then each of its alphanumeric words
+      void AddValue(uint32_t document,
+                    const std::string& value,
+                    uint8_t weight,
+                    bool splitWords)
+      {
+        std::string lower = value;
+        Orthanc::Toolbox::ToLowerCase(lower);
+
+        AddToken(document, lower, weight);
+
+        if (splitWords)
+        {
+          const uint8_t wordWeight = std::min(weight, WEIGHT_TEXT);
+
+          size_t start = 0;
+          while (start < lower.size())
+          {
+            while (start < lower.size() &&
+                   !isalnum(static_cast<unsigned char>(lower[start])))
+            {
+              start++;
+            }
+
+            size_t end = start;
+            while (end < lower.size() &&
+                   isalnum(static_cast<unsigned char>(lower[end])))
+            {
+              end++;
+            }
+
+            if (end > start &&
+                end - start < lower.size())
+            {
+              AddToken(document, lower.substr(start, end - start), wordWeight);
+            }
+
+            start = end;
+          }
+        }
+      }
+
+    public:
+      explicit Builder(Index& index) :
+        index_(index)
+      {
+        Intern("");
+      }
+
+      virtual void Visit(const MetadataMirror::Series& series) ORTHANC_OVERRIDE
+      {
+        const uint32_t collection = Intern(series.GetCollection());
+        const uint32_t patientId = Intern(series.GetPatientId());
+
+        if (collections_.find(series.GetCollection()) == collections_.end())
+        {
+          const uint32_t document = AddDocument(Level_Collection, collection, 0, 0, 0, 0, 0);
+          collections_[series.GetCollection()] = document;
+          AddValue(document, series.GetCollection(), WEIGHT_IDENTIFIER, true);
+        }
+
+        const std::pair<uint32_t, uint32_t> patientKey(collection, patientId);
+        if (patients_.find(patientKey) == patients_.end())
+        {
+          const uint32_t document = AddDocument(Level_Patient, collection, patientId, 0, 0, 0, 0);
+          patients_[patientKey] = document;
+          AddValue(document, series.GetPatientId(), WEIGHT_IDENTIFIER, true);
+          AddValue(document, series.GetCollection(), WEIGHT_PARENT, true);
+        }
+
+        const uint32_t document = AddDocument(Level_Series, collection, patientId,
+                                              Intern(series.GetStudyInstanceUid()),
+                                              Intern(series.GetSeriesInstanceUid()),
+                                              Intern(series.GetSeriesDescription()),
+                                              Intern(series.GetModality()));
+
+        // The UIDs are not split into words, as their components are meaningless
+        AddValue(document, series.GetSeriesInstanceUid(), WEIGHT_IDENTIFIER, false);
+        AddValue(document, series.GetStudyInstanceUid(), WEIGHT_TEXT, false);
+        AddValue(document, series.GetSeriesDescription(), WEIGHT_TEXT, true);
+        AddValue(document, series.GetModality(), WEIGHT_TEXT, false);
+        AddValue(document, series.GetPatientId(), WEIGHT_PARENT, true);
+        AddValue(document, series.GetCollection(), WEIGHT_PARENT, true);
+      }
+
+      void Finalize()
+      {
+        index_.tokens_.reserve(postings_.size());
+        for (Postings::const_iterator it = postings_.begin(); it != postings_.end(); ++it)
+        {
+          index_.tokens_.push_back(it->first);
+        }
+
+        std::sort(index_.tokens_.begin(), index_.tokens_.end());
+
+        index_.postingsStart_.reserve(index_.tokens_.size() + 1);
+
+        for (size_t i = 0; i < index_.tokens_.size(); i++)
+        {
+          index_.postingsStart_.push_back(static_cast<uint32_t>(index_.postings_.size()));
+
+          std::vector<Posting>& postings = postings_[index_.tokens_[i]];
+          std::sort(postings.begin(), postings.end());
+
+          // The same token can occur several times in one document: Keep its highest weight
+          for (size_t j = 0; j < postings.size(); j++)
+          {
+            if (j > 0 &&
+                postings[j].document_ == index_.postings_.back().document_)
+            {
+              index_.postings_.back().weight_ = std::max(index_.postings_.back().weight_, postings[j].weight_);
+            }
+            else
+            {
+              index_.postings_.push_back(postings[j]);
+            }
+          }
+
+          // Release the memory as soon as possible
+          std::vector<Posting>().swap(postings);
+        }
+
+        index_.postingsStart_.push_back(static_cast<uint32_t>(index_.postings_.size()));
+      }
+    };
+
+
+    void LookupRange(size_t& first,
+                     size_t& last,
+                     const std::string& prefix) const
+    {
+      TokenIterator lower = std::lower_bound(tokens_.begin(), tokens_.end(), prefix);
+      TokenIterator upper = std::partition_point(lower, tokens_.end(), PrefixPredicate(prefix));
+      first = lower - tokens_.begin();
+      last = upper - tokens_.begin();
+    }
+
+    // Returns the documents that have a token starting with the term, sorted by document
+    void CollectMatches(std::vector<Match>& target,
+                        const std::string& term,
+                        size_t firstToken,
+                        size_t lastToken) const
+    {
+      target.clear();
+      target.reserve(postingsStart_[lastToken] - postingsStart_[firstToken]);
+
+      for (size_t token = firstToken; token < lastToken; token++)
+      {
+        // A complete token is more relevant than a prefix
+        const unsigned int factor = (tokens_[token].size() == term.size() ? 2 : 1);
+
+        for (uint32_t i = postingsStart_[token]; i < postingsStart_[token + 1]; i++)
+        {
+          target.push_back(Match(postings_[i].document_, factor * postings_[i].weight_));
+        }
+      }
+
+      std::sort(target.begin(), target.end());
+
+      // Merge the duplicates, that come from different tokens with the same prefix
+      size_t count = 0;
+      for (size_t i = 0; i < target.size(); i++)
+      {
+        if (count > 0 &&
+            target[count - 1].document_ == target[i].document_)
+        {
+          target[count - 1].score_ = std::max(target[count - 1].score_, target[i].score_);
+        }
+        else
+        {
+          target[count] = target[i];
+          count++;
+        }
+      }
+
+      target.erase(target.begin() + count, target.end());
+    }
+
+    /**
+     * Only keeps the matches whose document also has a token starting
+     * with the term. The postings of the term are looked up in the
+     * current matches, which avoids sorting them.
+     **/
+    void FilterMatches(std::vector<Match>& matches,
+                       const std::string& term,
+                       size_t firstToken,
+                       size_t lastToken) const
+    {
+      std::vector<unsigned int> scores(matches.size(), 0);
+
+      for (size_t token = firstToken; token < lastToken; token++)
+      {
+        const unsigned int factor = (tokens_[token].size() == term.size() ? 2 : 1);
+
+        for (uint32_t i = postingsStart_[token]; i < postingsStart_[token + 1]; i++)
+        {
+          std::vector<Match>::const_iterator found = std::lower_bound(
+            matches.begin(), matches.end(), Match(postings_[i].document_, 0));
+
+          if (found != matches.end() &&
+              found->document_ == postings_[i].document_)
+          {
+            unsigned int& score = scores[found - matches.begin()];
+            score = std::max(score, factor * postings_[i].weight_);
+          }
+        }
+      }
+
+      size_t count = 0;
+      for (size_t i = 0; i < matches.size(); i++)
+      {
+        if (scores[i] > 0)  // All the weights are non-zero
+        {
+          matches[count] = Match(matches[i].document_, matches[i].score_ + scores[i]);
+          count++;
+        }
+      }
+
+      matches.erase(matches.begin() + count, matches.end());
+    }
+
+    class RankingOrdering
+    {
+    private:
+      const std::vector<Document>&  documents_;
+
+    public:
+      explicit RankingOrdering(const std::vector<Document>& documents) :
+        documents_(documents)
+      {
+      }
+
+      bool operator() (const Match& a,
+                       const Match& b) const
+      {
+        if (a.score_ != b.score_)
+        {
+          return a.score_ > b.score_;
+        }
+        else if (documents_[a.document_].level_ != documents_[b.document_].level_)
+        {
+          return documents_[a.document_].level_ < documents_[b.document_].level_;
+        }
+        else
+        {
+          return a.document_ < b.document_;
+        }
+      }
+    };
+
+    void Format(Json::Value& target,
+                const Match& match) const
+    {
+      const Document& document = documents_[match.document_];
+
+      target = Json::objectValue;
+      target["Collection"] = strings_[document.collection_];
+      target["Score"] = match.score_;
+
+      switch (document.level_)
+      {
+        case Level_Collection:
+          target["Level"] = "Collection";
+          break;
+
+        case Level_Patient:
+          target["Level"] = "Patient";
+          target["PatientID"] = strings_[document.patientId_];
+          break;
+
+        case Level_Series:
+          target["Level"] = "Series";
+          target["PatientID"] = strings_[document.patientId_];
+          target["StudyInstanceUID"] = strings_[document.studyInstanceUid_];
+          target["SeriesInstanceUID"] = strings_[document.seriesInstanceUid_];
+          target["SeriesDescription"] = strings_[document.seriesDescription_];
+          target["Modality"] = strings_[document.modality_];
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+
+  public:
+    explicit Index(uint64_t& revision)
+    {
+      Builder builder(*this);
+      revision = MetadataMirror::GetInstance().Apply(builder);
+      builder.Finalize();
+    }
+
+    void Search(Json::Value& target,
+                const std::vector<std::string>& terms,
+                size_t limit) const
+    {
+      target = Json::objectValue;
+      target["Items"] = Json::arrayValue;
+
+      // Process the most selective term first
+      std::vector<std::pair<uint32_t, size_t> > order;
+      std::vector<std::pair<size_t, size_t> > ranges(terms.size());
+
+      for (size_t i = 0; i < terms.size(); i++)
+      {
+        LookupRange(ranges[i].first, ranges[i].second, terms[i]);
+        order.push_back(std::make_pair(postingsStart_[ranges[i].second] - postingsStart_[ranges[i].first], i));
+      }
+
+      std::sort(order.begin(), order.end());
+
+      std::vector<Match> matches;
+
+      for (size_t i = 0; i < order.size(); i++)
+      {
+        const size_t term = order[i].second;
+
+        if (i == 0)
+        {
+          CollectMatches(matches, terms[term], ranges[term].first, ranges[term].second);
+        }
+        else
+        {
+          FilterMatches(matches, terms[term], ranges[term].first, ranges[term].second);
+        }
+
+        if (matches.empty())
+        {
+          break;
+        }
+      }
+
+      target["Total"] = static_cast<unsigned int>(matches.size());
+
+      const size_t count = std::min(limit, matches.size());
+      std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), RankingOrdering(documents_));
+
+      for (size_t i = 0; i < count; i++)
+      {
+        Json::Value item;
+        Format(item, matches[i]);
+        target["Items"].append(item);
+      }
+    }
+
+    size_t GetDocumentsCount() const
+    {
+      return documents_.size();
+    }
+
+    size_t GetTokensCount() const
+    {
+      return tokens_.size();
+    }
+
+    size_t GetPostingsCount() const
+    {
+      return postings_.size();
+    }
+  };
+
+
+  boost::shared_ptr<const SearchIndex::Index> SearchIndex::GetIndex()
+  {
+    {
+      // The index might be older than the mirror: It is rebuilt by the jobs that update the mirror
+      boost::mutex::scoped_lock lock(mutex_);
+      if (index_.get() != NULL)
+      {
+        return index_;
+      }
+    }
+
+    // No index has been built since the mirror was loaded
+    Update();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    return index_;
+  }
+
+
+  void SearchIndex::Update()
+  {
+    /**
+     * The index is built without holding "mutex_", then swapped: The
+     * searches are answered by the previous index in the meantime.
+     * Only one thread builds the index at once.
+     **/
+    boost::mutex::scoped_lock building(buildMutex_);
+
+    const uint64_t revision = MetadataMirror::GetInstance().GetRevision();
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      if (index_.get() != NULL &&
+          revision_ == revision)
+      {
+        return;  // Already up-to-date
+      }
+    }
+
+    LOG(INFO) << "Building the search index over the TCIA mirror";
+
+    uint64_t builtRevision;
+    boost::shared_ptr<const Index> index(new Index(builtRevision));
+
+    LOG(INFO) << "The search index over the TCIA mirror contains " << index->GetTokensCount() << " tokens";
+
+    boost::mutex::scoped_lock lock(mutex_);
+    index_ = index;
+    revision_ = builtRevision;
+  }
+
+
+  SearchIndex::SearchIndex() :
+    revision_(0)
+  {
+  }
+
+
+  void SearchIndex::Search(Json::Value& target,
+                           const std::string& query,
+                           size_t limit)
+  {
+    std::string lower = query;
+    Orthanc::Toolbox::ToLowerCase(lower);
+
+    std::vector<std::string> terms;
+
+    size_t start = 0;
+    while (start < lower.size())
+    {
+      while (start < lower.size() &&
+             isspace(static_cast<unsigned char>(lower[start])))
+      {
+        start++;
+      }
+
+      size_t end = start;
+      while (end < lower.size() &&
+             !isspace(static_cast<unsigned char>(lower[end])))
+      {
+        end++;
+      }
+
+      if (end > start)
+      {
+        terms.push_back(lower.substr(start, end - start));
+      }
+
+      start = end;
+    }
+
+    if (terms.size() > MAX_TERMS)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Too many terms in the search query");
+    }
+
+    if (terms.empty())
+    {
+      target = Json::objectValue;
+      target["Total"] = 0;
+      target["Items"] = Json::arrayValue;
+    }
+    else
+    {
+      GetIndex()->Search(target, terms, limit);
+    }
+  }
+
+
+  void SearchIndex::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["Built"] = (index_.get() != NULL);
+    target["UpToDate"] = (index_.get() != NULL &&
+                          revision_ == MetadataMirror::GetInstance().GetRevision());
+
+    if (index_.get() != NULL)
+    {
+      target["DocumentsCount"] = static_cast<unsigned int>(index_->GetDocumentsCount());
+      target["TokensCount"] = static_cast<unsigned int>(index_->GetTokensCount());
+      target["PostingsCount"] = static_cast<unsigned int>(index_->GetPostingsCount());
+    }
+  }
+
+
+  SearchIndex& SearchIndex::GetInstance()
+  {
+    static SearchIndex index;
+    return index;
+  }
+}
@@ -0,0 +1,75 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Search index over the local mirror of TCIA: collection names,
+   * PatientIDs, series descriptions, modalities and UIDs. The tokens
+   * are kept in a sorted dictionary, so that all the tokens starting
+   * with a given prefix form a contiguous range that is found by
+   * binary search. The index is rebuilt by the jobs that update the
+   * mirror, once they are done, without locking the mirror nor the
+   * searches that are answered by the previous index until the swap.
+   * Only the first search after the mirror is loaded builds the
+   * index by itself.
+   **/
+  class SearchIndex : public boost::noncopyable
+  {
+  private:
+    class Index;
+
+    boost::mutex                     mutex_;       // Protects "index_" and "revision_"
+    boost::mutex                     buildMutex_;  // Held by the thread that builds the index
+    boost::shared_ptr<const Index>   index_;
+    uint64_t                         revision_;
+
+    boost::shared_ptr<const Index> GetIndex();
+
+  public:
+    SearchIndex();
+
+    /**
+     * Returns the documents (collections, patients or series) that
+     * match all the whitespace-separated terms of the query, each
+     * term being a case-insensitive prefix. The matches are ranked by
+     * decreasing relevance.
+     **/
+    void Search(Json::Value& target,
+                const std::string& query,
+                size_t limit);
+
+    // Rebuilds the index if the mirror has changed since the last build
+    void Update();
+
+    void GetStatistics(Json::Value& target);
+
+    static SearchIndex& GetInstance();
+  };
+}
@@ -0,0 +1,640 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "SeriesIndex.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+
+static const unsigned int SEEDING_PAGE_SIZE = 1000;
+
+// Number of modified series that are remembered for the import jobs
+static const size_t MAX_LOGGED_CHANGES = 100000;
+
+// Delays (in seconds) between two attempts to seed the index, doubled after each failure
+static const unsigned int MIN_SEEDING_RETRY_DELAY = 1;
+static const unsigned int MAX_SEEDING_RETRY_DELAY = 60;
+
+
+namespace OrthancPlugins
+{
+  static bool LookupSeriesInstanceUid(std::string& target,
+                                      const Json::Value& series)
+  {
+    if (series.type() == Json::objectValue &&
+        series.isMember("MainDicomTags") &&
+        series["MainDicomTags"].type() == Json::objectValue &&
+        series["MainDicomTags"].isMember("SeriesInstanceUID") &&
+        series["MainDicomTags"]["SeriesInstanceUID"].type() == Json::stringValue)
+    {
+      target = series["MainDicomTags"]["SeriesInstanceUID"].asString();
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  uint64_t SeriesIndex::ComputeKey(const std::string& orthancId)
+  {
+    // 64-bit FNV-1a hash: Collisions are negligible for the size of an Orthanc database
+    uint64_t hash = 14695981039346656037ull;
+
+    for (size_t i = 0; i < orthancId.size(); i++)
+    {
+      hash ^= static_cast<uint8_t>(orthancId[i]);
+      hash *= 1099511628211ull;
+    }
+
+    return hash;
+  }
+
+
+  void SeriesIndex::LogChange(const std::string& seriesInstanceUid)
+  {
+    // The changes applied by the seeding are not logged, as the consumers check everything after a seeding
+    if (isReady_)
+    {
+      revision_++;
+      log_.push_back(std::make_pair(revision_, seriesInstanceUid));
+
+      if (log_.size() > MAX_LOGGED_CHANGES)
+      {
+        firstLoggedRevision_ = log_.front().first;
+        log_.pop_front();
+      }
+    }
+  }
+
+
+  void SeriesIndex::AddSeries(uint64_t seriesKey,
+                              const std::string& seriesInstanceUid)
+  {
+    if (series_.find(seriesKey) == series_.end())
+    {
+      Series& series = series_[seriesKey];
+      series.seriesInstanceUid_ = seriesInstanceUid;
+      series.instancesCount_ = 0;
+      uids_[seriesInstanceUid] = seriesKey;
+      LogChange(seriesInstanceUid);
+    }
+  }
+
+
+  void SeriesIndex::AddInstance(uint64_t instanceKey,
+                                uint64_t seriesKey)
+  {
+    ParentByInstance::iterator found = instances_.find(instanceKey);
+
+    if (found == instances_.end())
+    {
+      instances_[instanceKey] = seriesKey;
+    }
+    else if (found->second == seriesKey)
+    {
+      return;  // Already counted, e.g. both by the seeding and by a "NewInstance" event
+    }
+    else
+    {
+      // Stale parent, whose deletion was applied before the deletion of the instance
+      RemoveInstance(instanceKey);
+      instances_[instanceKey] = seriesKey;
+    }
+
+    SeriesByKey::iterator series = series_.find(seriesKey);
+    if (series != series_.end())
+    {
+      series->second.instancesCount_++;
+      LogChange(series->second.seriesInstanceUid_);
+    }
+  }
+
+
+  void SeriesIndex::RemoveInstance(uint64_t instanceKey)
+  {
+    ParentByInstance::iterator found = instances_.find(instanceKey);
+
+    if (found != instances_.end())
+    {
+      SeriesByKey::iterator series = series_.find(found->second);
+      if (series != series_.end() &&
+          series->second.instancesCount_ > 0)
+      {
+        series->second.instancesCount_--;
+        LogChange(series->second.seriesInstanceUid_);
+      }
+
+      instances_.erase(found);
+    }
+  }
+
+
+  void SeriesIndex::RemoveSeries(const std::string& orthancId)
+  {
+    // The instances of the series are removed by their own "Deleted" events
+    boost::mutex::scoped_lock lock(mutex_);
+
+    SeriesByKey::iterator found = series_.find(ComputeKey(orthancId));
+
+    if (found != series_.end())
+    {
+      KeyByUid::iterator uid = uids_.find(found->second.seriesInstanceUid_);
+      if (uid != uids_.end() &&
+          uid->second == found->first)
+      {
+        uids_.erase(uid);
+      }
+
+      LogChange(found->second.seriesInstanceUid_);
+      series_.erase(found);
+    }
+  }
+
+
+  void SeriesIndex::HandleNewInstance(const std::string& orthancInstanceId)
+  {
+    Json::Value instance;
+    if (!RestApiGet(instance, "/instances/" + orthancInstanceId, false) ||
+        instance.type() != Json::objectValue ||
+        !instance.isMember("ParentSeries") ||
+        instance["ParentSeries"].type() != Json::stringValue)
+    {
+      return;  // The instance has already been deleted
+    }
+
+    const std::string parent = instance["ParentSeries"].asString();
+    const uint64_t instanceKey = ComputeKey(orthancInstanceId);
+    const uint64_t seriesKey = ComputeKey(parent);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (series_.find(seriesKey) != series_.end())
+      {
+        AddInstance(instanceKey, seriesKey);
+        return;
+      }
+    }
+
+    // First instance of the series
+    Json::Value series;
+    std::string seriesInstanceUid;
+
+    if (RestApiGet(series, "/series/" + parent, false) &&
+        LookupSeriesInstanceUid(seriesInstanceUid, series))
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      AddSeries(seriesKey, seriesInstanceUid);
+      AddInstance(instanceKey, seriesKey);
+    }
+  }
+
+
+  bool SeriesIndex::AddExpandedSeries(const Json::Value& series)
+  {
+    std::string seriesInstanceUid;
+    if (series.isMember("ID") &&
+        series["ID"].type() == Json::stringValue &&
+        LookupSeriesInstanceUid(seriesInstanceUid, series))
+    {
+      const uint64_t seriesKey = ComputeKey(series["ID"].asString());
+      AddSeries(seriesKey, seriesInstanceUid);
+
+      if (series.isMember("Instances") &&
+          series["Instances"].type() == Json::arrayValue)
+      {
+        const Json::Value& instances = series["Instances"];
+        for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+        {
+          if (instances[j].type() == Json::stringValue)
+          {
+            AddInstance(ComputeKey(instances[j].asString()), seriesKey);
+          }
+        }
+      }
+
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  bool SeriesIndex::Seed()
+  {
+    LOG(INFO) << "Seeding the index of the series stored in Orthanc";
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      series_.clear();
+      uids_.clear();
+      instances_.clear();
+      log_.clear();
+      isReady_ = false;
+    }
+
+    unsigned int since = 0;
+    size_t count = 0;
+
+    for (;;)
+    {
+      Json::Value page;
+      if (!RestApiGet(page, "/series?expand&since=" + boost::lexical_cast<std::string>(since) +
+                      "&limit=" + boost::lexical_cast<std::string>(SEEDING_PAGE_SIZE), false) ||
+          page.type() != Json::arrayValue)
+      {
+        LOG(ERROR) << "Cannot seed the index of the series stored in Orthanc";
+        return false;
+      }
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (stop_)
+        {
+          return false;
+        }
+
+        for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+        {
+          if (AddExpandedSeries(page[i]))
+          {
+            count++;
+          }
+        }
+      }
+
+      if (page.size() < SEEDING_PAGE_SIZE)
+      {
+        break;
+      }
+
+      since += page.size();
+    }
+
+    /**
+     * The pages are indexed by their offset, which is shifted by the
+     * series that are deleted during the seeding: The series that
+     * slid back into an already-read page have been skipped. They are
+     * found by listing the identifiers of all the series, which only
+     * takes one call, and are retrieved one by one.
+     **/
+    Json::Value all;
+    if (!RestApiGet(all, "/series", false) ||
+        all.type() != Json::arrayValue)
+    {
+      LOG(ERROR) << "Cannot seed the index of the series stored in Orthanc";
+      return false;
+    }
+
+    size_t skipped = 0;
+
+    for (Json::Value::ArrayIndex i = 0; i < all.size(); i++)
+    {
+      if (all[i].type() == Json::stringValue)
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          if (stop_)
+          {
+            return false;
+          }
+
+          if (series_.find(ComputeKey(all[i].asString())) != series_.end())
+          {
+            continue;
+          }
+        }
+
+        Json::Value series;
+        if (RestApiGet(series, "/series/" + all[i].asString(), false))  // Otherwise, deleted in the meantime
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          if (AddExpandedSeries(series))
+          {
+            count++;
+            skipped++;
+          }
+        }
+      }
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // Force the consumers to check all their series
+      revision_++;
+      firstLoggedRevision_ = revision_;
+      isReady_ = true;
+    }
+
+    LOG(INFO) << "The index of the series stored in Orthanc has been seeded with " << count << " series"
+              << " (including " << skipped << " series skipped by the pages)";
+    return true;
+  }
+
+
+  void SeriesIndex::ApplyChange(const Change& change)
+  {
+    switch (change.changeType_)
+    {
+      case OrthancPluginChangeType_OrthancStarted:
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        needsSeeding_ = true;
+        nextSeeding_ = boost::get_system_time();
+        seedingRetryDelay_ = MIN_SEEDING_RETRY_DELAY;
+        break;
+      }
+
+      case OrthancPluginChangeType_NewInstance:
+        HandleNewInstance(change.resourceId_);
+        break;
+
+      case OrthancPluginChangeType_Deleted:
+        if (change.resourceType_ == OrthancPluginResourceType_Series)
+        {
+          RemoveSeries(change.resourceId_);
+        }
+        else if (change.resourceType_ == OrthancPluginResourceType_Instance)
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          RemoveInstance(ComputeKey(change.resourceId_));
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+
+  void SeriesIndex::Worker()
+  {
+    for (;;)
+    {
+      Change change;
+      bool seed = false;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (;;)
+        {
+          if (stop_)
+          {
+            return;
+          }
+          else if (needsSeeding_ &&
+                   boost::get_system_time() >= nextSeeding_)
+          {
+            seed = true;
+            break;
+          }
+          else if (!queue_.empty())
+          {
+            change = queue_.front();
+            queue_.pop_front();
+            break;
+          }
+          else if (needsSeeding_)
+          {
+            queueChanged_.timed_wait(lock, nextSeeding_);
+          }
+          else
+          {
+            queueChanged_.wait(lock);
+          }
+        }
+      }
+
+      if (seed)
+      {
+        bool success = false;
+
+        try
+        {
+          success = Seed();
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Error while seeding the index of the series: " << e.What();
+        }
+
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (success)
+        {
+          needsSeeding_ = false;
+        }
+        else
+        {
+          // Retry with an exponential backoff, the lookups falling back to the database in the meantime
+          LOG(WARNING) << "Seeding the index of the series again in " << seedingRetryDelay_ << " seconds";
+          nextSeeding_ = boost::get_system_time() + boost::posix_time::seconds(seedingRetryDelay_);
+          seedingRetryDelay_ = std::min(2 * seedingRetryDelay_, MAX_SEEDING_RETRY_DELAY);
+        }
+      }
+      else
+      {
+        try
+        {
+          ApplyChange(change);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Error while updating the index of the series: " << e.What();
+        }
+      }
+    }
+  }
+
+
+  SeriesIndex::SeriesIndex() :
+    revision_(0),
+    firstLoggedRevision_(0),
+    isReady_(false),
+    needsSeeding_(false),
+    seedingRetryDelay_(MIN_SEEDING_RETRY_DELAY),
+    stop_(false)
+  {
+  }
+
+
+  SeriesIndex::~SeriesIndex()
+  {
+    Stop();
+  }
+
+
+  void SeriesIndex::Start()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!stop_ &&
+        !worker_.joinable())
+    {
+      worker_ = boost::thread(&SeriesIndex::Worker, this);
+    }
+  }
+
+
+  void SeriesIndex::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+      isReady_ = false;
+      queueChanged_.notify_all();
+    }
+
+    if (worker_.joinable())
+    {
+      worker_.join();
+    }
+  }
+
+
+  void SeriesIndex::HandleChange(OrthancPluginChangeType changeType,
+                                 OrthancPluginResourceType resourceType,
+                                 const char* resourceId)
+  {
+    if (changeType == OrthancPluginChangeType_OrthancStarted ||
+        changeType == OrthancPluginChangeType_NewInstance ||
+        (changeType == OrthancPluginChangeType_Deleted &&
+         (resourceType == OrthancPluginResourceType_Series ||
+          resourceType == OrthancPluginResourceType_Instance)))
+    {
+      Change change;
+      change.changeType_ = changeType;
+      change.resourceType_ = resourceType;
+      change.resourceId_ = (resourceId == NULL ? "" : resourceId);
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (!stop_)
+      {
+        queue_.push_back(change);
+        queueChanged_.notify_one();
+      }
+    }
+  }
+
+
+  bool SeriesIndex::IsReady()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return isReady_;
+  }
+
+
+  bool SeriesIndex::Lookup(bool& isStored,
+                           unsigned int& instancesCount,
+                           const std::string& seriesInstanceUid)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isReady_)
+    {
+      return false;
+    }
+
+    KeyByUid::const_iterator uid = uids_.find(seriesInstanceUid);
+    if (uid == uids_.end())
+    {
+      isStored = false;
+      instancesCount = 0;
+    }
+    else
+    {
+      SeriesByKey::const_iterator found = series_.find(uid->second);
+      if (found == series_.end())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      isStored = true;
+      instancesCount = found->second.instancesCount_;
+    }
+
+    return true;
+  }
+
+
+  bool SeriesIndex::LookupChanges(std::set<std::string>& target,
+                                  bool& isComplete,
+                                  uint64_t& revision,
+                                  uint64_t since)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target.clear();
+
+    if (!isReady_)
+    {
+      return false;
+    }
+
+    revision = revision_;
+    isComplete = (since >= firstLoggedRevision_ &&
+                  since <= revision_);
+
+    if (isComplete)
+    {
+      // The log is sorted by revision: Scan it backward, up to the first change that was already seen
+      for (ChangesLog::const_reverse_iterator it = log_.rbegin(); it != log_.rend() && it->first > since; ++it)
+      {
+        target.insert(it->second);
+      }
+    }
+
+    return true;
+  }
+
+
+  void SeriesIndex::GetStatistics(Json::Value& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["Ready"] = isReady_;
+    target["SeriesCount"] = static_cast<unsigned int>(series_.size());
+    target["InstancesCount"] = static_cast<unsigned int>(instances_.size());
+    target["PendingChanges"] = static_cast<unsigned int>(queue_.size());
+    target["Revision"] = boost::lexical_cast<std::string>(revision_);
+    target["LoggedChanges"] = static_cast<unsigned int>(log_.size());
+  }
+
+
+  SeriesIndex& SeriesIndex::GetInstance()
+  {
+    static SeriesIndex index;
+    return index;
+  }
+}
@@ -0,0 +1,166 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <deque>
+#include <set>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * In-memory index of the series that are stored in Orthanc, with
+   * the number of their instances. The index is seeded once when
+   * Orthanc starts, then kept up-to-date by the changes that are
+   * signaled by the Orthanc core. If the seeding fails, it is tried
+   * again with an exponential backoff.
+   *
+   * The change callback of the SDK must not call the REST API of
+   * Orthanc, which could deadlock. The changes are therefore only
+   * queued by HandleChange(), and are applied by a worker thread,
+   * in the order of the queue. The changes that occur while the index
+   * is seeded are applied after the seeding.
+   *
+   * The index remembers the parent series of each instance, so that
+   * an instance is never counted twice, and so that the series of a
+   * deleted instance is known. To save memory, the instances and the
+   * series are indexed by a 64-bit hash of their Orthanc identifier.
+   *
+   * Once the index is ready, the SeriesInstanceUIDs of the modified
+   * series are logged with an increasing revision number, so that
+   * the import jobs only have to check the series that changed since
+   * their last look. Only the last changes are kept: If the log has
+   * been truncated or if the index has been seeded again, the
+   * consumers must check all their series.
+   **/
+  class SeriesIndex : public boost::noncopyable
+  {
+  private:
+    struct Series
+    {
+      std::string   seriesInstanceUid_;
+      unsigned int  instancesCount_;
+    };
+
+    struct Change
+    {
+      OrthancPluginChangeType    changeType_;
+      OrthancPluginResourceType  resourceType_;
+      std::string                resourceId_;
+    };
+
+    // Hash of the Orthanc identifier of the series => content of the series
+    typedef boost::unordered_map<uint64_t, Series>  SeriesByKey;
+
+    // SeriesInstanceUID => hash of the Orthanc identifier of the series
+    typedef boost::unordered_map<std::string, uint64_t>  KeyByUid;
+
+    // Hash of the Orthanc identifier of the instance => hash of its parent series
+    typedef boost::unordered_map<uint64_t, uint64_t>  ParentByInstance;
+
+    // Revision of the change => SeriesInstanceUID of the modified series
+    typedef std::deque< std::pair<uint64_t, std::string> >  ChangesLog;
+
+    boost::mutex               mutex_;
+    SeriesByKey                series_;
+    KeyByUid                   uids_;
+    ParentByInstance           instances_;
+    uint64_t                   revision_;
+    uint64_t                   firstLoggedRevision_;  // The log is complete after this revision
+    ChangesLog                 log_;
+    bool                       isReady_;
+    bool                       needsSeeding_;
+    boost::system_time         nextSeeding_;
+    unsigned int               seedingRetryDelay_;  // In seconds
+    std::deque<Change>         queue_;
+    boost::condition_variable  queueChanged_;
+    bool                       stop_;
+    boost::thread              worker_;
+
+    static uint64_t ComputeKey(const std::string& orthancId);
+
+    // The mutex must be locked by the caller of the 4 following methods
+    void LogChange(const std::string& seriesInstanceUid);
+
+    void AddSeries(uint64_t seriesKey,
+                   const std::string& seriesInstanceUid);
+
+    void AddInstance(uint64_t instanceKey,
+                     uint64_t seriesKey);
+
+    void RemoveInstance(uint64_t instanceKey);
+
+    void RemoveSeries(const std::string& orthancId);
+
+    void HandleNewInstance(const std::string& orthancInstanceId);
+
+    // Adds an item of "/series?expand", returns "false" if it is malformed. The mutex must be locked.
+    bool AddExpandedSeries(const Json::Value& series);
+
+    bool Seed();
+
+    void ApplyChange(const Change& change);
+
+    void Worker();
+
+  public:
+    SeriesIndex();
+
+    ~SeriesIndex();
+
+    // Starts the worker thread that applies the changes
+    void Start();
+
+    void Stop();
+
+    // Called by the change callback of the SDK, only queues the change
+    void HandleChange(OrthancPluginChangeType changeType,
+                      OrthancPluginResourceType resourceType,
+                      const char* resourceId);
+
+    // Returns "true" once the index reflects the content of the database
+    bool IsReady();
+
+    // Returns "false" if the index is not ready, in which case the database must be used
+    bool Lookup(bool& isStored,
+                unsigned int& instancesCount,
+                const std::string& seriesInstanceUid);
+
+    /**
+     * Lists the SeriesInstanceUIDs of the series that were modified
+     * after revision "since", and returns the current revision. Sets
+     * "isComplete" to "false" if these changes are not all logged, in
+     * which case all the series must be checked again. Returns "false"
+     * if the index is not ready.
+     **/
+    bool LookupChanges(std::set<std::string>& target,
+                       bool& isComplete,
+                       uint64_t& revision,
+                       uint64_t since);
+
+    void GetStatistics(Json::Value& target);
+
+    static SeriesIndex& GetInstance();
+  };
+}
@@ -0,0 +1,431 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TciaBrowser.h"
+
+#include "TciaProxy.h"
+
+#include <Compatibility.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <cassert>
+#include <map>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  namespace
+  {
+    class ItemComparator
+    {
+    private:
+      const Json::Value&  items_;
+      const std::string&  field_;
+      bool                ascending_;
+
+      static int Compare(const Json::Value* a,
+                         const Json::Value* b)
+      {
+        if (a == NULL || b == NULL)
+        {
+          // Missing values come first
+          return (a == NULL ? 0 : 1) - (b == NULL ? 0 : 1);
+        }
+        else if (a->isNumeric() && b->isNumeric())
+        {
+          const double x = a->asDouble();
+          const double y = b->asDouble();
+          return (x < y ? -1 : (x > y ? 1 : 0));
+        }
+        else if (a->isString() && b->isString())
+        {
+          return a->asString().compare(b->asString());
+        }
+        else
+        {
+          // Numbers come before strings
+          return static_cast<int>(a->type()) - static_cast<int>(b->type());
+        }
+      }
+
+      const Json::Value* LookupField(Json::Value::ArrayIndex index) const
+      {
+        const Json::Value& item = items_[index];
+        if (item.type() == Json::objectValue &&
+            item.isMember(field_))
+        {
+          return &item[field_];
+        }
+        else
+        {
+          return NULL;
+        }
+      }
+
+    public:
+      ItemComparator(const Json::Value& items,
+                     const std::string& field,
+                     bool ascending) :
+        items_(items),
+        field_(field),
+        ascending_(ascending)
+      {
+      }
+
+      bool operator() (Json::Value::ArrayIndex a,
+                       Json::Value::ArrayIndex b) const
+      {
+        const int c = Compare(LookupField(a), LookupField(b));
+
+        return ascending_ ? (c < 0) : (c > 0);
+      }
+    };
+  }
+
+
+  namespace
+  {
+    // Fetches one JSON answer from TCIA in a separate thread
+    class ConcurrentFetch : public boost::noncopyable
+    {
+    private:
+      std::string                                   url_;
+      TciaProxy::Fields                             fields_;
+      boost::shared_ptr<const Json::Value>          result_;
+      std::unique_ptr<Orthanc::OrthancException>    error_;
+      boost::thread                                 thread_;
+
+      static void Worker(ConcurrentFetch* that)
+      {
+        try
+        {
+          if (that->fields_.empty())
+          {
+            that->result_ = TciaProxy::GetJson(that->url_, RateLimiter::Lane_Interactive);
+          }
+          else
+          {
+            that->result_ = TciaProxy::GetProjection(that->url_, that->fields_)->GetJson();
+          }
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          that->error_.reset(new Orthanc::OrthancException(e));
+        }
+        catch (...)
+        {
+          that->error_.reset(new Orthanc::OrthancException(Orthanc::ErrorCode_InternalError));
+        }
+      }
+
+    public:
+      ConcurrentFetch(const std::string& url,
+                      const TciaProxy::Fields& fields) :
+        url_(url),
+        fields_(fields)
+      {
+        thread_ = boost::thread(Worker, this);
+      }
+
+      ~ConcurrentFetch()
+      {
+        if (thread_.joinable())
+        {
+          thread_.join();
+        }
+      }
+
+      boost::shared_ptr<const Json::Value> GetResult()
+      {
+        if (thread_.joinable())
+        {
+          thread_.join();
+        }
+
+        if (error_.get() != NULL)
+        {
+          throw *error_;
+        }
+
+        assert(result_.get() != NULL);
+        return result_;
+      }
+    };
+  }
+
+
+  TciaBrowser::Query::Query() :
+    ascending_(true),
+    offset_(0),
+    limit_(100)
+  {
+  }
+
+
+  void TciaBrowser::Query::SetFilter(const std::string& filter)
+  {
+    filter_ = filter;
+    Orthanc::Toolbox::ToLowerCase(filter_);
+  }
+
+
+  bool TciaBrowser::Query::IsMatch(const Json::Value& item) const
+  {
+    if (filter_.empty())
+    {
+      return true;
+    }
+    else if (item.type() != Json::objectValue)
+    {
+      return false;
+    }
+    else
+    {
+      // Same convention as in the Web application: All the values
+      // are concatenated, separated by spaces
+      std::string text;
+
+      Json::Value::Members members = item.getMemberNames();
+      for (size_t i = 0; i < members.size(); i++)
+      {
+        const Json::Value& value = item[members[i]];
+        if (value.isString() ||
+            value.isNumeric() ||
+            value.isBool())
+        {
+          if (!text.empty())
+          {
+            text += " ";
+          }
+
+          text += value.asString();
+        }
+      }
+
+      Orthanc::Toolbox::ToLowerCase(text);
+
+      return MatchWildcard(text, "*" + filter_ + "*");
+    }
+  }
+
+
+  void TciaBrowser::Query::Apply(Json::Value& answer,
+                                 const Json::Value& items) const
+  {
+    if (items.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "TCIA has not returned a list");
+    }
+
+    std::vector<Json::Value::ArrayIndex> selected;
+    selected.reserve(items.size());
+
+    for (Json::Value::ArrayIndex i = 0; i < items.size(); i++)
+    {
+      if (IsMatch(items[i]))
+      {
+        selected.push_back(i);
+      }
+    }
+
+    if (!sortField_.empty())
+    {
+      std::stable_sort(selected.begin(), selected.end(), ItemComparator(items, sortField_, ascending_));
+    }
+
+    answer = Json::objectValue;
+    answer["Total"] = static_cast<unsigned int>(selected.size());
+    answer["Offset"] = static_cast<unsigned int>(offset_);
+    answer["Limit"] = static_cast<unsigned int>(limit_);
+
+    Json::Value& page = answer["Items"];
+    page = Json::arrayValue;
+
+    for (size_t i = offset_; i < selected.size() && (limit_ == 0 || i < offset_ + limit_); i++)
+    {
+      page.append(items[selected[i]]);
+    }
+  }
+
+
+  bool TciaBrowser::LookupTciaPath(std::string& path,
+                                   const std::string& level)
+  {
+    if (level == "collections")
+    {
+      path = "getCollectionValues";
+      return true;
+    }
+    else if (level == "patients")
+    {
+      path = "getPatient";
+      return true;
+    }
+    else if (level == "studies")
+    {
+      path = "getPatientStudy";
+      return true;
+    }
+    else if (level == "series")
+    {
+      path = "getSeries";
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  bool TciaBrowser::MatchWildcard(const std::string& text,
+                                  const std::string& pattern)
+  {
+    // Iterative matching with backtracking to the last "*", which
+    // avoids the exponential behavior of the recursive approach
+    size_t t = 0;
+    size_t p = 0;
+    size_t star = std::string::npos;
+    size_t backtrack = 0;
+
+    while (t < text.size())
+    {
+      if (p < pattern.size() &&
+          (pattern[p] == '?' || pattern[p] == text[t]))
+      {
+        t++;
+        p++;
+      }
+      else if (p < pattern.size() &&
+               pattern[p] == '*')
+      {
+        star = p;
+        backtrack = t;
+        p++;
+      }
+      else if (star != std::string::npos)
+      {
+        p = star + 1;
+        backtrack++;
+        t = backtrack;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    while (p < pattern.size() &&
+           pattern[p] == '*')
+    {
+      p++;
+    }
+
+    return (p == pattern.size());
+  }
+
+
+  void TciaBrowser::GetPatientView(Json::Value& target,
+                                   const std::string& collection,
+                                   const std::string& patientId,
+                                   const std::set<std::string>& seriesFields)
+  {
+    static const char* const STUDY_INSTANCE_UID = "StudyInstanceUID";
+    static const char* const SERIES = "Series";
+
+    TciaProxy::Arguments arguments;
+    arguments["Collection"] = collection;
+    arguments["PatientID"] = patientId;
+
+    TciaProxy::Fields fields = seriesFields;
+    if (!fields.empty())
+    {
+      // The series are grouped by their parent study
+      fields.insert(STUDY_INSTANCE_UID);
+    }
+
+    // The list of series is retrieved in another thread, while the studies are retrieved in this thread
+    ConcurrentFetch series(TciaProxy::GetUrl("getSeries", arguments), fields);
+    boost::shared_ptr<const Json::Value> studies = TciaProxy::GetJson(TciaProxy::GetUrl("getPatientStudy", arguments), RateLimiter::Lane_Interactive);
+
+    if (studies->type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "TCIA has not returned a list");
+    }
+
+    target = Json::arrayValue;
+
+    std::map<std::string, Json::Value::ArrayIndex> index;
+
+    for (Json::Value::ArrayIndex i = 0; i < studies->size(); i++)
+    {
+      if ((*studies) [i].type() != Json::objectValue)
+      {
+        continue;  // Malformed item in the answer from TCIA
+      }
+
+      Json::Value study = (*studies) [i];
+      study[SERIES] = Json::arrayValue;
+
+      if (study.isMember(STUDY_INSTANCE_UID) &&
+          study[STUDY_INSTANCE_UID].isString())
+      {
+        index[study[STUDY_INSTANCE_UID].asString()] = target.size();
+      }
+
+      target.append(study);
+    }
+
+    boost::shared_ptr<const Json::Value> allSeries = series.GetResult();
+    if (allSeries->type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "TCIA has not returned a list");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < allSeries->size(); i++)
+    {
+      const Json::Value& item = (*allSeries) [i];
+
+      if (item.type() == Json::objectValue &&
+          item.isMember(STUDY_INSTANCE_UID) &&
+          item[STUDY_INSTANCE_UID].isString())
+      {
+        const std::string studyInstanceUid = item[STUDY_INSTANCE_UID].asString();
+
+        std::map<std::string, Json::Value::ArrayIndex>::const_iterator found = index.find(studyInstanceUid);
+        if (found == index.end())
+        {
+          // Series whose study is not listed by TCIA
+          Json::Value study = Json::objectValue;
+          study[STUDY_INSTANCE_UID] = studyInstanceUid;
+          study[SERIES] = Json::arrayValue;
+
+          found = index.insert(std::make_pair(studyInstanceUid, target.size())).first;
+          target.append(study);
+        }
+
+        target[found->second][SERIES].append(item);
+      }
+    }
+  }
+}
@@ -0,0 +1,120 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <json/value.h>
+#include <set>
+#include <string>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Server-side filtering, sorting and pagination over the lists
+   * that are returned by TCIA, which avoids sending huge lists to
+   * the Web browser.
+   **/
+  class TciaBrowser : public boost::noncopyable
+  {
+  public:
+    class Query
+    {
+    private:
+      std::string  filter_;
+      std::string  sortField_;
+      bool         ascending_;
+      size_t       offset_;
+      size_t       limit_;
+
+    public:
+      Query();
+
+      // Case-insensitive pattern with wildcards "*" and "?", matched anywhere in the items
+      void SetFilter(const std::string& filter);
+
+      const std::string& GetFilter() const
+      {
+        return filter_;
+      }
+
+      void SetSort(const std::string& field,
+                   bool ascending)
+      {
+        sortField_ = field;
+        ascending_ = ascending;
+      }
+
+      const std::string& GetSortField() const
+      {
+        return sortField_;
+      }
+
+      bool IsAscending() const
+      {
+        return ascending_;
+      }
+
+      void SetOffset(size_t offset)
+      {
+        offset_ = offset;
+      }
+
+      size_t GetOffset() const
+      {
+        return offset_;
+      }
+
+      // "0" means no limit
+      void SetLimit(size_t limit)
+      {
+        limit_ = limit;
+      }
+
+      size_t GetLimit() const
+      {
+        return limit_;
+      }
+
+      bool IsMatch(const Json::Value& item) const;
+
+      void Apply(Json::Value& answer,
+                 const Json::Value& items) const;
+    };
+
+    // Maps a level of the browse API ("collections", "patients", "studies", "series") to a TCIA path
+    static bool LookupTciaPath(std::string& path,
+                               const std::string& level);
+
+    static bool MatchWildcard(const std::string& text,
+                              const std::string& pattern);
+
+    /**
+     * Returns the studies of one patient, each study containing the
+     * list of its series in the "Series" field. The two underlying
+     * calls to TCIA are done concurrently. If "seriesFields" is not
+     * empty, only these fields are kept in the series.
+     **/
+    static void GetPatientView(Json::Value& target,
+                               const std::string& collection,
+                               const std::string& patientId,
+                               const std::set<std::string>& seriesFields);
+  };
+}
@@ -20,21 +20,55 @@
 #include "TciaImportJob.h"
 
 #include "CsvParser.h"
+#include "HttpClientPool.h"
+#include "ImportJobsRegistry.h"
+#include "IntegerParser.h"
+#include "SeriesIndex.h"
+#include "TciaManifest.h"
 
 #include <Logging.h>
 #include <SerializationToolbox.h>
 #include <Toolbox.h>
 
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <cassert>
+#include <set>
+
 
 static const char* const COLLECTION = "Collection";
+static const char* const COLLECTIONS = "Collections";
+static const char* const DIAGNOSTICS = "Diagnostics";
+static const char* const DIAGNOSTICS_COUNT = "DiagnosticsCount";
 static const char* const INSTANCES_COUNT = "InstancesCount";
 static const char* const JOB_TYPE = "TciaImportJob";
-static const char* const ORTHANC_ID = "OrthancID";
+static const char* const PATIENT = "Patient";
+static const char* const PATIENTS = "Patients";
 static const char* const PATIENT_ID = "PatientID";
 static const char* const SERIES = "Series";
 static const char* const SERIES_INSTANCE_UID = "SeriesInstanceUID";
 static const char* const SIZE = "Size";
+static const char* const UNRESOLVED = "Unresolved";
+static const char* const VERSION = "Version";
+
+/**
+ * Version of the compact serialization of the jobs. The jobs that
+ * were serialized by the versions <= 1.3 of the plugin have no
+ * version, and contain one JSON object per series.
+ **/
+static const unsigned int SERIALIZATION_VERSION = 2;
+
+
+// Below this size, the spreadsheets are parsed by the calling thread
+static const size_t MIN_PARALLEL_PARSING_SIZE = 1024 * 1024;
+
+static const unsigned int MAX_PARSING_THREADS = 16;
+
+// Maximum number of diagnostics that are reported in the content of a job
+static const size_t MAX_DIAGNOSTICS = 100;
 
+// Number of series of a manifest that are resolved by one step of the job
+static const size_t MANIFEST_BATCH_SIZE = 1000;
 
 static std::string tciaBaseUrl_;
 
@@ -72,11 +106,7 @@ namespace OrthancPlugins
 
     if (source.isMember(SIZE))
     {
-      try
-      {
-        size = boost::lexical_cast<uint64_t>(Orthanc::SerializationToolbox::ReadString(source, SIZE));
-      }
-      catch (boost::bad_lexical_cast&)
+      if (!IntegerParser::ParseUnsignedInteger64(size, Orthanc::SerializationToolbox::ReadString(source, SIZE)))
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
       }
@@ -93,6 +123,41 @@ namespace OrthancPlugins
                   size);
   }
 
+
+  TciaImportJob::PatientStatus::PatientStatus(const std::string& collection,
+                                              const std::string& patientId) :
+    collection_(collection),
+    patientId_(patientId),
+    seriesCount_(0),
+    completedSeries_(0),
+    instancesCount_(0),
+    size_(0)
+  {
+  }
+
+
+  void TciaImportJob::PatientStatus::AddSeries(const Series& series)
+  {
+    seriesCount_++;
+    instancesCount_ += series.GetInstancesCount();
+    size_ += series.GetSize();
+  }
+
+
+  void TciaImportJob::PatientStatus::SetCompleted(bool isCompleted)
+  {
+    if (isCompleted)
+    {
+      assert(completedSeries_ < seriesCount_);
+      completedSeries_++;
+    }
+    else
+    {
+      assert(completedSeries_ > 0);
+      completedSeries_--;
+    }
+  }
+
   
   void TciaImportJob::AddSeriesInternal(const Series& series)
   {
@@ -102,43 +167,302 @@ namespace OrthancPlugins
     }
     else
     {
-      series_.push_back(series);
+      {
+        boost::mutex::scoped_lock lock(seriesMutex_);
+
+        const std::pair<std::string, std::string> key(series.GetCollection(), series.GetPatientId());
+
+        PatientsIndex::const_iterator patient = patientsIndex_.find(key);
+        if (patient == patientsIndex_.end())
+        {
+          patient = patientsIndex_.insert(std::make_pair(key, patientsStatus_.size())).first;
+          patientsStatus_.push_back(PatientStatus(key.first, key.second));
+        }
+
+        patientsStatus_[patient->second].AddSeries(series);
+        seriesPatients_.push_back(patient->second);
+        seriesPositions_.insert(std::make_pair(boost::hash<std::string>()(series.GetSeriesInstanceUid()),
+                                               series_.size()));
+        stored_.push_back(false);
+        series_.push_back(series);
+      }
+
       totalInstancesCount_ += series.GetInstancesCount();
       totalSize_ += series.GetSize();
     }
   }
   
 
+  void TciaImportJob::SetStored(size_t position,
+                                bool isStored) const
+  {
+    assert(position < stored_.size());
+
+    if (stored_[position] != isStored)
+    {
+      stored_[position] = isStored;
+      patientsStatus_[seriesPatients_[position]].SetCompleted(isStored);
+
+      if (isStored)
+      {
+        storedCount_++;
+      }
+      else
+      {
+        storedCount_--;
+      }
+    }
+  }
+
+
+  void TciaImportJob::LookupStored(size_t position) const
+  {
+    const Series& series = series_[position];
+
+    bool isStored;
+    unsigned int instancesCount;
+    if (SeriesIndex::GetInstance().Lookup(isStored, instancesCount, series.GetSeriesInstanceUid()))
+    {
+      SetStored(position, isStored && instancesCount == series.GetInstancesCount());
+    }
+  }
+
+
+  void TciaImportJob::UpdateStoredStatus() const
+  {
+    std::set<std::string> changes;
+    bool isComplete;
+    uint64_t revision;
+
+    if (!SeriesIndex::GetInstance().LookupChanges(changes, isComplete, revision, storedRevision_))
+    {
+      // The index is not ready: Keep the last known status, that is updated by Step()
+      isStoredFromIndex_ = false;
+      return;
+    }
+
+    if (isStoredFromIndex_ &&
+        isComplete)
+    {
+      // Only look up the series that were modified, and those that were added since the last update
+      for (std::set<std::string>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+      {
+        std::pair<SeriesPositions::const_iterator, SeriesPositions::const_iterator> range =
+          seriesPositions_.equal_range(boost::hash<std::string>()(*it));
+
+        for (SeriesPositions::const_iterator position = range.first; position != range.second; ++position)
+        {
+          if (position->second < checkedCount_)
+          {
+            LookupStored(position->second);
+          }
+        }
+      }
+    }
+    else
+    {
+      checkedCount_ = 0;
+    }
+
+    for (size_t i = checkedCount_; i < series_.size(); i++)
+    {
+      LookupStored(i);
+    }
+
+    checkedCount_ = series_.size();
+    storedRevision_ = revision;
+    isStoredFromIndex_ = true;
+  }
+
+
+  void TciaImportJob::AddDiagnostic(const std::string& message)
+  {
+    if (diagnostics_.size() < MAX_DIAGNOSTICS)
+    {
+      diagnostics_.push_back(message);
+    }
+
+    diagnosticsCount_++;
+  }
+
+
+  void TciaImportJob::AddDiagnostic(size_t row,
+                                    const std::string& message)
+  {
+    AddDiagnostic("Row " + boost::lexical_cast<std::string>(row) + ": " + message);
+  }
+
+
+  namespace
+  {
+    // Dictionary encoding of the strings that are shared by many series
+    unsigned int EncodeString(Json::Value& dictionary,
+                              boost::unordered_map<std::string, unsigned int>& index,
+                              const std::string& value)
+    {
+      boost::unordered_map<std::string, unsigned int>::const_iterator found = index.find(value);
+
+      if (found == index.end())
+      {
+        const unsigned int code = dictionary.size();
+        dictionary.append(value);
+        index[value] = code;
+        return code;
+      }
+      else
+      {
+        return found->second;
+      }
+    }
+
+
+    const Json::Value& GetColumn(const Json::Value& columns,
+                                 const char* name,
+                                 Json::Value::ArrayIndex count)
+    {
+      if (!columns.isMember(name) ||
+          columns[name].type() != Json::arrayValue ||
+          columns[name].size() != count)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "Bad column in a serialized TCIA import job: " + std::string(name));
+      }
+      else
+      {
+        return columns[name];
+      }
+    }
+
+
+    const std::string& DecodeString(const std::vector<std::string>& dictionary,
+                                    const Json::Value& code)
+    {
+      if (!code.isUInt() ||
+          code.asUInt() >= dictionary.size())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+      }
+      else
+      {
+        return dictionary[code.asUInt()];
+      }
+    }
+
+
+    void UnserializeCompactSeries(std::vector<TciaImportJob::Series>& target,
+                                  const Json::Value& serialized)
+    {
+      std::vector<std::string> collections, patients;
+      Orthanc::SerializationToolbox::ReadArrayOfStrings(collections, serialized, COLLECTIONS);
+      Orthanc::SerializationToolbox::ReadArrayOfStrings(patients, serialized, PATIENTS);
+
+      if (!serialized.isMember(SERIES) ||
+          serialized[SERIES].type() != Json::objectValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+      }
+
+      const Json::Value& columns = serialized[SERIES];
+      const Json::Value& uids = GetColumn(columns, SERIES_INSTANCE_UID, columns[SERIES_INSTANCE_UID].size());
+      const Json::Value& collection = GetColumn(columns, COLLECTION, uids.size());
+      const Json::Value& patient = GetColumn(columns, PATIENT, uids.size());
+      const Json::Value& instancesCount = GetColumn(columns, INSTANCES_COUNT, uids.size());
+      const Json::Value& size = GetColumn(columns, SIZE, uids.size());
+
+      target.reserve(uids.size());
+
+      for (Json::Value::ArrayIndex i = 0; i < uids.size(); i++)
+      {
+        if (uids[i].type() != Json::stringValue ||
+            !instancesCount[i].isUInt() ||
+            !size[i].isUInt64())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+        }
+
+        target.push_back(TciaImportJob::Series(DecodeString(collections, collection[i]),
+                                               DecodeString(patients, patient[i]),
+                                               uids[i].asString(),
+                                               instancesCount[i].asUInt(),
+                                               size[i].asUInt64()));
+      }
+    }
+  }
+
+
   void TciaImportJob::UpdateInfo()
   {
-    Json::Value series = Json::arrayValue;
-    for (size_t i = 0; i < series_.size(); i++)
+    /**
+     * Only the series that were added since the previous call are
+     * serialized. The serialized job is compact, as Orthanc stores it
+     * in its database: The columns of the series are stored as
+     * separate arrays, the collections and the PatientIDs are
+     * dictionary-encoded, and the numbers are not stored as strings.
+     **/
+    Json::Value& collections = compact_[COLLECTIONS];
+    Json::Value& patients = compact_[PATIENTS];
+    Json::Value& columns = compact_[SERIES];
+
+    for (size_t i = columns[SERIES_INSTANCE_UID].size(); i < series_.size(); i++)
+    {
+      const Series& series = series_[i];
+
+      columns[COLLECTION].append(EncodeString(collections, collections_, series.GetCollection()));
+      columns[PATIENT].append(EncodeString(patients, patients_, series.GetPatientId()));
+      columns[SERIES_INSTANCE_UID].append(series.GetSeriesInstanceUid());
+      columns[INSTANCES_COUNT].append(series.GetInstancesCount());
+      columns[SIZE].append(static_cast<Json::UInt64>(series.GetSize()));
+    }
+
+    Json::Value diagnostics = Json::arrayValue;
+    for (size_t i = 0; i < diagnostics_.size(); i++)
     {
-      Json::Value item;
-      series_[i].Serialize(item);
-      series.append(item);
+      diagnostics.append(diagnostics_[i]);
     }
 
+    if (diagnosticsCount_ > 0)
     {
-      Json::Value serialized = Json::objectValue;
-      serialized[SERIES] = series;
-      OrthancJob::UpdateSerialized(serialized);
+      compact_[DIAGNOSTICS] = diagnostics;
+      compact_[DIAGNOSTICS_COUNT] = static_cast<unsigned int>(diagnosticsCount_);
     }
 
-    for (size_t i = 0; i < series_.size(); i++)
+    if (unresolved_.empty())
     {
-      std::string orthancId;
-      Orthanc::Toolbox::ComputeSHA1(orthancId, series_[i].GetPatientId());
-      series[static_cast<Json::Value::ArrayIndex>(i)][ORTHANC_ID] = orthancId;
+      compact_.removeMember(UNRESOLVED);
     }
-      
+    else
+    {
+      Json::Value& unresolved = compact_[UNRESOLVED];
+      unresolved = Json::arrayValue;
+
+      for (size_t i = 0; i < unresolved_.size(); i++)
+      {
+        unresolved.append(unresolved_[i]);
+      }
+    }
+
+    OrthancJob::UpdateSerialized(compact_);
+
     {
+      // The series are not listed, as Orthanc writes the whole content in each answer to "GET /jobs/{id}"
       Json::Value content = Json::objectValue;
-      content["Series"] = series;
+      content["ImportID"] = importId_;
       content["SeriesCount"] = static_cast<unsigned int>(series_.size());
       content["InstancesCount"] = totalInstancesCount_;
       content["Size"] = boost::lexical_cast<std::string>(totalSize_);
       content["SizeMB"] = static_cast<unsigned int>(totalSize_ / static_cast<uint64_t>((1024 * 1024)));
+
+      if (diagnosticsCount_ > 0)
+      {
+        content[DIAGNOSTICS] = diagnostics;
+        content[DIAGNOSTICS_COUNT] = static_cast<unsigned int>(diagnosticsCount_);
+      }
+
+      if (!unresolved_.empty())
+      {
+        content["UnresolvedSeriesCount"] = static_cast<unsigned int>(unresolved_.size());
+      }
+
       OrthancJob::UpdateContent(content);
     }
   }
@@ -148,8 +472,110 @@ namespace OrthancPlugins
     OrthancJob(JOB_TYPE),
     position_(0),
     totalInstancesCount_(0),
-    totalSize_(0)
+    totalSize_(0),
+    diagnosticsCount_(0),
+    compact_(Json::objectValue),
+    importId_(Orthanc::Toolbox::GenerateUuid()),
+    storedCount_(0),
+    checkedCount_(0),
+    isStoredFromIndex_(false),
+    storedRevision_(0)
+  {
+    compact_[VERSION] = SERIALIZATION_VERSION;
+    compact_[COLLECTIONS] = Json::arrayValue;
+    compact_[PATIENTS] = Json::arrayValue;
+
+    Json::Value& columns = compact_[SERIES];
+    columns = Json::objectValue;
+    columns[COLLECTION] = Json::arrayValue;
+    columns[PATIENT] = Json::arrayValue;
+    columns[SERIES_INSTANCE_UID] = Json::arrayValue;
+    columns[INSTANCES_COUNT] = Json::arrayValue;
+    columns[SIZE] = Json::arrayValue;
+
+    ImportJobsRegistry::GetInstance().Register(importId_, *this);
+  }
+
+
+  TciaImportJob::~TciaImportJob()
+  {
+    ImportJobsRegistry::GetInstance().Unregister(importId_);
+  }
+
+
+  void TciaImportJob::Reserve(size_t count)
+  {
+    boost::mutex::scoped_lock lock(seriesMutex_);
+    series_.reserve(count);
+    seriesPatients_.reserve(count);
+    stored_.reserve(count);
+  }
+
+
+  size_t TciaImportJob::CopySeries(std::vector<Series>& series,
+                                   std::vector<bool>& stored,
+                                   size_t offset,
+                                   size_t count) const
   {
+    boost::mutex::scoped_lock lock(seriesMutex_);
+    UpdateStoredStatus();
+
+    series.clear();
+    stored.clear();
+
+    if (offset < series_.size())
+    {
+      const size_t end = (count < series_.size() - offset ? offset + count : series_.size());
+      series.assign(series_.begin() + offset, series_.begin() + end);
+      stored.assign(stored_.begin() + offset, stored_.begin() + end);
+    }
+
+    return series_.size();
+  }
+
+
+  size_t TciaImportJob::CopySeriesWithStatus(std::vector<Series>& series,
+                                             bool isStored,
+                                             size_t offset,
+                                             size_t count) const
+  {
+    boost::mutex::scoped_lock lock(seriesMutex_);
+    UpdateStoredStatus();
+
+    series.clear();
+
+    // Only the flags are scanned, up to the end of the page
+    size_t matches = 0;
+
+    for (size_t i = 0; i < series_.size() && series.size() < count; i++)
+    {
+      if (stored_[i] == isStored)
+      {
+        if (matches >= offset)
+        {
+          series.push_back(series_[i]);
+        }
+
+        matches++;
+      }
+    }
+
+    return (isStored ? storedCount_ : series_.size() - storedCount_);
+  }
+
+
+  void TciaImportJob::GetPatientsStatus(std::vector<PatientStatus>& target) const
+  {
+    boost::mutex::scoped_lock lock(seriesMutex_);
+    UpdateStoredStatus();
+
+    target.clear();
+    target.reserve(patientsIndex_.size());
+
+    for (PatientsIndex::const_iterator it = patientsIndex_.begin(); it != patientsIndex_.end(); ++it)
+    {
+      target.push_back(patientsStatus_[it->second]);
+    }
   }
     
 
@@ -170,94 +596,456 @@ namespace OrthancPlugins
     UpdateInfo();
   }
 
+
+  void TciaImportJob::AddSeries(const std::vector<Series>& series)
+  {
+    Reserve(series_.size() + series.size());
+
+    for (size_t i = 0; i < series.size(); i++)
+    {
+      AddSeriesInternal(series[i]);
+    }
+
+    UpdateInfo();
+  }
+
   
-  void TciaImportJob::AddNbiaClientSpreadsheet(const std::string& csv)
+  class TciaImportJob::SpreadsheetVisitor : public CsvParser::IRowVisitor
   {
+  private:
+    typedef std::pair<size_t, std::string>  Diagnostic;  // Row and message
+
+    std::vector<Series>&     target_;
+    size_t                   collectionName_;
+    size_t                   subjectId_;
+    size_t                   seriesId_;
+    size_t                   instancesCount_;
+    size_t                   size_;
+    size_t                   columnsCount_;
+    std::string              instancesCountName_;
+    std::string              sizeName_;
+    std::vector<Diagnostic>  diagnostics_;
+    size_t                   diagnosticsCount_;
+
+    void AddDiagnostic(size_t row,
+                       const std::string& column,
+                       const std::string& value)
+    {
+      if (diagnostics_.size() < MAX_DIAGNOSTICS)
+      {
+        diagnostics_.push_back(Diagnostic(row, "Bad value for " + column + ": \"" + value + "\""));
+      }
+
+      diagnosticsCount_++;
+    }
+
+    static size_t LookupColumn(const std::map<std::string, size_t>& index,
+                               const char* name)
+    {
+      std::map<std::string, size_t>::const_iterator found = index.find(name);
+
+      if (found == index.end())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "Invalid TCIA cart, missing column: " + std::string(name));
+      }
+      else
+      {
+        return found->second;
+      }
+    }
+
+    void ParseHeader(const std::vector<std::string>& cells)
+    {
 #if 1
-    // Values that are used since orthanc-tcia 1.3
-    static const char* const COLLECTION_NAME = "Collection";
-    static const char* const SUBJECT_ID = "PatientID";
-    static const char* const SERIES_ID = "SeriesInstanceUID";
-    static const char* const NUMBER_OF_IMAGES = "ImageCount";
-    static const char* const FILE_SIZE = "FileSize";
+      // Values that are used since orthanc-tcia 1.3
+      static const char* const COLLECTION_NAME = "Collection";
+      static const char* const SUBJECT_ID = "PatientID";
+      static const char* const SERIES_ID = "SeriesInstanceUID";
+      static const char* const NUMBER_OF_IMAGES = "ImageCount";
+      static const char* const FILE_SIZE = "FileSize";
 #endif
 
 #if 0
-    // Values that were used in orthanc-tcia <= 1.2
-    static const char* const COLLECTION_NAME = "Collection Name";
-    static const char* const SUBJECT_ID = "Subject ID";
-    static const char* const SERIES_ID = "Series ID";
-    static const char* const NUMBER_OF_IMAGES = "Number of images";
-    static const char* const FILE_SIZE = "File Size (Bytes)";
+      // Values that were used in orthanc-tcia <= 1.2
+      static const char* const COLLECTION_NAME = "Collection Name";
+      static const char* const SUBJECT_ID = "Subject ID";
+      static const char* const SERIES_ID = "Series ID";
+      static const char* const NUMBER_OF_IMAGES = "Number of images";
+      static const char* const FILE_SIZE = "File Size (Bytes)";
 #endif
-      
-    OrthancPlugins::CsvParser parser;
-    parser.Parse(csv);
 
-    std::map<std::string, size_t> index;
-    parser.GetHeaderIndex(index);
+      std::map<std::string, size_t> index;
+      CsvParser::GetHeaderIndex(index, cells);
+
+      collectionName_ = LookupColumn(index, COLLECTION_NAME);
+      subjectId_ = LookupColumn(index, SUBJECT_ID);
+      seriesId_ = LookupColumn(index, SERIES_ID);
+      instancesCount_ = LookupColumn(index, NUMBER_OF_IMAGES);
+      size_ = LookupColumn(index, FILE_SIZE);
 
-    std::map<std::string, size_t>::const_iterator collectionName = index.find(COLLECTION_NAME);
-    std::map<std::string, size_t>::const_iterator subjectId = index.find(SUBJECT_ID);
-    std::map<std::string, size_t>::const_iterator seriesId = index.find(SERIES_ID);
-    std::map<std::string, size_t>::const_iterator instancesCount = index.find(NUMBER_OF_IMAGES);
-    std::map<std::string, size_t>::const_iterator size = index.find(FILE_SIZE);
+      columnsCount_ = std::max(std::max(std::max(collectionName_, subjectId_),
+                                        std::max(seriesId_, instancesCount_)), size_) + 1;
 
-    if (collectionName == index.end())
+      instancesCountName_ = NUMBER_OF_IMAGES;
+      sizeName_ = FILE_SIZE;
+    }
+
+  public:
+    explicit SpreadsheetVisitor(std::vector<Series>& target) :
+      target_(target),
+      collectionName_(0),
+      subjectId_(0),
+      seriesId_(0),
+      instancesCount_(0),
+      size_(0),
+      columnsCount_(0),
+      diagnosticsCount_(0)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
-                                      "Invalid TCIA cart, missing column: " + std::string(COLLECTION_NAME));
     }
-    else if (subjectId == index.end())
+
+    // Visitor for the rows that follow the header that was parsed by another visitor
+    SpreadsheetVisitor(std::vector<Series>& target,
+                       const SpreadsheetVisitor& header) :
+      target_(target),
+      collectionName_(header.collectionName_),
+      subjectId_(header.subjectId_),
+      seriesId_(header.seriesId_),
+      instancesCount_(header.instancesCount_),
+      size_(header.size_),
+      columnsCount_(header.columnsCount_),
+      instancesCountName_(header.instancesCountName_),
+      sizeName_(header.sizeName_),
+      diagnosticsCount_(0)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
-                                      "Invalid TCIA cart, missing column: " + std::string(SUBJECT_ID));
     }
-    else if (seriesId == index.end())
+
+    bool HasHeader() const
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
-                                      "Invalid TCIA cart, missing column: " + std::string(SERIES_ID));
+      return columnsCount_ != 0;
     }
-    else if (instancesCount == index.end())
+
+    virtual void VisitRow(size_t row,
+                          const std::vector<std::string>& cells) ORTHANC_OVERRIDE
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
-                                      "Invalid TCIA cart, missing column: " + std::string(NUMBER_OF_IMAGES));
+      if (!HasHeader())
+      {
+        ParseHeader(cells);
+        return;
+      }
+
+      if (cells.size() < columnsCount_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "Invalid TCIA cart, missing cells in row " +
+                                        boost::lexical_cast<std::string>(row));
+      }
+
+      // An empty cell is a missing value, which is not reported
+      uint32_t instancesCount = 0;
+      if (!cells[instancesCount_].empty() &&
+          !IntegerParser::ParseUnsignedInteger32(instancesCount, cells[instancesCount_]))
+      {
+        AddDiagnostic(row, instancesCountName_, cells[instancesCount_]);
+        instancesCount = 0;
+      }
+
+      uint64_t size = 0;
+      if (!cells[size_].empty() &&
+          !IntegerParser::ParseUnsignedInteger64(size, cells[size_]))
+      {
+        AddDiagnostic(row, sizeName_, cells[size_]);
+        size = 0;
+      }
+
+      target_.push_back(Series(cells[collectionName_], cells[subjectId_], cells[seriesId_],
+                               instancesCount, size));
     }
-    else if (size == index.end())
+
+    // The rows are numbered from "rowOffset" in the whole spreadsheet
+    void CommitDiagnostics(TciaImportJob& job,
+                           size_t rowOffset) const
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
-                                      "Invalid TCIA cart, missing column: " + std::string(FILE_SIZE));
+      for (size_t i = 0; i < diagnostics_.size(); i++)
+      {
+        job.AddDiagnostic(diagnostics_[i].first + rowOffset, diagnostics_[i].second);
+      }
+
+      // The diagnostics in excess were only counted
+      job.diagnosticsCount_ += diagnosticsCount_ - diagnostics_.size();
     }
-    else
+  };
+
+
+  void TciaImportJob::SpreadsheetReader::Flush()
+  {
+    for (size_t i = 0; i < pending_.size(); i++)
     {
-      Reserve(series_.size() + parser.GetRowsCount() - 1);
-        
-      for (size_t i = 1; i < parser.GetRowsCount(); i++)
+      job_.AddSeriesInternal(pending_[i]);
+    }
+
+    pending_.clear();
+  }
+
+
+  TciaImportJob::SpreadsheetReader::SpreadsheetReader(TciaImportJob& job) :
+    job_(job),
+    visitor_(new SpreadsheetVisitor(pending_))
+  {
+    reader_.reset(new CsvParser::Reader(*visitor_));
+  }
+
+
+  TciaImportJob::SpreadsheetReader::~SpreadsheetReader()
+  {
+    // Defined here, as "SpreadsheetVisitor" is incomplete in the header
+  }
+
+
+  void TciaImportJob::SpreadsheetReader::AddChunk(const void* data,
+                                                  size_t size)
+  {
+    // The series are built while parsing, without storing the cells of the whole spreadsheet
+    reader_->Feed(data, size);
+    Flush();
+  }
+
+
+  void TciaImportJob::SpreadsheetReader::Finish()
+  {
+    reader_->Finish();
+    Flush();
+
+    if (!visitor_->HasHeader())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Invalid TCIA cart, no header row");
+    }
+
+    visitor_->CommitDiagnostics(job_, 0);
+
+    job_.UpdateInfo();
+  }
+
+
+  // Range of rows of a spreadsheet, that is parsed by a separate thread
+  class TciaImportJob::SpreadsheetRange : public boost::noncopyable
+  {
+  private:
+    std::vector<Series>  series_;
+    SpreadsheetVisitor   visitor_;
+    size_t               rowsCount_;
+    bool                 success_;
+    boost::thread        thread_;
+
+    static void Worker(SpreadsheetRange* that,
+                       const char* data,
+                       size_t size)
+    {
+      try
       {
-        unsigned int instancesCount2;
-        try
+        CsvParser::Reader reader(that->visitor_);
+        reader.Feed(data, size);
+        reader.Finish();
+
+        that->rowsCount_ = reader.GetRowsCount();
+        that->success_ = true;
+      }
+      catch (...)
+      {
+        // The error is reported by the sequential parsing, with the index of the faulty row
+        that->success_ = false;
+      }
+    }
+
+  public:
+    SpreadsheetRange(const SpreadsheetVisitor& header,
+                     const char* data,
+                     size_t size) :
+      visitor_(series_, header),
+      rowsCount_(0),
+      success_(false)
+    {
+      thread_ = boost::thread(Worker, this, data, size);
+    }
+
+    ~SpreadsheetRange()
+    {
+      if (thread_.joinable())
+      {
+        thread_.join();
+      }
+    }
+
+    bool Join()
+    {
+      if (thread_.joinable())
+      {
+        thread_.join();
+      }
+
+      return success_;
+    }
+
+    const std::vector<Series>& GetSeries() const
+    {
+      return series_;
+    }
+
+    size_t GetRowsCount() const
+    {
+      return rowsCount_;
+    }
+
+    const SpreadsheetVisitor& GetVisitor() const
+    {
+      return visitor_;
+    }
+  };
+
+
+  bool TciaImportJob::AddSpreadsheetInParallel(const std::string& csv,
+                                               unsigned int threadsCount)
+  {
+    std::vector<size_t> boundaries;
+    if (!CsvParser::SplitRows(boundaries, csv, threadsCount) ||
+        boundaries.size() < 3)
+    {
+      return false;
+    }
+
+    // The first range only contains the first line, which must be the header row
+    std::vector<Series> ignored;
+    SpreadsheetVisitor header(ignored);
+
+    try
+    {
+      CsvParser::Reader reader(header);
+      reader.Feed(csv.c_str(), boundaries[1]);
+      reader.Finish();
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      return false;
+    }
+
+    if (!header.HasHeader())
+    {
+      return false;
+    }
+
+    std::vector<SpreadsheetRange*> ranges;
+    ranges.reserve(boundaries.size() - 2);
+
+    bool success = true;
+
+    try
+    {
+      for (size_t i = 2; i < boundaries.size(); i++)
+      {
+        ranges.push_back(new SpreadsheetRange(header, csv.c_str() + boundaries[i - 1],
+                                              boundaries[i] - boundaries[i - 1]));
+      }
+
+      for (size_t i = 0; i < ranges.size(); i++)
+      {
+        if (!ranges[i]->Join())
         {
-          instancesCount2 = boost::lexical_cast<unsigned int>(parser.GetCell(i, instancesCount->second));
+          success = false;
         }
-        catch (boost::bad_lexical_cast&)
+      }
+
+      if (success)
+      {
+        size_t count = 0;
+        for (size_t i = 0; i < ranges.size(); i++)
         {
-          instancesCount2 = 0;
+          count += ranges[i]->GetSeries().size();
         }
 
-        uint64_t size2;
-        try
+        // The ranges are merged in the order of the spreadsheet
+        Reserve(series_.size() + count);
+
+        for (size_t i = 0; i < ranges.size(); i++)
         {
-          size2 = boost::lexical_cast<uint64_t>(parser.GetCell(i, size->second));
+          const std::vector<Series>& series = ranges[i]->GetSeries();
+          for (size_t j = 0; j < series.size(); j++)
+          {
+            AddSeriesInternal(series[j]);
+          }
         }
-        catch (boost::bad_lexical_cast&)
+
+        // The first range only contains the header row
+        size_t rowOffset = 1;
+        for (size_t i = 0; i < ranges.size(); i++)
         {
-          size2 = 0;
+          ranges[i]->GetVisitor().CommitDiagnostics(*this, rowOffset);
+          rowOffset += ranges[i]->GetRowsCount();
         }
+      }
+    }
+    catch (...)
+    {
+      for (size_t i = 0; i < ranges.size(); i++)
+      {
+        delete ranges[i];
+      }
+
+      throw;
+    }
+
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+      delete ranges[i];
+    }
+
+    return success;
+  }
+
+
+  void TciaImportJob::AddNbiaClientSpreadsheet(const std::string& csv)
+  {
+    if (position_ != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    unsigned int threadsCount = std::min(boost::thread::hardware_concurrency(), MAX_PARSING_THREADS);
+
+    if (csv.size() >= MIN_PARALLEL_PARSING_SIZE &&
+        threadsCount > 1 &&
+        AddSpreadsheetInParallel(csv, threadsCount))
+    {
+      UpdateInfo();
+    }
+    else
+    {
+      // One row per line, except for the header: This bounds the number of series
+      Reserve(series_.size() + std::count(csv.begin(), csv.end(), '\n'));
+
+      SpreadsheetReader reader(*this);
+      reader.AddChunk(csv.empty() ? NULL : csv.c_str(), csv.size());
+      reader.Finish();
+    }
+  }
+
+
+  void TciaImportJob::AddTciaManifest(const TciaManifest& manifest)
+  {
+    if (position_ != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    const std::vector<std::string>& uids = manifest.GetSeriesInstanceUids();
 
-        AddSeriesInternal(Series(parser.GetCell(i, collectionName->second),
-                                 parser.GetCell(i, subjectId->second),
-                                 parser.GetCell(i, seriesId->second),
-                                 instancesCount2, size2));
+    std::set<std::string> unique(unresolved_.begin(), unresolved_.end());
+    unresolved_.reserve(unresolved_.size() + uids.size());
+
+    for (size_t i = 0; i < uids.size(); i++)
+    {
+      if (unique.insert(uids[i]).second)
+      {
+        unresolved_.push_back(uids[i]);
       }
     }
 
@@ -265,9 +1053,83 @@ namespace OrthancPlugins
   }
 
 
+  void TciaImportJob::ResolveManifestSeries()
+  {
+    const size_t count = std::min(unresolved_.size(), MANIFEST_BATCH_SIZE);
+    const std::vector<std::string> batch(unresolved_.begin(), unresolved_.begin() + count);
+
+    std::vector<MetadataMirror::Series> resolved;
+    std::vector<std::string> unknown;
+    TciaManifest::Resolve(resolved, unknown, batch);
+
+    // Same behavior as the NBIA Data Retriever: The missing series do not prevent the others from being imported
+    for (size_t i = 0; i < unknown.size(); i++)
+    {
+      LOG(WARNING) << "Series of the TCIA manifest that is unknown to TCIA, ignoring it: " << unknown[i];
+      AddDiagnostic("Series unknown to TCIA: " + unknown[i]);
+    }
+
+    Reserve(series_.size() + resolved.size());
+
+    for (size_t i = 0; i < resolved.size(); i++)
+    {
+      const MetadataMirror::Series& s = resolved[i];
+      AddSeriesInternal(Series(s.GetCollection(), s.GetPatientId(), s.GetSeriesInstanceUid(),
+                               s.GetImagesCount(), s.GetSize()));
+    }
+
+    unresolved_.erase(unresolved_.begin(), unresolved_.begin() + count);
+
+    if (unresolved_.empty() &&
+        series_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                      "None of the series of the TCIA manifest is known to TCIA");
+    }
+
+    UpdateInfo();
+  }
+
+
+  bool TciaImportJob::IsSeriesFullyStored(const Series& series)
+  {
+    bool isStored;
+    unsigned int instancesCount;
+    if (SeriesIndex::GetInstance().Lookup(isStored, instancesCount, series.GetSeriesInstanceUid()))
+    {
+      return (isStored &&
+              instancesCount == series.GetInstancesCount());
+    }
+
+    // The index of the series is not ready yet, fallback to the database
+    Json::Value query;
+    query["Level"] = "Instance";
+    query["Query"]["SeriesInstanceUID"] = series.GetSeriesInstanceUid();
+
+    Json::Value found;
+    if (OrthancPlugins::RestApiPost(found, "/tools/find", query, false) &&
+        found.type() == Json::arrayValue)
+    {
+      // Same rule as with the index: A series without any instance is never stored
+      return (found.size() > 0 &&
+              found.size() == series.GetInstancesCount());
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
   OrthancPluginJobStepStatus TciaImportJob::Step()
   {
-    if (position_ >= series_.size())
+    if (!unresolved_.empty())
+    {
+      // The manifests are resolved before any series is downloaded
+      ResolveManifestSeries();
+      return OrthancPluginJobStepStatus_Continue;
+    }
+    else if (position_ >= series_.size())
     {
       UpdateProgress(1);
       return OrthancPluginJobStepStatus_Success;
@@ -276,45 +1138,45 @@ namespace OrthancPlugins
     {
       const Series& series = series_[position_];
 
-      const std::string url = (std::string(TCIA_BASE_URL) +
-                               "/getImage?SeriesInstanceUID=" + series.GetSeriesInstanceUid());
+      const std::string url = GetTciaUrl("getImage?SeriesInstanceUID=" + series.GetSeriesInstanceUid());
 
-      Json::Value query;
-      query["Level"] = "Instance";
-      query["Query"]["SeriesInstanceUID"] = series.GetSeriesInstanceUid();
-        
-      Json::Value found;
-      if (OrthancPlugins::RestApiPost(found, "/tools/find", query, false) &&
-          found.type() == Json::arrayValue)
+      if (IsSeriesFullyStored(series))
+      {
+        LOG(INFO) << "TCIA series already fully stored in Orthanc: " << series.GetSeriesInstanceUid();
+      }
+      else
       {
-        if (found.size() == series.GetInstancesCount())
+        std::string archive;
+
+        try
         {
-          LOG(INFO) << "TCIA series already fully stored in Orthanc: " << series.GetSeriesInstanceUid();
+          HttpClientPool::GetInstance().Get(archive, url, RateLimiter::Lane_Bulk);
         }
-        else
+        catch (Orthanc::OrthancException&)
         {
-          OrthancPlugins::MemoryBuffer buffer;
-          if (buffer.HttpGet(url, "", ""))
-          {
-            std::string answer;
-            if (!OrthancPlugins::RestApiPost(answer, "/instances", buffer.GetData(), buffer.GetSize(), false))
-            {
-              throw Orthanc::OrthancException(
-                Orthanc::ErrorCode_BadFileFormat, "Cannot import series downloaded from TCIA into Orthanc: " +
-                series.GetSeriesInstanceUid());
-            }
-          }
-          else
-          {
-            throw Orthanc::OrthancException(
-              Orthanc::ErrorCode_NetworkProtocol, "Cannot download series from TCIA: " +
-              series.GetSeriesInstanceUid());
-          }
+          throw Orthanc::OrthancException(
+            Orthanc::ErrorCode_NetworkProtocol, "Cannot download series from TCIA: " +
+            series.GetSeriesInstanceUid());
+        }
+
+        std::string answer;
+        if (!OrthancPlugins::RestApiPost(answer, "/instances", archive.empty() ? NULL : archive.c_str(),
+                                         archive.size(), false))
+        {
+          throw Orthanc::OrthancException(
+            Orthanc::ErrorCode_BadFileFormat, "Cannot import series downloaded from TCIA into Orthanc: " +
+            series.GetSeriesInstanceUid());
         }
       }
-      else
+
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        // Once the index is ready, the status is only updated from its changes
+        boost::mutex::scoped_lock lock(seriesMutex_);
+
+        if (!isStoredFromIndex_)
+        {
+          SetStored(position_, true);
+        }
       }
 
       position_ ++;
@@ -337,25 +1199,62 @@ namespace OrthancPlugins
 
   TciaImportJob* TciaImportJob::Unserialize(const Json::Value& serialized)
   {
-    if (!serialized.isMember(SERIES) ||
-        serialized[SERIES].type() != Json::arrayValue)
+    if (serialized.type() != Json::objectValue)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
     }
-    else
+
+    std::unique_ptr<TciaImportJob> job(new TciaImportJob);
+
+    if (!serialized.isMember(VERSION))
     {
-      std::unique_ptr<TciaImportJob> job(new TciaImportJob);
+      // Job serialized by a version <= 1.3 of the plugin
+      if (!serialized.isMember(SERIES) ||
+          serialized[SERIES].type() != Json::arrayValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+      }
 
       const Json::Value& series = serialized[SERIES];
+      job->Reserve(series.size());
+
       for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
       {
         job->AddSeriesInternal(Series::Unserialize(series[i]));
       }
+    }
+    else if (Orthanc::SerializationToolbox::ReadUnsignedInteger(serialized, VERSION) == SERIALIZATION_VERSION)
+    {
+      std::vector<Series> series;
+      UnserializeCompactSeries(series, serialized);
 
-      job->UpdateInfo();
-        
-      return job.release();
+      job->Reserve(series.size());
+
+      for (size_t i = 0; i < series.size(); i++)
+      {
+        job->AddSeriesInternal(series[i]);
+      }
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                      "TCIA import job serialized by a more recent version of the plugin");
+    }
+
+    if (serialized.isMember(DIAGNOSTICS))
+    {
+      Orthanc::SerializationToolbox::ReadArrayOfStrings(job->diagnostics_, serialized, DIAGNOSTICS);
+      job->diagnosticsCount_ = Orthanc::SerializationToolbox::ReadUnsignedInteger(serialized, DIAGNOSTICS_COUNT);
     }
+
+    if (serialized.isMember(UNRESOLVED))
+    {
+      Orthanc::SerializationToolbox::ReadArrayOfStrings(job->unresolved_, serialized, UNRESOLVED);
+    }
+
+    job->UpdateInfo();
+
+    return job.release();
   }
 
 
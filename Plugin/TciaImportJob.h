@@ -19,13 +19,21 @@
 
 #pragma once
 
+#include "CsvParser.h"
+
 #include <Compatibility.h>
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <map>
+
 
 namespace OrthancPlugins
 {
+  class TciaManifest;
+
   class TciaImportJob : public OrthancJob
   {
   public:
@@ -75,23 +83,173 @@ namespace OrthancPlugins
       static Series Unserialize(const Json::Value& source);
     };
 
+    // Summary of the series of one patient of the job
+    class PatientStatus
+    {
+    private:
+      std::string   collection_;
+      std::string   patientId_;
+      unsigned int  seriesCount_;
+      unsigned int  completedSeries_;  // Series whose instances are all stored in Orthanc
+      unsigned int  instancesCount_;
+      uint64_t      size_;
+
+    public:
+      PatientStatus(const std::string& collection,
+                    const std::string& patientId);
+
+      const std::string& GetCollection() const
+      {
+        return collection_;
+      }
+
+      const std::string& GetPatientId() const
+      {
+        return patientId_;
+      }
+
+      unsigned int GetSeriesCount() const
+      {
+        return seriesCount_;
+      }
+
+      unsigned int GetCompletedSeries() const
+      {
+        return completedSeries_;
+      }
+
+      unsigned int GetInstancesCount() const
+      {
+        return instancesCount_;
+      }
+
+      uint64_t GetSize() const
+      {
+        return size_;
+      }
+
+      void AddSeries(const Series& series);
+
+      void SetCompleted(bool isCompleted);
+    };
+
   private:
-    std::vector<Series>  series_;
-    size_t               position_;
-    unsigned int         totalInstancesCount_;
-    uint64_t             totalSize_;
+    class SpreadsheetVisitor;
+    class SpreadsheetRange;
+
+  public:
+    /**
+     * Fills a job with the series of an NBIA spreadsheet that is
+     * received chunk by chunk, as in a chunked HTTP upload. The rows
+     * are converted to series as soon as they are complete, so that
+     * the spreadsheet is never stored as a whole.
+     **/
+    class SpreadsheetReader : public boost::noncopyable
+    {
+    private:
+      TciaImportJob&                       job_;
+      std::vector<Series>                  pending_;   // Series of the last chunk, not added to the job yet
+      std::unique_ptr<SpreadsheetVisitor>  visitor_;
+      std::unique_ptr<CsvParser::Reader>   reader_;
+
+      void Flush();
+
+    public:
+      explicit SpreadsheetReader(TciaImportJob& job);
+
+      ~SpreadsheetReader();
+
+      void AddChunk(const void* data,
+                    size_t size);
+
+      // Must be called after the last chunk
+      void Finish();
+    };
+
+  private:
+    typedef boost::unordered_map<std::string, unsigned int>  Dictionary;
+
+    // (Collection, PatientID) => index in "patientsStatus_"
+    typedef std::map<std::pair<std::string, std::string>, size_t>  PatientsIndex;
+
+    // Hash of the SeriesInstanceUID => index of the series
+    typedef boost::unordered_multimap<size_t, size_t>  SeriesPositions;
+
+    mutable boost::mutex      seriesMutex_;       // Protects "series_", that is read by the REST routes during the job
+    std::vector<Series>       series_;
+    std::vector<std::string>  unresolved_;        // Series of the manifests whose metadata is not resolved yet
+    size_t                    position_;
+    unsigned int              totalInstancesCount_;
+    uint64_t                  totalSize_;
+    std::vector<std::string>  diagnostics_;       // Malformed cells and unknown series, only the first ones are kept
+    size_t                    diagnosticsCount_;
+    Json::Value               compact_;           // Compact serialization of the job, kept between the calls to UpdateInfo()
+    Dictionary                collections_;       // Index of the collections in "compact_"
+    Dictionary                patients_;          // Index of the PatientIDs in "compact_"
+    std::string               importId_;          // Key of the job in the ImportJobsRegistry
+
+    /**
+     * Status of the series, that is read by the REST routes. It is
+     * maintained from the changes that are logged by the SeriesIndex,
+     * so that only the modified series are looked up again. Until the
+     * index is ready, the series are flagged by Step() once they are
+     * processed. Protected by "seriesMutex_".
+     **/
+    mutable std::vector<PatientStatus>  patientsStatus_;
+    PatientsIndex                       patientsIndex_;
+    std::vector<size_t>                 seriesPatients_;     // Index of the patient of each series
+    SeriesPositions                     seriesPositions_;
+    mutable std::vector<bool>           stored_;
+    mutable size_t                      storedCount_;
+    mutable size_t                      checkedCount_;       // Number of series already looked up in the index
+    mutable bool                        isStoredFromIndex_;
+    mutable uint64_t                    storedRevision_;     // Revision of the SeriesIndex
 
     void AddSeriesInternal(const Series& series);
+
+    // The mutex must be locked by the caller of the 3 following methods
+    void SetStored(size_t position,
+                   bool isStored) const;
+
+    void LookupStored(size_t position) const;
+
+    void UpdateStoredStatus() const;
+
+    void AddDiagnostic(const std::string& message);
+
+    void AddDiagnostic(size_t row,
+                       const std::string& message);
+
+    // Returns "false" if the spreadsheet cannot be split, or if some range is invalid
+    bool AddSpreadsheetInParallel(const std::string& csv,
+                                  unsigned int threadsCount);
     
     void UpdateInfo();
 
+    // Resolves the next batch of the series of the manifests
+    void ResolveManifestSeries();
+
   public:
     TciaImportJob();
+
+    virtual ~TciaImportJob();
     
-    void Reserve(size_t count)
-    {
-      series_.reserve(count);
-    }
+    void Reserve(size_t count);
+
+    // Copies at most "count" series from "offset" with their status, and returns the total number of series
+    size_t CopySeries(std::vector<Series>& series,
+                      std::vector<bool>& stored,
+                      size_t offset,
+                      size_t count) const;
+
+    // Same as CopySeries(), but only for the series with the given status. Returns the number of matches.
+    size_t CopySeriesWithStatus(std::vector<Series>& series,
+                                bool isStored,
+                                size_t offset,
+                                size_t count) const;
+
+    // Lists the patients of the job, sorted by collection and PatientID
+    void GetPatientsStatus(std::vector<PatientStatus>& target) const;
 
     void AddSeries(const Series& series);
     
@@ -100,8 +258,30 @@ namespace OrthancPlugins
                    const std::string& seriesInstanceUid,
                    unsigned int instancesCount,
                    uint64_t size);
+
+    /**
+     * Each call to AddSeries() updates the content of the job, which
+     * is written again as a whole. This version only updates the
+     * content once, and must be preferred to add many series.
+     **/
+    void AddSeries(const std::vector<Series>& series);
     
+    /**
+     * The large spreadsheets are split into ranges of rows that are
+     * parsed by concurrent threads, then merged in order. The parsing
+     * is sequential if the spreadsheet cannot be safely split (e.g.
+     * because of stray quotes), or if it is invalid, so that the
+     * error refers to the right row.
+     **/
     void AddNbiaClientSpreadsheet(const std::string& csv);
+
+    /**
+     * Adds the series of a ".tcia" manifest. Their metadata is only
+     * resolved by the first steps of the job, as this requires calls
+     * to TCIA that can last for minutes: The series of the manifest
+     * are only listed in the job once resolved.
+     **/
+    void AddTciaManifest(const TciaManifest& manifest);
     
     virtual OrthancPluginJobStepStatus Step() ORTHANC_OVERRIDE;
     
@@ -118,6 +298,9 @@ namespace OrthancPlugins
     
     static TciaImportJob* Unserialize(const Json::Value& serialized);
 
+    // Tells whether Orthanc stores the expected number of instances of the series
+    static bool IsSeriesFullyStored(const Series& series);
+
     static std::string GetTciaUrl(const std::string& path);
 
     static void SetTciaBaseUrl(const std::string& url);
@@ -0,0 +1,434 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "TciaManifest.h"
+
+#include "AdmissionControl.h"
+#include "TciaMirrorJob.h"
+#include "TciaProxy.h"
+
+#include <Compatibility.h>
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/thread.hpp>
+#include <cassert>
+#include <cctype>
+#include <cstring>
+#include <map>
+
+
+static const char* const LIST_OF_SERIES = "ListOfSeriesToDownload=";
+
+// Upper bound on the number of threads that resolve the series of one manifest
+static const unsigned int MAX_RESOLVER_THREADS = 8;
+
+
+namespace OrthancPlugins
+{
+  namespace
+  {
+    class Resolver : public boost::noncopyable
+    {
+    private:
+      typedef std::map<std::string, MetadataMirror::Series>  Resolved;
+      typedef std::pair<std::string, std::string>            Patient;  // Collection and PatientID
+
+      const std::vector<std::string>&              uids_;
+      const std::set<std::string>&                 wanted_;
+      boost::mutex                                 mutex_;
+      std::vector<size_t>                          begin_;      // Remaining range [begin, end) of each worker
+      std::vector<size_t>                          end_;
+      Resolved                                     resolved_;
+      std::set<Patient>                            patients_;   // The patients that were already asked to TCIA
+      std::unique_ptr<Orthanc::OrthancException>  error_;
+
+      // Stores the wanted series of an answer, and returns the patients whose series are still to be asked
+      void Store(std::vector<Patient>& toExpand,
+                 const std::vector<MetadataMirror::Series>& series)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (size_t i = 0; i < series.size(); i++)
+        {
+          const MetadataMirror::Series& s = series[i];
+
+          if (wanted_.find(s.GetSeriesInstanceUid()) != wanted_.end())
+          {
+            resolved_.insert(std::make_pair(s.GetSeriesInstanceUid(), s));
+
+            if (patients_.insert(Patient(s.GetCollection(), s.GetPatientId())).second)
+            {
+              toExpand.push_back(Patient(s.GetCollection(), s.GetPatientId()));
+            }
+          }
+        }
+      }
+
+      /**
+       * The cache of the proxy is bypassed, as each answer is only
+       * used once. TCIA answers with an empty body if the series is
+       * unknown, which is parsed as an empty array: The series is then
+       * reported as unknown, instead of failing the whole manifest.
+       **/
+      void Fetch(std::vector<Patient>& toExpand,
+                 const TciaProxy::Arguments& arguments)
+      {
+        Json::Value answer;
+        TciaMirrorJob::GetFromTcia(answer, "getSeries", arguments);
+
+        std::vector<MetadataMirror::Series> series;
+        MetadataMirror::Series::Parse(series, answer);
+        Store(toExpand, series);
+      }
+
+      bool IsResolved(size_t index) const
+      {
+        return resolved_.find(uids_[index]) != resolved_.end();
+      }
+
+      /**
+       * The siblings of a series are usually contiguous in a manifest.
+       * Each worker therefore walks its own contiguous range, so that
+       * the siblings of a series are skipped once its patient has been
+       * retrieved. A worker that is done takes the last series of the
+       * largest remaining range of another worker.
+       **/
+      bool NextUid(std::string& uid,
+                   size_t worker)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (error_.get() != NULL)
+        {
+          return false;
+        }
+
+        while (begin_[worker] < end_[worker] &&
+               IsResolved(begin_[worker]))
+        {
+          begin_[worker]++;
+        }
+
+        if (begin_[worker] < end_[worker])
+        {
+          uid = uids_[begin_[worker]];
+          begin_[worker]++;
+          return true;
+        }
+
+        for (;;)
+        {
+          size_t largest = 0;
+          for (size_t i = 1; i < begin_.size(); i++)
+          {
+            if (end_[i] - begin_[i] > end_[largest] - begin_[largest])
+            {
+              largest = i;
+            }
+          }
+
+          if (begin_[largest] == end_[largest])
+          {
+            return false;
+          }
+
+          end_[largest]--;
+
+          if (!IsResolved(end_[largest]))
+          {
+            uid = uids_[end_[largest]];
+            return true;
+          }
+        }
+      }
+
+      void ResolveSeries(const std::string& uid)
+      {
+        std::vector<Patient> toExpand;
+
+        {
+          TciaProxy::Arguments arguments;
+          arguments["SeriesInstanceUID"] = uid;
+          Fetch(toExpand, arguments);
+        }
+
+        for (size_t i = 0; i < toExpand.size(); i++)
+        {
+          TciaProxy::Arguments arguments;
+          arguments["Collection"] = toExpand[i].first;
+          arguments["PatientID"] = toExpand[i].second;
+
+          std::vector<Patient> ignored;
+          Fetch(ignored, arguments);
+        }
+      }
+
+      static void Worker(Resolver* that,
+                         size_t worker)
+      {
+        std::string uid;
+        while (that->NextUid(uid, worker))
+        {
+          try
+          {
+            that->ResolveSeries(uid);
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            /**
+             * A series is only reported as unknown if TCIA answered
+             * without it. If TCIA could not be asked, the whole
+             * manifest is given up, as the series would otherwise be
+             * silently dropped from the import.
+             **/
+            LOG(ERROR) << "Cannot resolve series from TCIA: " << uid << " (" << e.What() << ")";
+
+            boost::mutex::scoped_lock lock(that->mutex_);
+            if (that->error_.get() == NULL)
+            {
+              that->error_.reset(new Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                                               "Cannot resolve series from TCIA: " + uid));
+            }
+          }
+          catch (...)
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+            if (that->error_.get() == NULL)
+            {
+              that->error_.reset(new Orthanc::OrthancException(Orthanc::ErrorCode_InternalError));
+            }
+          }
+        }
+      }
+
+    public:
+      Resolver(const std::vector<std::string>& uids,
+               const std::set<std::string>& wanted) :
+        uids_(uids),
+        wanted_(wanted)
+      {
+      }
+
+      void AddMirrored(const std::vector<MetadataMirror::Series>& series)
+      {
+        std::vector<Patient> ignored;
+        Store(ignored, series);
+
+        // The patients of the mirror were not asked to TCIA, their other series might be missing
+        patients_.clear();
+      }
+
+      void Run(unsigned int threadsCount)
+      {
+        assert(threadsCount > 0);
+
+        begin_.resize(threadsCount);
+        end_.resize(threadsCount);
+
+        for (size_t i = 0; i < threadsCount; i++)
+        {
+          begin_[i] = uids_.size() * i / threadsCount;
+          end_[i] = uids_.size() * (i + 1) / threadsCount;
+        }
+
+        boost::thread_group threads;
+
+        for (size_t i = 0; i < threadsCount; i++)
+        {
+          threads.add_thread(new boost::thread(Worker, this, i));
+        }
+
+        threads.join_all();
+
+        if (error_.get() != NULL)
+        {
+          throw *error_;
+        }
+      }
+
+      void GetResult(std::vector<MetadataMirror::Series>& target,
+                     std::vector<std::string>& unknown) const
+      {
+        target.reserve(target.size() + resolved_.size());
+
+        for (size_t i = 0; i < uids_.size(); i++)
+        {
+          Resolved::const_iterator found = resolved_.find(uids_[i]);
+          if (found == resolved_.end())
+          {
+            unknown.push_back(uids_[i]);
+          }
+          else
+          {
+            target.push_back(found->second);
+          }
+        }
+      }
+    };
+  }
+
+
+  void TciaManifest::AddLine(const char* start,
+                             const char* end)
+  {
+    const std::string line = Orthanc::Toolbox::StripSpaces(std::string(start, end));
+
+    if (line.empty())
+    {
+      return;
+    }
+    else if (hasList_)
+    {
+      for (size_t i = 0; i < line.size(); i++)
+      {
+        if (!isdigit(line[i]) &&
+            line[i] != '.')
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                          "Invalid TCIA manifest, bad SeriesInstanceUID: " + line);
+        }
+      }
+
+      if (uniqueUids_.insert(line).second)
+      {
+        seriesInstanceUids_.push_back(line);
+      }
+    }
+    else if (line == LIST_OF_SERIES)
+    {
+      hasList_ = true;
+    }
+    else if (line.find('=') == std::string::npos)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Invalid TCIA manifest, unexpected line: " + line);
+    }
+  }
+
+
+  TciaManifest::TciaManifest() :
+    hasList_(false),
+    done_(false)
+  {
+  }
+
+
+  void TciaManifest::AddChunk(const void* data,
+                              size_t size)
+  {
+    if (done_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    const char* current = reinterpret_cast<const char*>(data);
+    const char* end = current + size;
+
+    while (current < end)
+    {
+      const char* eol = reinterpret_cast<const char*>(memchr(current, '\n', end - current));
+
+      if (eol == NULL)
+      {
+        pendingLine_.append(current, end);
+        return;
+      }
+      else if (pendingLine_.empty())
+      {
+        AddLine(current, eol);
+      }
+      else
+      {
+        pendingLine_.append(current, eol);
+        AddLine(pendingLine_.c_str(), pendingLine_.c_str() + pendingLine_.size());
+        pendingLine_.clear();
+      }
+
+      current = eol + 1;
+    }
+  }
+
+
+  void TciaManifest::Finish()
+  {
+    if (done_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    done_ = true;
+
+    AddLine(pendingLine_.c_str(), pendingLine_.c_str() + pendingLine_.size());
+    pendingLine_.clear();
+
+    if (!hasList_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Invalid TCIA manifest, no line \"" + std::string(LIST_OF_SERIES) + "\"");
+    }
+  }
+
+
+  void TciaManifest::Resolve(std::vector<MetadataMirror::Series>& target,
+                             std::vector<std::string>& unknown,
+                             const std::vector<std::string>& seriesInstanceUids)
+  {
+    const std::set<std::string> uniqueUids(seriesInstanceUids.begin(), seriesInstanceUids.end());
+
+    if (uniqueUids.size() != seriesInstanceUids.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    Resolver resolver(seriesInstanceUids, uniqueUids);
+
+    {
+      std::vector<MetadataMirror::Series> mirrored;
+      MetadataMirror::GetInstance().LookupSeries(mirrored, uniqueUids);
+      resolver.AddMirrored(mirrored);
+
+      LOG(INFO) << "TCIA manifest: " << mirrored.size() << " series out of "
+                << seriesInstanceUids.size() << " found in the mirror";
+    }
+
+    /**
+     * Never run more concurrent calls than half of those allowed to
+     * the proxy by the admission control, so that the interactive
+     * requests are still served while a large manifest is resolved.
+     **/
+    const unsigned int maximumActive = AdmissionControl::GetInstance().GetMaximumActive();
+
+    unsigned int threadsCount = maximumActive / 2;
+    if (maximumActive == 0 ||  // No limit
+        threadsCount > MAX_RESOLVER_THREADS)
+    {
+      threadsCount = MAX_RESOLVER_THREADS;
+    }
+    else if (threadsCount == 0)
+    {
+      threadsCount = 1;
+    }
+
+    resolver.Run(threadsCount);
+    resolver.GetResult(target, unknown);
+  }
+}
@@ -0,0 +1,85 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "MetadataMirror.h"
+
+#include <boost/noncopyable.hpp>
+#include <set>
+#include <string>
+#include <vector>
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Manifest in the ".tcia" format of the NBIA Data Retriever, which
+   * is a list of "key=value" lines, followed by the line
+   * "ListOfSeriesToDownload=" and by one SeriesInstanceUID per line.
+   * The manifest can be received chunk by chunk. As it only contains
+   * UIDs, the metadata of the series must be resolved before
+   * importing them.
+   **/
+  class TciaManifest : public boost::noncopyable
+  {
+  private:
+    std::vector<std::string>  seriesInstanceUids_;   // In the order of the manifest, without duplicates
+    std::set<std::string>     uniqueUids_;
+    std::string               pendingLine_;          // Incomplete line at the end of the last chunk
+    bool                      hasList_;
+    bool                      done_;
+
+    void AddLine(const char* start,
+                 const char* end);
+
+  public:
+    TciaManifest();
+
+    void AddChunk(const void* data,
+                  size_t size);
+
+    // Must be called after the last chunk
+    void Finish();
+
+    const std::vector<std::string>& GetSeriesInstanceUids() const
+    {
+      return seriesInstanceUids_;
+    }
+
+    /**
+     * Resolves the collection, the patient, the number of instances
+     * and the size of the given series, which must be unique, in the
+     * given order. The series are first looked up in the local mirror
+     * of TCIA. The remaining series are asked to TCIA by concurrent
+     * calls that bypass the cache of the proxy: Once a series is
+     * found, all the series of its patient are retrieved at once,
+     * which resolves its siblings in the manifest with one single
+     * call. The series that are unknown to TCIA (i.e. TCIA answers
+     * with an empty body or an empty array) are reported in
+     * "unknown". An exception is thrown if TCIA cannot be asked about
+     * a series. This can take minutes for large manifests, and must
+     * be called from a job.
+     **/
+    static void Resolve(std::vector<MetadataMirror::Series>& target,
+                        std::vector<std::string>& unknown,
+                        const std::vector<std::string>& seriesInstanceUids);
+  };
+}
@@ -0,0 +1,275 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TciaMirrorJob.h"
+
+#include "HttpClientPool.h"
+#include "MetadataMirror.h"
+#include "SearchIndex.h"
+#include "TciaProxy.h"
+#include "TciaSyncJob.h"
+
+#include <Logging.h>
+#include <SerializationToolbox.h>
+
+#include <set>
+
+
+static const char* const COLLECTIONS = "Collections";
+static const char* const JOB_TYPE = "TciaMirrorJob";
+
+
+namespace OrthancPlugins
+{
+  void TciaMirrorJob::GetFromTcia(Json::Value& target,
+                                  const std::string& path,
+                                  const std::map<std::string, std::string>& arguments)
+  {
+    // The cache of the proxy is bypassed, as the mirror must be up-to-date
+    const std::string url = TciaProxy::GetUrl(path, arguments);
+
+    std::string body;
+
+    try
+    {
+      HttpClientPool::GetInstance().Get(body, url, RateLimiter::Lane_Bulk);
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Cannot access TCIA: " + url);
+    }
+
+    if (body.empty())
+    {
+      target = Json::arrayValue;  // TCIA answers with an empty body if there is no match
+    }
+    else if (!ReadJson(target, body))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "TCIA has not answered with JSON: " + url);
+    }
+  }
+
+
+  void TciaMirrorJob::UpdateInfo()
+  {
+    Json::Value collections = Json::arrayValue;
+
+    if (!allCollections_)
+    {
+      for (size_t i = 0; i < collections_.size(); i++)
+      {
+        collections.append(collections_[i]);
+      }
+    }
+
+    {
+      Json::Value serialized = Json::objectValue;
+      serialized[COLLECTIONS] = collections;
+      OrthancJob::UpdateSerialized(serialized);
+    }
+
+    {
+      Json::Value content = Json::objectValue;
+      content["AllCollections"] = allCollections_;
+      content["CollectionsCount"] = static_cast<unsigned int>(collections_.size());
+      content["MirroredCollections"] = static_cast<unsigned int>(position_);
+      content["SeriesCount"] = static_cast<unsigned int>(seriesCount_);
+      OrthancJob::UpdateContent(content);
+    }
+  }
+
+
+  void TciaMirrorJob::ListAllCollections()
+  {
+    Json::Value collections;
+    GetFromTcia(collections, "getCollectionValues", TciaProxy::Arguments());
+
+    if (collections.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Cannot list the collections of TCIA");
+    }
+
+    collections_.clear();
+
+    for (Json::Value::ArrayIndex i = 0; i < collections.size(); i++)
+    {
+      if (collections[i].isMember("Collection") &&
+          collections[i]["Collection"].type() == Json::stringValue)
+      {
+        collections_.push_back(collections[i]["Collection"].asString());
+      }
+    }
+
+    if (collections_.empty())
+    {
+      // Otherwise, all the collections would be removed from the mirror at the end of the job
+      std::set<std::string> mirrored;
+      MetadataMirror::GetInstance().ListCollectionNames(mirrored);
+
+      if (!mirrored.empty())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        "TCIA has listed no collection, the mirror is kept as it was");
+      }
+    }
+  }
+
+
+  void TciaMirrorJob::MirrorCollection(const std::string& collection)
+  {
+    TciaProxy::Arguments arguments;
+    arguments["Collection"] = collection;
+
+    Json::Value answer;
+    GetFromTcia(answer, "getSeries", arguments);
+
+    std::vector<MetadataMirror::Series> series;
+    MetadataMirror::Series::Parse(series, answer);
+
+    if (MetadataMirror::GetInstance().ReplaceCollection(collection, series))
+    {
+      seriesCount_ += series.size();
+      LOG(INFO) << "TCIA collection mirrored: " << collection << " (" << series.size() << " series)";
+    }
+    else
+    {
+      LOG(WARNING) << "TCIA has listed no series in collection " << collection
+                   << ", which is kept in the mirror as it was";
+    }
+  }
+
+
+  TciaMirrorJob::TciaMirrorJob() :
+    OrthancJob(JOB_TYPE),
+    allCollections_(true),
+    hasCollections_(false),
+    position_(0),
+    seriesCount_(0)
+  {
+    UpdateInfo();
+  }
+
+
+  void TciaMirrorJob::AddCollection(const std::string& collection)
+  {
+    if (position_ != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      collections_.push_back(collection);
+      allCollections_ = false;
+      hasCollections_ = true;
+      UpdateInfo();
+    }
+  }
+
+
+  OrthancPluginJobStepStatus TciaMirrorJob::Step()
+  {
+    if (!hasCollections_)
+    {
+      // Taken before the first call to TCIA, so that no update is missed by the next sync
+      startDate_ = TciaSyncJob::GetCurrentDate();
+      ListAllCollections();
+      hasCollections_ = true;
+    }
+    else if (position_ < collections_.size())
+    {
+      MirrorCollection(collections_[position_]);
+      position_++;
+    }
+    else
+    {
+      if (allCollections_)
+      {
+        const std::set<std::string> current(collections_.begin(), collections_.end());
+
+        std::set<std::string> mirrored;
+        MetadataMirror::GetInstance().ListCollectionNames(mirrored);
+
+        for (std::set<std::string>::const_iterator it = mirrored.begin(); it != mirrored.end(); ++it)
+        {
+          if (current.find(*it) == current.end())
+          {
+            LOG(INFO) << "Collection removed from the TCIA mirror: " << *it;
+            MetadataMirror::GetInstance().RemoveCollection(*it);
+          }
+        }
+
+        // The whole archive has been mirrored: Incremental sync can start from this date
+        MetadataMirror::GetInstance().SetLastUpdate(startDate_);
+      }
+
+      MetadataMirror::GetInstance().Save();
+
+      // Rebuild the search index now, instead of during the next search
+      SearchIndex::GetInstance().Update();
+
+      UpdateProgress(1);
+      return OrthancPluginJobStepStatus_Success;
+    }
+
+    UpdateInfo();
+
+    if (!collections_.empty())
+    {
+      UpdateProgress(static_cast<float>(position_) / static_cast<float>(collections_.size() + 1));
+    }
+
+    return OrthancPluginJobStepStatus_Continue;
+  }
+
+
+  void TciaMirrorJob::Reset()
+  {
+    if (allCollections_)
+    {
+      collections_.clear();
+      hasCollections_ = false;
+    }
+
+    position_ = 0;
+    seriesCount_ = 0;
+    UpdateInfo();
+  }
+
+
+  std::string TciaMirrorJob::GetJobType()
+  {
+    return JOB_TYPE;
+  }
+
+
+  TciaMirrorJob* TciaMirrorJob::Unserialize(const Json::Value& serialized)
+  {
+    std::unique_ptr<TciaMirrorJob> job(new TciaMirrorJob);
+
+    std::set<std::string> collections;
+    Orthanc::SerializationToolbox::ReadSetOfStrings(collections, serialized, COLLECTIONS);
+
+    for (std::set<std::string>::const_iterator it = collections.begin(); it != collections.end(); ++it)
+    {
+      job->AddCollection(*it);
+    }
+
+    return job.release();
+  }
+}
@@ -0,0 +1,73 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <Compatibility.h>
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Job that fills the local mirror of the metadata of TCIA, with
+   * one call to "getSeries" per collection. If no collection is
+   * explicitly given, all the collections of TCIA are mirrored, and
+   * the collections that have disappeared from TCIA are removed.
+   **/
+  class TciaMirrorJob : public OrthancJob
+  {
+  private:
+    std::vector<std::string>  collections_;
+    bool                      allCollections_;
+    bool                      hasCollections_;
+    size_t                    position_;
+    size_t                    seriesCount_;
+    std::string               startDate_;
+
+    void UpdateInfo();
+
+    void ListAllCollections();
+
+    void MirrorCollection(const std::string& collection);
+
+  public:
+    TciaMirrorJob();
+
+    void AddCollection(const std::string& collection);
+
+    virtual OrthancPluginJobStepStatus Step() ORTHANC_OVERRIDE;
+
+    virtual void Stop(OrthancPluginJobStopReason reason) ORTHANC_OVERRIDE
+    {
+    }
+
+    virtual void Reset() ORTHANC_OVERRIDE;
+
+    static std::string GetJobType();
+
+    static TciaMirrorJob* Unserialize(const Json::Value& serialized);
+
+    // GET request to TCIA that bypasses the cache of the proxy
+    static void GetFromTcia(Json::Value& target,
+                            const std::string& path,
+                            const std::map<std::string, std::string>& arguments);
+  };
+}
@@ -0,0 +1,292 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TciaProxy.h"
+
+#include "AdmissionControl.h"
+#include "CircuitBreaker.h"
+#include "HttpClientPool.h"
+#include "HttpHelpers.h"
+#include "IntegerParser.h"
+#include "NegativeCache.h"
+#include "TciaImportJob.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <cassert>
+
+
+// Largest body that is allocated from its "Content-Length", even if the cache has no limit
+static const uint64_t MAX_RESERVED_BODY_SIZE = 16 * 1024 * 1024;
+
+
+namespace OrthancPlugins
+{
+  namespace
+  {
+    class ChunkedAnswer : public HttpClient::IAnswer
+    {
+    private:
+      std::string  mime_;
+      std::string  body_;
+
+    public:
+      ChunkedAnswer() :
+        mime_("application/octet-stream")
+      {
+      }
+
+      virtual void AddHeader(const std::string& key,
+                             const std::string& value) ORTHANC_OVERRIDE
+      {
+        if (boost::iequals(key, "Content-Type"))
+        {
+          mime_ = value;
+        }
+        else if (boost::iequals(key, "Content-Length"))
+        {
+          /**
+           * Allocate the body at once if its size is announced by TCIA.
+           * The announced size is not trusted beyond the size of the
+           * items of the cache: The larger bodies grow as they are
+           * received, and fail with the transfer if memory runs out.
+           **/
+          uint64_t size;
+          if (IntegerParser::ParseUnsignedInteger64(size, value) &&
+              size <= MAX_RESERVED_BODY_SIZE &&
+              HttpCache::GetInstance().IsCacheable(static_cast<size_t>(size)))
+          {
+            body_.reserve(static_cast<size_t>(size));
+          }
+        }
+      }
+
+      virtual void AddChunk(const void* data,
+                            size_t size) ORTHANC_OVERRIDE
+      {
+        body_.append(reinterpret_cast<const char*>(data), size);
+      }
+
+      HttpCache::Item* CreateItem()
+      {
+        return new HttpCache::Item(body_, mime_);
+      }
+    };
+  }
+
+
+  static void ProjectFields(Json::Value& target,
+                            const Json::Value& source,
+                            const TciaProxy::Fields& fields)
+  {
+    if (source.type() == Json::objectValue)
+    {
+      target = Json::objectValue;
+
+      for (TciaProxy::Fields::const_iterator it = fields.begin(); it != fields.end(); ++it)
+      {
+        if (source.isMember(*it))
+        {
+          target[*it] = source[*it];
+        }
+      }
+    }
+    else if (source.type() == Json::arrayValue)
+    {
+      target = Json::arrayValue;
+      target.resize(source.size());
+
+      for (Json::Value::ArrayIndex i = 0; i < source.size(); i++)
+      {
+        ProjectFields(target[i], source[i], fields);
+      }
+    }
+    else
+    {
+      target = source;
+    }
+  }
+
+
+  std::string TciaProxy::GetUrl(const std::string& path,
+                                const Arguments& arguments)
+  {
+    // The path comes from the client: A "#" would be taken as the separator of the cache keys of the projections
+    if (path.find('#') != std::string::npos)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Bad path to TCIA: " + path);
+    }
+
+    std::string tcia = TciaImportJob::GetTciaUrl(path);
+
+    for (Arguments::const_iterator it = arguments.begin(); it != arguments.end(); ++it)
+    {
+      if (it == arguments.begin())
+      {
+        tcia += "?";
+      }
+      else
+      {
+        tcia += "&";
+      }
+
+      std::string key, value;
+      Orthanc::Toolbox::UriEncode(key, it->first);
+      Orthanc::Toolbox::UriEncode(value, it->second);
+    
+      tcia += key + "=" + value;
+    }
+
+    return tcia;
+  }
+
+
+  boost::shared_ptr<const HttpCache::Item> TciaProxy::Get(const std::string& url,
+                                                          RateLimiter::Lane lane)
+  {
+    boost::shared_ptr<const HttpCache::Item> item;
+
+    if (!HttpCache::GetInstance().Read(item, url))
+    {
+      std::string failure;
+      if (NegativeCache::GetInstance().Lookup(failure, url))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem,
+                                        "Cannot proxy HTTP request to TCIA (recent failure: " + failure + "): " + url);
+      }
+
+      ChunkedAnswer answer;
+
+      // Fail at once if TCIA is known to be down, without queuing for admission
+      CircuitBreaker::Call call(CircuitBreaker::GetInstance());
+
+      // Only the cache misses are subject to admission control, as they are the only ones to wait for TCIA
+      AdmissionControl::Ticket ticket(AdmissionControl::GetInstance());
+
+      try
+      {
+        HttpClientPool::GetInstance().Get(answer, url, lane);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        const int status = static_cast<int>(e.GetHttpStatus());
+
+        // An error of the client (4xx) shows that TCIA is up
+        call.SetOutcome(status >= 400 && status < 500);
+
+        NegativeCache::GetInstance().Add(url, e.HasDetails() ? e.GetDetails() : e.What());
+
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem,
+                                        "Cannot proxy HTTP request to TCIA: " + url);
+      }
+
+      call.SetOutcome(true);
+
+      item.reset(answer.CreateItem());
+
+      if (!HttpCache::GetInstance().Write(url, item))
+      {
+        LOG(INFO) << "Answer from TCIA is too large to be cached (" << item->GetBody().size()
+                  << " bytes): " << url;
+      }
+    }
+
+    assert(item.get() != NULL);
+    return item;
+  }
+
+
+  boost::shared_ptr<const Json::Value> TciaProxy::GetJson(const std::string& url,
+                                                          RateLimiter::Lane lane)
+  {
+    return Get(url, lane)->GetJson();
+  }
+
+
+  void TciaProxy::ParseFields(Fields& target,
+                              const std::string& value)
+  {
+    target.clear();
+
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, value, ',');
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      const std::string field = Orthanc::Toolbox::StripSpaces(tokens[i]);
+      if (!field.empty())
+      {
+        target.insert(field);
+      }
+    }
+
+    if (target.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "No field is selected: " + value);
+    }
+  }
+
+
+  boost::shared_ptr<const HttpCache::Item> TciaProxy::GetProjection(const std::string& url,
+                                                                    const Fields& fields)
+  {
+    // "GetUrl()" never produces a "#", hence no collision with the full answers
+    std::string key = url + "#fields=";
+
+    for (Fields::const_iterator it = fields.begin(); it != fields.end(); ++it)
+    {
+      if (it != fields.begin())
+      {
+        key += ",";
+      }
+
+      key += *it;
+    }
+
+    boost::shared_ptr<const HttpCache::Item> item;
+
+    if (!HttpCache::GetInstance().Read(item, key))
+    {
+      Json::Value projected;
+      ProjectFields(projected, *GetJson(url, RateLimiter::Lane_Interactive), fields);
+
+      std::string body;
+      WriteFastJson(body, projected);
+
+      item.reset(new HttpCache::Item(body, "application/json"));
+      HttpCache::GetInstance().Write(key, item);
+    }
+
+    assert(item.get() != NULL);
+    return item;
+  }
+
+
+  void TciaProxy::Answer(OrthancPluginRestOutput* output,
+                         const OrthancPluginHttpRequest* request,
+                         const std::string& url,
+                         const Fields& fields)
+  {
+    boost::shared_ptr<const HttpCache::Item> item = (fields.empty() ? Get(url, RateLimiter::Lane_Interactive) : GetProjection(url, fields));
+    HttpHelpers::AnswerBuffer(output, request, item->GetBody(), item->GetMime(), item->GetETag());
+  }
+}
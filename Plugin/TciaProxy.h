@@ -0,0 +1,75 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "HttpCache.h"
+#include "RateLimiter.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <set>
+
+
+namespace OrthancPlugins
+{
+  class TciaProxy : public boost::noncopyable
+  {
+  public:
+    typedef std::map<std::string, std::string>  Arguments;
+    typedef std::set<std::string>               Fields;
+
+    // Builds the full URL to TCIA, with the given GET arguments. The path must not contain "#".
+    static std::string GetUrl(const std::string& path,
+                              const Arguments& arguments);
+
+    /**
+     * Returns the answer of TCIA to a GET request, from the cache if
+     * available. The body is received by chunks from TCIA and stored
+     * only once in memory: The same buffer is shared with the cache,
+     * unless it is larger than the maximum size of the cached items.
+     * The cache misses are sent to TCIA through the given lane of the
+     * rate limiter.
+     **/
+    static boost::shared_ptr<const HttpCache::Item> Get(const std::string& url,
+                                                        RateLimiter::Lane lane);
+
+    static boost::shared_ptr<const Json::Value> GetJson(const std::string& url,
+                                                        RateLimiter::Lane lane);
+
+    // Parses a comma-separated list of fields, as in "SeriesInstanceUID,Modality,ImageCount"
+    static void ParseFields(Fields& target,
+                            const std::string& value);
+
+    /**
+     * Same as "Get()", but only keeps the given fields in the JSON
+     * objects of the answer. The projected answer is cached by itself,
+     * under a key that includes the fields, so that it is not
+     * projected again by the next requests.
+     **/
+    static boost::shared_ptr<const HttpCache::Item> GetProjection(const std::string& url,
+                                                                  const Fields& fields);
+
+    // The answer is projected onto the given fields, unless no field is given
+    static void Answer(OrthancPluginRestOutput* output,
+                       const OrthancPluginHttpRequest* request,
+                       const std::string& url,
+                       const Fields& fields);
+  };
+}
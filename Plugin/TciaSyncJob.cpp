@@ -0,0 +1,282 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TciaSyncJob.h"
+
+#include "MetadataMirror.h"
+#include "SearchIndex.h"
+#include "TciaMirrorJob.h"
+
+#include <Logging.h>
+#include <SerializationToolbox.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+#include <stdio.h>
+
+
+static const char* const JOB_TYPE = "TciaSyncJob";
+
+static boost::mutex     schedulerMutex_;
+static boost::thread    schedulerThread_;
+static bool             schedulerStop_ = false;
+static boost::mutex     activeJobMutex_;
+static std::string      activeJobId_;    // Last submitted job that updates the mirror, protected by "activeJobMutex_"
+
+
+namespace OrthancPlugins
+{
+  // NBIA expects the "fromDate" argument in the "DD/MM/YYYY" format
+  static std::string FormatNbiaDate(const std::string& date)
+  {
+    if (date.size() != 8)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Badly formatted date: " + date);
+    }
+    else
+    {
+      return date.substr(6, 2) + "/" + date.substr(4, 2) + "/" + date.substr(0, 4);
+    }
+  }
+
+
+  void TciaSyncJob::UpdateInfo()
+  {
+    {
+      Json::Value serialized = Json::objectValue;
+      OrthancJob::UpdateSerialized(serialized);
+    }
+
+    {
+      Json::Value content = Json::objectValue;
+      content["UpdatedSeries"] = static_cast<unsigned int>(updatedCount_);
+
+      if (!fromDate_.empty())
+      {
+        content["FromDate"] = fromDate_;
+      }
+
+      OrthancJob::UpdateContent(content);
+    }
+  }
+
+
+  TciaSyncJob::TciaSyncJob() :
+    OrthancJob(JOB_TYPE),
+    updatedCount_(0)
+  {
+    UpdateInfo();
+  }
+
+
+  OrthancPluginJobStepStatus TciaSyncJob::Step()
+  {
+    MetadataMirror& mirror = MetadataMirror::GetInstance();
+
+    if (!mirror.LookupLastUpdate(fromDate_))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "The TCIA mirror must be fully refreshed once before it can be synchronized");
+    }
+
+    /**
+     * The new watermark is taken before calling TCIA, and the
+     * watermark date is included in the query: The series that are
+     * updated during the sync will be received again by the next
+     * sync, which is harmless as the patching is idempotent.
+     **/
+    const std::string now = GetCurrentDate();
+
+    std::map<std::string, std::string> arguments;
+    arguments["fromDate"] = FormatNbiaDate(fromDate_);
+
+    Json::Value answer;
+    TciaMirrorJob::GetFromTcia(answer, "getUpdatedSeries", arguments);
+
+    std::vector<MetadataMirror::Series> series;
+    MetadataMirror::Series::Parse(series, answer);
+
+    mirror.UpsertSeries(series);
+    mirror.SetLastUpdate(now);
+    mirror.Save();
+    SearchIndex::GetInstance().Update();
+
+    updatedCount_ = series.size();
+    UpdateInfo();
+
+    LOG(INFO) << "TCIA mirror synchronized since " << fromDate_ << ": " << updatedCount_ << " updated series";
+
+    UpdateProgress(1);
+    return OrthancPluginJobStepStatus_Success;
+  }
+
+
+  void TciaSyncJob::Reset()
+  {
+    fromDate_.clear();
+    updatedCount_ = 0;
+    UpdateInfo();
+  }
+
+
+  std::string TciaSyncJob::GetJobType()
+  {
+    return JOB_TYPE;
+  }
+
+
+  TciaSyncJob* TciaSyncJob::Unserialize(const Json::Value& serialized)
+  {
+    // The watermark is read from the mirror, so there is nothing to unserialize
+    return new TciaSyncJob;
+  }
+
+
+  std::string TciaSyncJob::GetCurrentDate()
+  {
+    const boost::gregorian::date today = boost::posix_time::second_clock::universal_time().date();
+
+    char buffer[16];
+    sprintf(buffer, "%04d%02d%02d",
+            static_cast<int>(today.year()),
+            static_cast<int>(today.month()),
+            static_cast<int>(today.day()));
+
+    return buffer;
+  }
+
+
+  static bool IsJobActive(const std::string& jobId)
+  {
+    Json::Value job;
+    if (jobId.empty() ||
+        !RestApiGet(job, "/jobs/" + jobId, false) ||
+        job.type() != Json::objectValue ||
+        !job.isMember("State") ||
+        job["State"].type() != Json::stringValue)
+    {
+      return false;
+    }
+    else
+    {
+      const std::string state = job["State"].asString();
+      return (state == "Pending" ||
+              state == "Running" ||
+              state == "Retry");
+    }
+  }
+
+
+  static void SchedulerThread(unsigned int intervalSeconds)
+  {
+    unsigned int elapsed = 0;
+
+    for (;;)
+    {
+      {
+        boost::mutex::scoped_lock lock(schedulerMutex_);
+        if (schedulerStop_)
+        {
+          return;
+        }
+      }
+
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+      elapsed++;
+
+      {
+        // Never submit a job while the plugin is being finalized
+        boost::mutex::scoped_lock lock(schedulerMutex_);
+        if (schedulerStop_)
+        {
+          return;
+        }
+      }
+
+      std::string lastUpdate;
+      if (elapsed >= intervalSeconds &&
+          MetadataMirror::GetInstance().LookupLastUpdate(lastUpdate))
+      {
+        elapsed = 0;
+
+        try
+        {
+          std::string jobId;
+          TciaSyncJob::SubmitUnlessActive(jobId, 0 /* priority */);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Cannot submit the job to synchronize the TCIA mirror: " << e.What();
+        }
+      }
+    }
+  }
+
+
+  bool TciaSyncJob::SubmitUnlessActive(std::string& jobId,
+                                       OrthancJob* job,
+                                       int priority)
+  {
+    std::unique_ptr<OrthancJob> protection(job);
+
+    boost::mutex::scoped_lock lock(activeJobMutex_);
+
+    if (IsJobActive(activeJobId_))
+    {
+      jobId = activeJobId_;
+      return false;
+    }
+    else
+    {
+      activeJobId_ = OrthancJob::Submit(protection.release(), priority);
+      jobId = activeJobId_;
+      return true;
+    }
+  }
+
+
+  void TciaSyncJob::StartScheduler(unsigned int intervalSeconds)
+  {
+    boost::mutex::scoped_lock lock(schedulerMutex_);
+
+    if (schedulerThread_.joinable())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else if (intervalSeconds != 0)
+    {
+      schedulerStop_ = false;
+      schedulerThread_ = boost::thread(SchedulerThread, intervalSeconds);
+    }
+  }
+
+
+  void TciaSyncJob::StopScheduler()
+  {
+    {
+      boost::mutex::scoped_lock lock(schedulerMutex_);
+      schedulerStop_ = true;
+    }
+
+    if (schedulerThread_.joinable())
+    {
+      schedulerThread_.join();
+    }
+  }
+}
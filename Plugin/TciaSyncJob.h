@@ -0,0 +1,89 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <Compatibility.h>
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+
+namespace OrthancPlugins
+{
+  /**
+   * Job that brings the local mirror of TCIA up-to-date, by only
+   * asking TCIA for the series that were updated since the last
+   * sync (the "watermark"). The series are patched in place in the
+   * mirror. The mirror must have been fully refreshed once, which
+   * sets the first watermark.
+   *
+   * NB: "getUpdatedSeries" does not report the deleted series, which
+   * are only removed from the mirror by a full refresh.
+   **/
+  class TciaSyncJob : public OrthancJob
+  {
+  private:
+    std::string  fromDate_;
+    size_t       updatedCount_;
+
+    void UpdateInfo();
+
+  public:
+    TciaSyncJob();
+
+    virtual OrthancPluginJobStepStatus Step() ORTHANC_OVERRIDE;
+
+    virtual void Stop(OrthancPluginJobStopReason reason) ORTHANC_OVERRIDE
+    {
+    }
+
+    virtual void Reset() ORTHANC_OVERRIDE;
+
+    static std::string GetJobType();
+
+    static TciaSyncJob* Unserialize(const Json::Value& serialized);
+
+    // Current UTC date, in the "YYYYMMDD" format
+    static std::string GetCurrentDate();
+
+    /**
+     * Submits a job that updates the mirror (a sync job or a
+     * TciaMirrorJob), unless the previous such job is still pending or
+     * running, in which case its identifier is returned. This is
+     * shared by the REST API and the scheduler, so that a refresh and
+     * a sync never run at once. Returns "true" iff a new job was
+     * submitted.
+     **/
+    static bool SubmitUnlessActive(std::string& jobId,
+                                   OrthancJob* job /* takes ownership */,
+                                   int priority);
+
+    // Submits a sync job, unless a job that updates the mirror is active
+    static bool SubmitUnlessActive(std::string& jobId,
+                                   int priority)
+    {
+      return SubmitUnlessActive(jobId, new TciaSyncJob, priority);
+    }
+
+    // Periodically submits a sync job, if the mirror has a watermark ("0" disables the sync)
+    static void StartScheduler(unsigned int intervalSeconds);
+
+    static void StopScheduler();
+  };
+}
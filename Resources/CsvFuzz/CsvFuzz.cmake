@@ -0,0 +1,73 @@
+# TCIA plugin for Orthanc
+# Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+#
+# This program is free software: you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+# Differential fuzzer of "Plugin/CsvTokenizer.cpp" against libcsv,
+# which the plugin used before. One executable is built per code path
+# of the tokenizer: Runtime dispatch (AVX2 if supported by the CPU,
+# otherwise SSE2), SSE2 only, and scalar only. Run them on the corpus:
+#
+#   ./CsvFuzz ../Resources/CsvFuzz/Corpus/*.csv
+#   ./CsvFuzzSse2 ../Resources/CsvFuzz/Corpus/*.csv
+#   ./CsvFuzzScalar ../Resources/CsvFuzz/Corpus/*.csv
+
+
+if (STATIC_BUILD OR NOT USE_SYSTEM_LIBCSV)
+  set(LIBCSV_SOURCES_DIR ${CMAKE_BINARY_DIR}/libcsv-3.0.3)
+  DownloadPackage(
+    "d3307a7bd41d417da798cd80c80aa42a"
+    "https://orthanc.uclouvain.be/downloads/third-party-downloads/libcsv-3.0.3.tar.gz"
+    "${LIBCSV_SOURCES_DIR}")
+
+  set(LIBCSV_INCLUDE_DIRS ${LIBCSV_SOURCES_DIR})
+  set(LIBCSV_SOURCES ${LIBCSV_SOURCES_DIR}/libcsv.c)
+  set(LIBCSV_LIBRARIES)
+
+else()
+  check_include_file(csv.h HAVE_LIBCSV_H)
+  if (NOT HAVE_LIBCSV_H)
+    message(FATAL_ERROR "Please install the libcsv-dev package")
+  endif()
+
+  set(LIBCSV_INCLUDE_DIRS)
+  set(LIBCSV_SOURCES)
+  set(LIBCSV_LIBRARIES csv)
+endif()
+
+
+macro(AddCsvFuzzExecutable Name Definitions)
+  add_executable(${Name}
+    ${CMAKE_SOURCE_DIR}/Plugin/CsvTokenizer.cpp
+    ${CMAKE_SOURCE_DIR}/Resources/CsvFuzz/CsvFuzz.cpp
+    ${LIBCSV_SOURCES}
+    ${ORTHANC_CORE_SOURCES}
+    )
+
+  target_include_directories(${Name} PRIVATE ${LIBCSV_INCLUDE_DIRS})
+  target_link_libraries(${Name} ${LIBCSV_LIBRARIES})
+
+  if (NOT "${Definitions}" STREQUAL "")
+    set_target_properties(${Name} PROPERTIES COMPILE_DEFINITIONS "${Definitions}")
+  endif()
+
+  if (COMMAND DefineSourceBasenameForTarget)
+    DefineSourceBasenameForTarget(${Name})
+  endif()
+endmacro()
+
+AddCsvFuzzExecutable(CsvFuzz "")
+AddCsvFuzzExecutable(CsvFuzzSse2 "ORTHANC_CSV_HAS_AVX2=0")
+AddCsvFuzzExecutable(CsvFuzzScalar "ORTHANC_CSV_HAS_SSE2=0;ORTHANC_CSV_HAS_AVX2=0")
@@ -0,0 +1,303 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+/**
+ * Differential fuzzer of "CsvTokenizer" against libcsv, configured as
+ * in the former versions of the plugin. Each input is tokenized by
+ * libcsv, then by "CsvTokenizer" at once and by random chunks: The
+ * rows must be identical. The inputs are the files of the corpus that
+ * are given on the command line, followed by random documents over
+ * the characters that drive the state machine of libcsv.
+ *
+ * Usage: CsvFuzz [--iterations N] [--seed S] [corpus files...]
+ **/
+
+
+#include "../../Plugin/CsvTokenizer.h"
+
+#include <csv.h>
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+typedef std::vector<std::vector<std::string> >  Rows;
+
+
+class RowsCollector : public OrthancPlugins::CsvTokenizer::IHandler
+{
+private:
+  Rows&                     rows_;
+  std::vector<std::string>  current_;
+
+public:
+  explicit RowsCollector(Rows& rows) :
+    rows_(rows)
+  {
+  }
+
+  virtual void OnCell(const char* data,
+                      size_t size)
+  {
+    current_.push_back(std::string(data, size));
+  }
+
+  virtual void OnRow()
+  {
+    rows_.push_back(current_);
+    current_.clear();
+  }
+
+  static void OnLibCsvCell(void* data,
+                           size_t size,
+                           void* payload)
+  {
+    reinterpret_cast<RowsCollector*>(payload)->OnCell(reinterpret_cast<const char*>(data), size);
+  }
+
+  static void OnLibCsvRow(int /* terminator */,
+                          void* payload)
+  {
+    reinterpret_cast<RowsCollector*>(payload)->OnRow();
+  }
+};
+
+
+// Same blanks and line terminators as the former versions of the plugin
+static int IsSpace(unsigned char c)
+{
+  return (c == CSV_SPACE || c == CSV_TAB);
+}
+
+
+static int IsEndOfLine(unsigned char c)
+{
+  return (c == CSV_CR || c == CSV_LF);
+}
+
+
+static void TokenizeWithLibCsv(Rows& rows,
+                               const std::string& csv)
+{
+  RowsCollector collector(rows);
+
+  struct csv_parser parser;
+  if (csv_init(&parser, 0) != 0)
+  {
+    throw std::runtime_error("Cannot initialize libcsv");
+  }
+
+  csv_set_space_func(&parser, IsSpace);
+  csv_set_term_func(&parser, IsEndOfLine);
+
+  const bool success = (csv_parse(&parser, csv.c_str(), csv.size(), RowsCollector::OnLibCsvCell,
+                                  RowsCollector::OnLibCsvRow, &collector) == csv.size() &&
+                        csv_fini(&parser, RowsCollector::OnLibCsvCell, RowsCollector::OnLibCsvRow, &collector) == 0);
+
+  csv_free(&parser);
+
+  if (!success)
+  {
+    throw std::runtime_error("libcsv cannot parse the input");
+  }
+}
+
+
+// The chunks have random sizes, "0" meaning that the input is given at once
+static void TokenizeWithPlugin(Rows& rows,
+                               const std::string& csv,
+                               size_t maximumChunkSize)
+{
+  RowsCollector collector(rows);
+  OrthancPlugins::CsvTokenizer tokenizer;
+
+  size_t position = 0;
+  while (position < csv.size())
+  {
+    size_t size = csv.size() - position;
+    if (maximumChunkSize != 0)
+    {
+      size = std::min(size, static_cast<size_t>(1 + rand() % maximumChunkSize));
+    }
+
+    tokenizer.Parse(collector, csv.c_str() + position, size);
+    position += size;
+  }
+
+  tokenizer.Finish(collector);
+}
+
+
+static std::string Escape(const std::string& s)
+{
+  std::string escaped;
+
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    const unsigned char c = static_cast<unsigned char>(s[i]);
+    if (c >= 32 && c < 127 && c != '\\')
+    {
+      escaped.push_back(c);
+    }
+    else
+    {
+      char buffer[8];
+      sprintf(buffer, "\\x%02x", c);
+      escaped += buffer;
+    }
+  }
+
+  return escaped;
+}
+
+
+static bool Check(const std::string& csv,
+                  const std::string& source)
+{
+  Rows expected;
+  TokenizeWithLibCsv(expected, csv);
+
+  // At once, then by chunks that are small enough to split the SIMD blocks, then by larger chunks
+  static const size_t CHUNK_SIZES[] = { 0, 1, 7, 40, 200 };
+
+  for (size_t i = 0; i < sizeof(CHUNK_SIZES) / sizeof(CHUNK_SIZES[0]); i++)
+  {
+    Rows actual;
+    TokenizeWithPlugin(actual, csv, CHUNK_SIZES[i]);
+
+    if (actual != expected)
+    {
+      std::cerr << "MISMATCH with libcsv (" << source << ", maximum chunk size "
+                << CHUNK_SIZES[i] << "): \"" << Escape(csv) << "\"" << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+static std::string GenerateRandomInput()
+{
+  // The characters that change the state of libcsv, plus some ordinary and non-ASCII characters
+  static const char ALPHABET[] = { 'a', 'b', 'x', ',', '"', ' ', '\t', '\r', '\n', '\xe9', '\0' };
+
+  std::string csv;
+
+  const size_t length = rand() % 120;
+  for (size_t i = 0; i < length; i++)
+  {
+    if (rand() % 10 == 0)
+    {
+      // Long runs cross the boundaries of the SIMD blocks
+      csv.append(rand() % 70, 'z');
+    }
+    else
+    {
+      csv.push_back(ALPHABET[rand() % sizeof(ALPHABET)]);
+    }
+  }
+
+  return csv;
+}
+
+
+int main(int argc, char* argv[])
+{
+  unsigned int iterations = 200000;
+  unsigned int seed = 42;
+  std::vector<std::string> corpus;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg(argv[i]);
+
+    if (arg == "--iterations" && i + 1 < argc)
+    {
+      iterations = static_cast<unsigned int>(atoi(argv[++i]));
+    }
+    else if (arg == "--seed" && i + 1 < argc)
+    {
+      seed = static_cast<unsigned int>(atoi(argv[++i]));
+    }
+    else
+    {
+      corpus.push_back(arg);
+    }
+  }
+
+  std::cout << "Instruction set of the tokenizer: " << OrthancPlugins::CsvTokenizer::GetInstructionSet() << std::endl;
+
+  srand(seed);
+
+  try
+  {
+    for (size_t i = 0; i < corpus.size(); i++)
+    {
+      std::ifstream f(corpus[i].c_str(), std::ios::binary);
+      if (!f)
+      {
+        std::cerr << "Cannot read file: " << corpus[i] << std::endl;
+        return -1;
+      }
+
+      std::stringstream content;
+      content << f.rdbuf();
+
+      if (!Check(content.str(), corpus[i]))
+      {
+        return -1;
+      }
+    }
+
+    std::cout << corpus.size() << " files of the corpus: identical rows" << std::endl;
+
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+      if (!Check(GenerateRandomInput(), "random input"))
+      {
+        return -1;
+      }
+    }
+
+    std::cout << iterations << " random inputs (seed " << seed << "): identical rows" << std::endl;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    std::cerr << "Exception: " << e.What() << std::endl;
+    return -1;
+  }
+  catch (std::exception& e)
+  {
+    std::cerr << "Exception: " << e.what() << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -15,26 +15,14 @@
 # along with this program. If not, see <http://www.gnu.org/licenses/>.
 
 
-if (STATIC_BUILD OR NOT USE_SYSTEM_LIBCSV)
-  set(LIBCSV_SOURCES_DIR ${CMAKE_BINARY_DIR}/libcsv-3.0.3)
-  DownloadPackage(
-    "d3307a7bd41d417da798cd80c80aa42a"
-    "https://orthanc.uclouvain.be/downloads/third-party-downloads/libcsv-3.0.3.tar.gz"
-    "${LIBCSV_SOURCES_DIR}")
-
-  include_directories(
-    ${LIBCSV_SOURCES_DIR}
-    )
-
-  set(LIBCSV_SOURCES
-    ${LIBCSV_SOURCES_DIR}/libcsv.c
-    )
+# Benchmark of "Plugin/IntegerParser.cpp" against "boost::lexical_cast"
+# on the cells of one million rows of an NBIA spreadsheet. Build in
+# release mode, then run:
+#
+#   ./IntegerParserBenchmark
 
-else()
-  check_include_file(csv.h HAVE_LIBCSV_H)
-  if (NOT HAVE_LIBCSV_H)
-    message(FATAL_ERROR "Please install the libcsv-dev package")
-  endif()
 
-  link_libraries(csv)
-endif()
+add_executable(IntegerParserBenchmark
+  ${CMAKE_SOURCE_DIR}/Plugin/IntegerParser.cpp
+  ${CMAKE_SOURCE_DIR}/Resources/IntegerParserBenchmark/IntegerParserBenchmark.cpp
+  )
@@ -0,0 +1,209 @@
+/**
+ * TCIA plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+/**
+ * Benchmark of "IntegerParser" against "boost::lexical_cast", which
+ * the plugin used before, on the "FileSize" cells of one million rows
+ * of an NBIA spreadsheet. A given ratio of the cells is malformed, as
+ * "lexical_cast" is much slower if it throws. Both parsers must agree
+ * on every cell. Each measure is repeated, and the range is printed.
+ *
+ * Usage: IntegerParserBenchmark [--rows N] [--repeat N]
+ **/
+
+
+#include "../../Plugin/IntegerParser.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+// Parsing of the cells by the former versions of the plugin
+static bool ParseWithLexicalCast(uint64_t& target,
+                                 const std::string& value)
+{
+  try
+  {
+    target = boost::lexical_cast<uint64_t>(value);
+    return true;
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    return false;
+  }
+}
+
+
+static bool ParseWithIntegerParser(uint64_t& target,
+                                   const std::string& value)
+{
+  return OrthancPlugins::IntegerParser::ParseUnsignedInteger64(target, value);
+}
+
+
+static void GenerateCells(std::vector<std::string>& cells,
+                          size_t rows,
+                          unsigned int malformedPercent)
+{
+  static const char* const MALFORMED[] = { "12.5 MB", "n/a", "1e6", "0x400", "-1" };
+
+  srand(42);
+
+  cells.clear();
+  cells.reserve(rows);
+
+  for (size_t i = 0; i < rows; i++)
+  {
+    if (static_cast<unsigned int>(rand() % 100) < malformedPercent)
+    {
+      cells.push_back(MALFORMED[rand() % (sizeof(MALFORMED) / sizeof(MALFORMED[0]))]);
+    }
+    else
+    {
+      // Typical sizes of the series, from a few kilobytes to a few gigabytes
+      char buffer[32];
+      sprintf(buffer, "%lu", static_cast<unsigned long>(rand()) * static_cast<unsigned long>(1 + rand() % 64));
+      cells.push_back(buffer);
+    }
+  }
+}
+
+
+static bool Verify(const std::vector<std::string>& cells)
+{
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    uint64_t a, b;
+    const bool isLexicalValid = ParseWithLexicalCast(a, cells[i]);
+    const bool isParserValid = ParseWithIntegerParser(b, cells[i]);
+
+    if (isLexicalValid != isParserValid ||
+        (isLexicalValid && a != b))
+    {
+      // "lexical_cast" wraps the negative values around, which "IntegerParser" rejects on purpose
+      if (cells[i].empty() ||
+          cells[i][0] != '-' ||
+          isParserValid)
+      {
+        std::cerr << "The parsers disagree on: " << cells[i] << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+// Returns the duration in milliseconds, and the sum of the parsed values to prevent the optimizer from skipping the loop
+template <typename Parser>
+static double Measure(uint64_t& sum,
+                      size_t& failures,
+                      const std::vector<std::string>& cells,
+                      Parser parser)
+{
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  sum = 0;
+  failures = 0;
+
+  for (size_t i = 0; i < cells.size(); i++)
+  {
+    uint64_t value;
+    if (parser(value, cells[i]))
+    {
+      sum += value;
+    }
+    else
+    {
+      failures++;
+    }
+  }
+
+  const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+  return static_cast<double>((end - start).total_microseconds()) / 1000.0;
+}
+
+
+int main(int argc, char* argv[])
+{
+  size_t rows = 1000000;
+  unsigned int repeat = 5;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--rows") && i + 1 < argc)
+    {
+      rows = static_cast<size_t>(atol(argv[++i]));
+    }
+    else if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+    {
+      repeat = std::max(1, atoi(argv[++i]));
+    }
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--rows N] [--repeat N]" << std::endl;
+      return -1;
+    }
+  }
+
+  static const unsigned int MALFORMED_PERCENTS[] = { 0, 1, 10 };
+
+  std::cout << "Parsing " << rows << " cells, " << repeat << " times (durations in ms)" << std::endl;
+
+  for (size_t i = 0; i < sizeof(MALFORMED_PERCENTS) / sizeof(MALFORMED_PERCENTS[0]); i++)
+  {
+    std::vector<std::string> cells;
+    GenerateCells(cells, rows, MALFORMED_PERCENTS[i]);
+
+    if (!Verify(cells))
+    {
+      return -1;
+    }
+
+    double lexicalMin = 0, lexicalMax = 0, parserMin = 0, parserMax = 0;
+
+    for (unsigned int j = 0; j < repeat; j++)
+    {
+      uint64_t sum;
+      size_t failures;
+
+      const double lexical = Measure(sum, failures, cells, ParseWithLexicalCast);
+      const double parser = Measure(sum, failures, cells, ParseWithIntegerParser);
+
+      lexicalMin = (j == 0 ? lexical : std::min(lexicalMin, lexical));
+      lexicalMax = (j == 0 ? lexical : std::max(lexicalMax, lexical));
+      parserMin = (j == 0 ? parser : std::min(parserMin, parser));
+      parserMax = (j == 0 ? parser : std::max(parserMax, parser));
+    }
+
+    printf("%3u%% malformed   lexical_cast %.0f-%.0f, IntegerParser %.0f-%.0f\n",
+           MALFORMED_PERCENTS[i], lexicalMin, lexicalMax, parserMin, parserMax);
+  }
+
+  return 0;
+}
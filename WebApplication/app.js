@@ -54,6 +54,13 @@ var app = new Vue({
       activeCollection : '',
       activePatientId : '',
       patients : [],
+      patientsTotal : 0,
+      patientsOffset : 0,
+      patientsFilter : '',
+      patientsPageSize : 100,
+      filterTimeout : null,
+      searchResults : [],
+      searchTotal : 0,
       studies : [],
       series : {},
       openedStudies : {},
@@ -73,6 +80,30 @@ var app = new Vue({
     }
   },
   
+  watch: {
+    filter: function() {
+      // The subjects are filtered on the server side, wait for the
+      // user to stop typing before sending the query
+      if (this.activeCollection != '' &&
+          this.activePatientId == '' &&
+          this.filter != this.patientsFilter) {
+        var that = this;
+        clearTimeout(this.filterTimeout);
+        this.filterTimeout = setTimeout(function() {
+          that.loadPatients(0);
+        }, 300);
+      }
+      else if (this.activeCollection == '') {
+        // Search the local mirror of TCIA, across all the levels
+        var that = this;
+        clearTimeout(this.filterTimeout);
+        this.filterTimeout = setTimeout(function() {
+          that.searchMirror();
+        }, 300);
+      }
+    }
+  },
+
   methods: {
     openJob: function() {
       if (this.jobId != '') {
@@ -83,87 +114,22 @@ var app = new Vue({
     refreshSeriesCount: function() {
       var that = this;
 
-      // The use of "let" instead of "var" is mandatory so that the
-      // scope of "i" matches that of the "for" loop
-      for (let i = 0; i < that.importedPatients.length; i++) {
-        axios.post('../../tools/find', {
-          'Expand' : true,
-          'Level' : 'Series',
-          'Query' : {
-            'PatientID' : that.importedPatients[i].PatientID
-          }
-        })
-          .then(function(series) {
-            var availableSeries = new Set();
-            for (var j = 0; j < series.data.length; j++) {
-              availableSeries.add(series.data[j].MainDicomTags.SeriesInstanceUID);
-            }
-            
-            var count = 0;
-            for (var j = 0; j < that.importedPatients[i].SeriesInstanceUID.length; j++) {
-              if (availableSeries.has(that.importedPatients[i].SeriesInstanceUID[j])) {
-                count ++;
-              }
-            }
-
-            that.importedPatients[i].CompletedSeries = count;
-          });
-      }
-    },
-
-    getJobPatients: function() {
-      this.importedPatients = [];
-
       if (this.jobId == '') {
         return;
       }
-      
-      var that = this;
-      
-      axios.get('../../jobs/' + this.jobId)
-        .then(function(job) {
-          var series = job.data.Content.Series;
-          var index = {};
-          
-          for (var i = 0; i < series.length; i++) {
-            var id = (series[i].Collection + '|' + series[i].PatientID);
-            
-            if (id in index) {
-              var patient = index[id];
-              patient.SeriesInstanceUID.push(series[i].SeriesInstanceUID);
-              patient.InstancesCount += series[i].InstancesCount;
-              patient.Size += parseInt(series[i].Size, 10);
-            }
-            else {
-              index[id] = {
-                'Collection' : series[i].Collection,
-                'PatientID' : series[i].PatientID,
-                'OrthancID' : series[i].OrthancID,
-                'CompletedSeries' : 0,
-                'SeriesInstanceUID' : [ series[i].SeriesInstanceUID ],
-                'InstancesCount' : series[i].InstancesCount,
-                'Size' : parseInt(series[i].Size, 10)
-              }
-            }
-          }
-
-          that.importedPatients = Object.values(index);
-          
-          that.importedPatients.sort(function(a, b) {
-            if (a.Collection < b.Collection) {
-              return -1;
-            }
-            else if (a.Collection > b.Collection) {
-              return 1;
-            }
-            else {
-              return a.PatientID < b.PatientID ? -1 : 1;
-            }
-          });
 
-          that.refreshSeriesCount();
+      axios.post('../import-status', {
+        'Job' : this.jobId
+      })
+        .then(function(status) {
+          that.importedPatients = status.data.Patients;
         });
     },
+
+    getJobPatients: function() {
+      this.importedPatients = [];
+      this.refreshSeriesCount();
+    },
     
     importCart: function() {
       var that = this;
@@ -173,31 +139,24 @@ var app = new Vue({
         alert('No cart was provided');
       }
       else {
-        var reader = new FileReader();
-        reader.readAsText(blob);
-        reader.onerror = function (error) {
-          alert('Cannot read the cart');
-        };
-        reader.onload = function () {
-          that.jobId = '';
-          that.importedPatients = [];
-          
-          var base64 = btoa(reader.result);
-          
-          axios.post('../import', {
-            'Type' : 'NbiaClientSpreadsheet',
-            'Content' : base64,
-            'Asynchronous' : true
+        that.jobId = '';
+        that.importedPatients = [];
+
+        // The raw file is streamed to the plugin, which parses it as it arrives
+        var isManifest = /\.tcia$/i.test(blob.name);
+        var route = isManifest ? '../import/manifest' : '../import/spreadsheet';
+
+        axios.post(route + '?Asynchronous=true', blob, {
+          headers: { 'Content-Type' : isManifest ? 'text/plain' : 'text/csv' }
+        })
+          .then(function(response) {
+            that.jobId = response.data.ID;
+            that.getJobPatients();
+            window.location.href = '#import-status';
           })
-            .then(function(response) {
-              that.jobId = response.data.ID;
-              that.getJobPatients();
-              window.location.href = '#import-status';
-            })
-            .catch(function(error) {
-              alert('Cannot process the cart, check that this is a valid NBIA spreadsheet file in CSV format');
-            });
-        };
+          .catch(function(error) {
+            alert('Cannot process the cart, check that this is a valid NBIA spreadsheet file in CSV format, or a valid .tcia manifest');
+          });
       }
     },
 
@@ -241,18 +200,83 @@ var app = new Vue({
       window.location.href = '#explore-tcia';
     },
 
-    openCollection : function(collection) {
+    loadPatients : function(offset) {
       var that = this;
-      
-      axios.get('../proxy/getPatient', {
+      var filter = this.filter;
+
+      return axios.get('../browse/patients', {
         params : {
-          Collection : collection
+          Collection : this.activeCollection,
+          filter : filter,
+          sort : 'PatientId',
+          offset : offset,
+          limit : this.patientsPageSize
         }
       })
         .then(function(patients) {
-          that.activeCollection = collection;
-          that.patients = patients.data;
-          that.filter = '';
+          that.patients = patients.data.Items;
+          that.patientsTotal = patients.data.Total;
+          that.patientsOffset = offset;
+          that.patientsFilter = filter;
+        });
+    },
+
+    previousPatients : function() {
+      this.loadPatients(Math.max(0, this.patientsOffset - this.patientsPageSize));
+    },
+
+    nextPatients : function() {
+      if (this.patientsOffset + this.patientsPageSize < this.patientsTotal) {
+        this.loadPatients(this.patientsOffset + this.patientsPageSize);
+      }
+    },
+
+    searchMirror : function() {
+      var that = this;
+      var query = this.filter;
+
+      if (query == '') {
+        this.searchResults = [];
+        this.searchTotal = 0;
+        return;
+      }
+
+      axios.get('../search', {
+        params : {
+          q : query,
+          limit : 20
+        }
+      })
+        .then(function(matches) {
+          if (that.filter == query) {
+            that.searchResults = matches.data.Items;
+            that.searchTotal = matches.data.Total;
+          }
+        });
+    },
+
+    openSearchResult : function(match) {
+      var that = this;
+
+      this.openCollection(match.Collection)
+        .then(function() {
+          if (match.Level != 'Collection') {
+            that.openPatient(match.PatientID);
+          }
+        });
+    },
+
+    openCollection : function(collection) {
+      var that = this;
+
+      this.activeCollection = collection;
+      this.filter = '';
+      this.patientsFilter = '';
+      this.searchResults = [];
+      this.searchTotal = 0;
+      
+      return this.loadPatients(0)
+        .then(function() {
           window.location.href = '#explore-tcia';
         });
     },
@@ -260,10 +284,12 @@ var app = new Vue({
     openPatient : function(patientId) {
       var that = this;
       
-      axios.get('../proxy/getPatientStudy', {
+      axios.get('../patient', {
         params : {
           Collection : this.activeCollection,
-          PatientID : patientId
+          PatientID : patientId,
+          // Only the fields of the series that are displayed or imported
+          fields : 'SeriesInstanceUID,SeriesDescription,Modality,BodyPartExamined,Manufacturer,ImageCount'
         }
       })
         .then(function(studies) {
@@ -273,24 +299,12 @@ var app = new Vue({
           that.openedStudies = {};
           that.series = {};
           that.selectedSeries = {};
+
+          for (var i = 0; i < studies.data.length; i++) {
+            that.series[studies.data[i].StudyInstanceUID] = studies.data[i].Series;
+          }
+
           window.location.href = '#explore-tcia';
-          
-          axios.get('../proxy/getSeries', {
-            params : {
-              Collection : this.activeCollection,
-              PatientID : patientId
-            }
-          })
-            .then(function(series) {
-              that.series = {};
-              for (var i = 0; i < series.data.length; i++) {
-                var studyInstanceUid = series.data[i].StudyInstanceUID;
-                if (!(studyInstanceUid in that.series)) {
-                  that.series[studyInstanceUid] = [];
-                }
-                that.series[studyInstanceUid].push(series.data[i]);
-              }
-            });
         });
     },
 
@@ -374,7 +388,11 @@ var app = new Vue({
   mounted: function() {
     var that = this;
     
-    axios.get('../proxy/getCollectionValues')
+    axios.get('../proxy/getCollectionValues', {
+      params : {
+        fields : 'Collection'
+      }
+    })
       .then(function(collections) {
         // Only use 1 axios query at a time, in order to avoid
         // overwhelming the browser
@@ -385,7 +403,8 @@ var app = new Vue({
             
             axios.get('../proxy/getModalityValues', {
               params : {
-                Collection : collection.Name
+                Collection : collection.Name,
+                fields : 'Modality'
               }
             })
               .then(function(modalities) {
@@ -403,7 +422,8 @@ var app = new Vue({
             
             axios.get('../proxy/getBodyPartValues', {
               params : {
-                Collection : collection.Name
+                Collection : collection.Name,
+                fields : 'BodyPartExamined'
               }
             })
               .then(function(parts) {